@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Heap allocations and time per serialized message. The global operator new is
+// replaced with a counting one, the figures cover the message construction and
+// its serialization into a pooled buffer as the parser sends it.
+//
+// alloc_bench [messages count=100000]
+
+#include "stdafx.h"
+
+#include "../utils/BufferPool.h"
+#include "../utils/Protocol.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> g_allocations{ 0 };
+}
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    template<typename MakeT>
+    void Run(const char* name, int count, MakeT&& make)
+    {
+        auto pool = MakeBufferPool();
+        // the pool holds the buffers of the warm up, the loop reuses them
+        for (int i = 0; i < 16; ++i)
+            make(i, *pool);
+
+        size_t bytes = 0;
+        const auto allocations = g_allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i)
+            bytes += make(i, *pool)->size();
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        printf("%-14s %6.2f allocs/message %6lld ns/message %4zu bytes/message\n", name,
+            double(g_allocations.load() - allocations) / count,
+            (long long)(ns / count), bytes / count);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int count = argc > 1 ? std::max(1, atoi(argv[1])) : 100000;
+
+    Run("SetHWLO64", count, [](int i, IBufferPool& pool) {
+        return Protocol::SerializeMessage(Protocol::Make_SetHWLO64_Msg({}, { 100000000 + i }),
+            ExtIO_TCP_Proto::MsgType::Request, i, pool);
+    });
+    Run("ExtIoGetAGCs", count, [](int i, IBufferPool& pool) {
+        return Protocol::SerializeMessage(Protocol::Make_ExtIoGetAGCs_Msg({ 0 }, { i % 8 }, { "AGC" }),
+            ExtIO_TCP_Proto::MsgType::Responce, i, pool);
+    });
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Throughput of the packet checksums over the payload sizes the connection
+// carries, from the 4 KB control packets to the 1 MB IQ blocks.
+//
+// checksum_bench [MB per measurement=256]
+
+#include "stdafx.h"
+
+#include "../utils/Checksum.h"
+
+namespace
+{
+    // the sums keep the calls from being optimized out
+    volatile uint32_t g_sink = 0;
+
+    double Measure(Checksum::Kind kind, const std::vector<uint8_t>& data, size_t size, size_t totalBytes)
+    {
+        const size_t repeats = std::max<size_t>(1, totalBytes / size);
+        uint32_t sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repeats; ++r)
+            sum += Checksum::Calc(kind, data.data() + (r % 4) * 64, size);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        g_sink = sum;
+        return double(repeats) * size / seconds / 1e9;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t totalBytes = (argc > 1 ? std::max(1, atoi(argv[1])) : 256) * size_t(1024 * 1024);
+    const size_t sizes[] = { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    const Checksum::Kind kinds[] = {
+        Checksum::Kind::Crc32, Checksum::Kind::Crc32c, Checksum::Kind::XxHash64, Checksum::Kind::None };
+
+    // the offsets of the repeats vary the alignment
+    std::vector<uint8_t> data(sizes[std::size(sizes) - 1] + 256);
+    std::mt19937 rng(1);
+    for (auto& b : data)
+        b = uint8_t(rng());
+
+    printf("crc32c instructions: %s\n", Checksum::HasHardwareCrc32c() ? "yes" : "no");
+    printf("%-10s", "GB/s");
+    for (auto size : sizes)
+        printf("%10zu KB", size / 1024);
+    printf("\n");
+    for (auto kind : kinds)
+    {
+        printf("%-10s", Checksum::Name(kind));
+        // none costs the call only, it is off the scale
+        for (auto size : sizes)
+        {
+            const double rate = Measure(kind, data, size, totalBytes);
+            if (rate < 1000.)
+                printf("%13.2f", rate);
+            else
+                printf("%13s", ">1000");
+        }
+        printf("\n");
+    }
+    return 0;
+}
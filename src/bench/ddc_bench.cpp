@@ -0,0 +1,204 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Fidelity and throughput of the server DDC. Tones are fed at the 2.048 MS/s
+// device rate for every decimation: the gain and the spurs of a passband tone,
+// the worst alias folded into 0.4 of the output rate by the tones outside 0.6
+// of it, the SNR of the int16 path and the input samples per second it takes.
+//
+// ddc_bench [throughput repeats=100]
+
+#include "stdafx.h"
+
+#include "../tcp_server/ddc.h"
+
+#include <algorithm>
+#include <complex>
+#include <numbers>
+
+namespace
+{
+    constexpr double c_inputRate = 2.048e6;
+    constexpr double c_offsetHz = 300e3;
+
+    using Samples = std::vector<std::complex<double>>;
+
+    struct BlockStats
+    {
+        size_t samples = 0;
+        int blocks = 0;
+        int malformed = 0;      // blocks not of the block size
+    };
+
+    // Output of the DDC fed with a complex tone of the frequency relative to the device LO
+    Samples Run(extHWtypeT dataType, const IDDC::Config& config, double toneHz, double amplitude, size_t cnt,
+        int blockSize = 0, BlockStats* stats = nullptr)
+    {
+        auto ddc = MakeDDC(dataType, config, c_inputRate, blockSize);
+        Samples out;
+        std::vector<float> f;
+        std::vector<int16_t> s;
+        std::mt19937 rng(3);
+        for (size_t pos = 0; pos < cnt;)
+        {
+            // odd chunks when the blocks are checked, the DDC has to rebuild them
+            const size_t n = std::min<size_t>(blockSize ? 1 + rng() % 5000 : 16384, cnt - pos);
+            f.resize(2 * n);
+            s.resize(2 * n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                const auto v = std::polar(amplitude, 2 * std::numbers::pi * toneHz * double(pos + i) / c_inputRate);
+                f[2 * i] = float(v.real());
+                f[2 * i + 1] = float(v.imag());
+                s[2 * i] = int16_t(std::lrint(v.real()));
+                s[2 * i + 1] = int16_t(std::lrint(v.imag()));
+            }
+            const void* IQdata = dataType == exthwUSBfloat32 ? (const void*)f.data() : (const void*)s.data();
+            ddc->Process(int(n), IQdata, [&](int cnt, void* IQdata) {
+                if (stats)
+                {
+                    stats->samples += cnt;
+                    stats->blocks++;
+                    stats->malformed += cnt != blockSize;
+                }
+                for (int i = 0; i < cnt; ++i)
+                {
+                    if (dataType == exthwUSBfloat32)
+                        out.emplace_back(((float*)IQdata)[2 * i], ((float*)IQdata)[2 * i + 1]);
+                    else
+                        out.emplace_back(((int16_t*)IQdata)[2 * i], ((int16_t*)IQdata)[2 * i + 1]);
+                }
+            });
+            pos += n;
+        }
+        // the filters settle
+        out.erase(out.begin(), out.begin() + std::min<size_t>(200, out.size()));
+        return out;
+    }
+
+    // Complex amplitude of the tone at the frequency relative to the output rate
+    std::complex<double> ToneAmplitude(const Samples& y, double f)
+    {
+        std::complex<double> sum;
+        for (size_t n = 0; n < y.size(); ++n)
+            sum += y[n] * std::polar(1., -2 * std::numbers::pi * f * double(n));
+        return sum / double(y.size());
+    }
+
+    // Power of whatever is left after the tone is subtracted
+    double ResidualPower(const Samples& y, double f, std::complex<double> a)
+    {
+        double sum = 0.;
+        for (size_t n = 0; n < y.size(); ++n)
+            sum += std::norm(y[n] - a * std::polar(1., 2 * std::numbers::pi * f * double(n)));
+        return sum / double(y.size());
+    }
+
+    double dB(double power)
+    {
+        return 10. * std::log10(power);
+    }
+
+    void Fidelity(uint32_t decimation)
+    {
+        constexpr double c_amplitude = 1000.;
+        const IDDC::Config config{ c_offsetHz, decimation };
+        const double outputRate = c_inputRate / decimation;
+
+        const auto y = Run(exthwUSBfloat32, config, c_offsetHz + 0.3 * outputRate, c_amplitude, 1 << 20);
+        const auto a = ToneAmplitude(y, 0.3);
+        const double gain = dB(std::norm(a) / (c_amplitude * c_amplitude));
+        const double spurs = dB(ResidualPower(y, 0.3, a) / std::norm(a));
+
+        double worst = -INFINITY, worstAt = 0.;
+        for (double rel : { 0.6, 0.65, 0.7, 0.8, 1.0, 1.3, 1.7, 2.3, 3.1, 4.7, 7.3, 11.1, 19.7, 37.3, 61.9, 99.1 })
+            for (double sign : { -1., 1. })
+            {
+                const double toneHz = sign * rel * outputRate;
+                if (std::abs(c_offsetHz + toneHz) > 0.49 * c_inputRate)
+                    continue;
+                // the output frequency the tone folds to
+                const double folded = toneHz / outputRate - std::round(toneHz / outputRate);
+                if (std::abs(folded) > 0.4)
+                    continue;
+                const auto z = Run(exthwUSBfloat32, config, c_offsetHz + toneHz, c_amplitude,
+                    std::max<size_t>(1 << 16, 2000 * decimation));
+                const double alias = dB(std::norm(ToneAmplitude(z, folded)) / (c_amplitude * c_amplitude));
+                if (alias > worst)
+                {
+                    worst = alias;
+                    worstAt = toneHz / outputRate;
+                }
+            }
+
+        printf("decimation %3u: passband gain %6.3f dB spurs %6.1f dBc worst alias %6.1f dB (tone at %6.2f of the output rate)\n",
+            decimation, gain, spurs, worst, worstAt);
+    }
+
+    void Int16Fidelity()
+    {
+        constexpr uint32_t c_decimation = 16;
+        constexpr int c_blockSize = 4096;
+        constexpr size_t c_cnt = 1 << 21;
+        const double toneHz = 20e3;
+
+        BlockStats stats;
+        const auto y = Run(exthwUSBdata16, { -250e3, c_decimation }, -250e3 + toneHz, 20000., c_cnt, c_blockSize, &stats);
+        const double f = toneHz / (c_inputRate / c_decimation);
+        const auto a = ToneAmplitude(y, f);
+        printf("int16, decimation %u: %zu of %zu samples in %d blocks of %d, %d malformed; tone SNR %.1f dB\n",
+            c_decimation, stats.samples, c_cnt / c_decimation, stats.blocks, c_blockSize, stats.malformed,
+            dB(std::norm(a) / ResidualPower(y, f, a)));
+    }
+
+    void Throughput(int repeats)
+    {
+        constexpr int c_cnt = 65536;
+        constexpr double c_deviceRate = 10e6;
+        std::vector<int16_t> samples(2 * c_cnt);
+        std::mt19937 rng(1);
+        for (auto& s : samples)
+            s = int16_t(int(rng() % 2000) - 1000);
+
+        for (uint32_t decimation : { 2u, 16u, 64u, 256u })
+        {
+            auto ddc = MakeDDC(exthwUSBdata16, { 1.234e6, decimation }, c_deviceRate, 4096);
+            size_t produced = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; ++r)
+                ddc->Process(c_cnt, samples.data(), [&](int cnt, void*) { produced += cnt; });
+            const double rate = double(repeats) * c_cnt /
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("decimation %3u: %6.1f MS/s of int16 input, %3.0f%% of a core at %.0f MS/s\n",
+                decimation, rate / 1e6, 100. * c_deviceRate / rate, c_deviceRate / 1e6);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+    const int repeats = argc > 1 ? std::max(1, atoi(argv[1])) : 100;
+
+    for (uint32_t decimation : { 2u, 4u, 16u, 64u, 256u })
+        Fidelity(decimation);
+    Int16Fidelity();
+    Throughput(repeats);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Fidelity and throughput of the IQ codecs on 16 bit samples. The signal is
+// a tone switching between -40 and -6 dBFS each 8192 samples with a noise,
+// the SNR is reported separately for the weak and the strong blocks.
+//
+// iqcodec_bench [repeats=200]
+
+#include "stdafx.h"
+
+#include "../utils/IQCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr size_t c_cnt = 65536;
+    constexpr size_t c_switchPeriod = 8192;
+
+    std::vector<uint8_t> MakeSignal()
+    {
+        std::mt19937 rng(1);
+        std::normal_distribution<double> noise(0., 1.5);
+        std::vector<uint8_t> samples(c_cnt * 4);
+        for (size_t i = 0; i < c_cnt; ++i)
+        {
+            const double amplitude = (i / c_switchPeriod) % 2 ? 16000. : 300.;
+            const int16_t iq[2] = {
+                (int16_t)std::lround(std::clamp(amplitude * std::cos(i * 0.0123) + noise(rng), -32768., 32767.)),
+                (int16_t)std::lround(std::clamp(amplitude * std::sin(i * 0.0123) + noise(rng), -32768., 32767.)),
+            };
+            memcpy(&samples[i * 4], iq, sizeof(iq));
+        }
+        return samples;
+    }
+
+    void Run(const IQCodec::Config& config, const std::vector<uint8_t>& samples, int repeats)
+    {
+        std::vector<uint8_t> coded(IQCodec::MaxCodedSize(samples.size()));
+        std::vector<uint8_t> decoded;
+        size_t codedSize = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r)
+            codedSize = IQCodec::Encode(config, samples.data(), c_cnt, 4, 2, coded.data());
+        const auto encoded = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (int r = 0; r < repeats; ++r)
+            ok = IQCodec::Decode(config.kind, coded.data(), codedSize, c_cnt, decoded) && ok;
+        const auto finished = std::chrono::steady_clock::now();
+
+        if (!ok || decoded.size() != samples.size())
+        {
+            printf("%-6s %2d bits: decoding failed\n", IQCodec::Name(config.kind), config.packBits);
+            return;
+        }
+
+        double signal[2] = {}, error[2] = {};
+        int maxError = 0;
+        for (size_t i = 0; i < 2 * c_cnt; ++i)
+        {
+            int16_t in, out;
+            memcpy(&in, &samples[i * 2], 2);
+            memcpy(&out, &decoded[i * 2], 2);
+            const size_t strong = (i / 2 / c_switchPeriod) % 2;
+            signal[strong] += double(in) * in;
+            error[strong] += double(in - out) * (in - out);
+            maxError = std::max(maxError, std::abs(in - out));
+        }
+        auto snr = [](double s, double e) { return e ? 10. * std::log10(s / e) : INFINITY; };
+
+        const double encodeSeconds = std::chrono::duration<double>(encoded - start).count();
+        const double decodeSeconds = std::chrono::duration<double>(finished - encoded).count();
+        printf("%-6s %2d bits: ratio %.2f SNR weak %5.1f dB strong %5.1f dB max error %5d "
+            "encode %4.0f MS/s decode %4.0f MS/s\n",
+            IQCodec::Name(config.kind), config.kind == IQCodec::Kind::Packed ? config.packBits : 16,
+            double(samples.size()) / codedSize, snr(signal[0], error[0]), snr(signal[1], error[1]), maxError,
+            repeats * c_cnt / encodeSeconds / 1e6, repeats * c_cnt / decodeSeconds / 1e6);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int repeats = argc > 1 ? std::max(1, atoi(argv[1])) : 200;
+    const auto samples = MakeSignal();
+
+    Run({ IQCodec::Kind::Rice }, samples, repeats);
+    for (int bits : { 8, 10, 12, 14, 16 })
+        Run({ IQCodec::Kind::Packed, bits }, samples, repeats);
+    return 0;
+}
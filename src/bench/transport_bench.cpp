@@ -0,0 +1,157 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Loopback throughput of the connection socket backends. Both backends move
+// the same packet stream over a TCP connection of this host, the receiver
+// checks the sequence and the size of every packet.
+//
+// transport_bench [small packets count] [large packets count]
+
+#include "stdafx.h"
+
+#include "../utils/BufferPool.h"
+#include "../utils/Connection.h"
+
+namespace
+{
+    struct Result
+    {
+        int received = 0;
+        bool intact = true;
+        double seconds = 0.;
+    };
+
+    const char* Name(SocketBackend backend)
+    {
+        return backend == SocketBackend::IoUring ? "io_uring" : "asio";
+    }
+
+    Result Run(SocketBackend backend, size_t payloadSize, int count)
+    {
+        // the writer keeps this many packets in flight
+        constexpr int c_window = 64;
+
+        boost::asio::io_context ctx;
+        auto work = boost::asio::make_work_guard(ctx);
+        auto txStrand = boost::asio::make_strand(ctx);
+        auto rxStrand = boost::asio::make_strand(ctx);
+        boost::asio::ip::tcp::acceptor acceptor(ctx, { boost::asio::ip::address_v4::loopback(), 0 });
+
+        auto tx = MakeConnection(txStrand, ConnectionType::Tcp, backend);
+        auto rx = MakeConnection(rxStrand, ConnectionType::Tcp, backend);
+
+        Result result;
+        int sent = 0;
+        int written = 0;
+
+        // the sizes vary a little to keep the reads unaligned to the packets
+        auto packetSize = [payloadSize](int seq) { return payloadSize + seq % 7; };
+
+        std::function<void()> send = [&]() {
+            while (sent < count && sent - written < c_window)
+            {
+                auto buf = tx->GetBufferPool().Acquire();
+                buf->set_packet_type(PacketBuffer::PacketType::RawData);
+                buf->resize(packetSize(sent));
+                const uint32_t seq = sent++;
+                std::memcpy(buf->data(), &seq, sizeof(seq));
+                tx->AsyncWritePacket(buf, IConnection::Priority::IQData, [&](const boost::system::error_code& ec) {
+                    if (ec.failed())
+                        result.intact = false;
+                    ++written;
+                    send();
+                });
+            }
+        };
+
+        acceptor.async_accept([&](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
+            if (ec.failed())
+                return;
+            boost::asio::post(rxStrand, [&, socket = std::move(socket)]() mutable {
+                rx->Attach(std::move(socket));
+                rx->AsyncReadPackets([&](const boost::system::error_code& ec, const PacketView& packet) {
+                    if (ec.failed())
+                    {
+                        result.intact = false;
+                        return false;
+                    }
+                    uint32_t seq = 0;
+                    std::memcpy(&seq, packet.data, sizeof(seq));
+                    if (seq != (uint32_t)result.received || packet.size != packetSize(result.received))
+                        result.intact = false;
+                    return ++result.received < count;
+                });
+            });
+        });
+
+        const auto started = std::chrono::steady_clock::now();
+        boost::asio::post(txStrand, [&]() {
+            tx->Connect("127.0.0.1", acceptor.local_endpoint().port(), [&](const boost::system::error_code& ec) {
+                if (ec.failed())
+                {
+                    result.intact = false;
+                    return;
+                }
+                tx->SetChecksum(Checksum::Kind::None);
+                send();
+            });
+        });
+
+        while (result.received < count && result.intact &&
+            std::chrono::steady_clock::now() - started < std::chrono::seconds(60))
+            ctx.run_for(std::chrono::milliseconds(10));
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        boost::asio::post(txStrand, [&]() { tx->Close(); });
+        boost::asio::post(rxStrand, [&]() { rx->Close(); });
+        ctx.run_for(std::chrono::milliseconds(50));
+        return result;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    const int smallCount = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int largeCount = argc > 2 ? std::atoi(argv[2]) : 4000;
+
+    struct Case
+    {
+        size_t payloadSize;
+        int count;
+    };
+
+    bool intact = true;
+    for (auto c : { Case{ 64, smallCount }, Case{ 256 * 1024, largeCount } })
+    {
+        for (auto backend : { SocketBackend::Asio, SocketBackend::IoUring })
+        {
+            const auto r = Run(backend, c.payloadSize, c.count);
+            std::printf("%-8s %7zu B x %6d: %8.1f kpackets/s %8.1f MB/s%s\n",
+                Name(backend), c.payloadSize, r.received,
+                r.received / r.seconds / 1e3, r.received * (double)c.payloadSize / r.seconds / 1e6,
+                r.intact && r.received == c.count ? "" : "  FAILED");
+            intact = intact && r.intact && r.received == c.count;
+        }
+    }
+
+    return intact ? 0 : 1;
+}
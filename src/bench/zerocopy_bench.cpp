@@ -0,0 +1,231 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Crossover payload size of the MSG_ZEROCOPY sends. The sender writes the
+// same amount of data with every payload size, once copied and once with
+// zero copy, and reports the throughput and its own thread CPU time per GB.
+// The zero copy sends pay off from the size their CPU time drops below the
+// copied ones, that is the value for --zerocopy_threshold of the server.
+//
+// Over the loopback the kernel copies the zero copy sends anyway, so the
+// receiver is meant to run on another host:
+//
+// zerocopy_bench --sink <port>         on the receiving host
+// zerocopy_bench <host> <port> [MB]    on the server host
+// zerocopy_bench                       loopback run, checks the code path only
+
+#include "stdafx.h"
+
+#include "../utils/BufferPool.h"
+#include "../utils/Connection.h"
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+    double ThreadCpuSeconds()
+    {
+        timespec ts = {};
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    // Reads and drops the packets of every connection accepted
+    class Sink
+    {
+        boost::asio::io_context& _ctx;
+        boost::asio::ip::tcp::acceptor _acceptor;
+        std::vector<std::unique_ptr<IConnection>> _connections;
+        std::vector<std::unique_ptr<IConnection::strand_type>> _strands;
+
+    public:
+        Sink(boost::asio::io_context& ctx, const boost::asio::ip::tcp::endpoint& endpoint)
+            : _ctx(ctx)
+            , _acceptor(ctx, endpoint)
+        {
+            Accept();
+        }
+
+        uint16_t Port() const
+        {
+            return _acceptor.local_endpoint().port();
+        }
+
+    private:
+        void Accept()
+        {
+            _acceptor.async_accept([this](const boost::system::error_code& ec, boost::asio::ip::tcp::socket socket) {
+                if (ec.failed())
+                    return;
+                auto& strand = *_strands.emplace_back(
+                    std::make_unique<IConnection::strand_type>(boost::asio::make_strand(_ctx)));
+                auto connection = _connections.emplace_back(MakeConnection(strand)).get();
+                boost::asio::post(strand, [connection, socket = std::move(socket)]() mutable {
+                    connection->Attach(std::move(socket));
+                    connection->AsyncReadPackets([](const boost::system::error_code& ec, const PacketView&) {
+                        return !ec.failed();
+                    });
+                });
+                Accept();
+            });
+        }
+    };
+
+    struct Result
+    {
+        double seconds = 0.;
+        double cpuSeconds = 0.;
+        bool completed = false;
+    };
+
+    Result Run(const std::string& host, uint16_t port, size_t payloadSize, size_t totalBytes, bool zeroCopy)
+    {
+        // the writer keeps this many bytes in flight
+        constexpr size_t c_windowBytes = 8 * 1024 * 1024;
+
+        boost::asio::io_context ctx;
+        auto strand = boost::asio::make_strand(ctx);
+        auto connection = MakeConnection(strand);
+
+        const size_t count = std::max<size_t>(totalBytes / payloadSize, 1);
+        const size_t window = std::max<size_t>(c_windowBytes / payloadSize, 2);
+        size_t sent = 0;
+        size_t written = 0;
+        bool failed = false;
+
+        std::function<void()> send = [&]() {
+            while (sent < count && sent - written < window)
+            {
+                auto buf = connection->GetBufferPool().Acquire();
+                buf->set_packet_type(PacketBuffer::PacketType::RawData);
+                buf->resize(payloadSize);
+                ++sent;
+                connection->AsyncWritePacket(buf, IConnection::Priority::IQData, [&](const boost::system::error_code& ec) {
+                    failed = failed || ec.failed();
+                    ++written;
+                    if (!failed)
+                        send();
+                });
+            }
+        };
+
+        Result result;
+        double cpuStarted = 0.;
+        auto started = std::chrono::steady_clock::now();
+
+        boost::asio::post(strand, [&]() {
+            connection->Connect(host, port, [&](const boost::system::error_code& ec) {
+                if (ec.failed())
+                {
+                    failed = true;
+                    return;
+                }
+                connection->SetChecksum(Checksum::Kind::None);
+                connection->SetZeroCopyThreshold(zeroCopy ? payloadSize : 0);
+                started = std::chrono::steady_clock::now();
+                cpuStarted = ThreadCpuSeconds();
+                send();
+            });
+        });
+
+        while (written < count && !failed)
+            ctx.run_one();
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.cpuSeconds = ThreadCpuSeconds() - cpuStarted;
+        result.completed = !failed;
+
+        boost::asio::post(strand, [&]() { connection->Close(); });
+        ctx.run_for(std::chrono::milliseconds(50));
+        return result;
+    }
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef __linux__
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    if (argc > 2 && std::string(argv[1]) == "--sink")
+    {
+        boost::asio::io_context ctx;
+        Sink sink(ctx, { boost::asio::ip::tcp::v4(), (uint16_t)std::atoi(argv[2]) });
+        std::printf("Sink listens on port %u.\n", sink.Port());
+        ctx.run();
+        return 0;
+    }
+
+    boost::asio::io_context sinkCtx;
+    std::optional<Sink> localSink;
+    std::thread sinkThread;
+
+    std::string host = argc > 2 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc > 2 ? (uint16_t)std::atoi(argv[2]) : 0;
+    const size_t totalBytes = (argc > 3 ? std::atoi(argv[3]) : 1024) * size_t(1024 * 1024);
+
+    if (argc <= 2)
+    {
+        localSink.emplace(sinkCtx, boost::asio::ip::tcp::endpoint{ boost::asio::ip::address_v4::loopback(), 0 });
+        port = localSink->Port();
+        sinkThread = std::thread([&sinkCtx]() { sinkCtx.run(); });
+        std::printf("Loopback run, the kernel copies the zero copy sends here.\n");
+    }
+
+    std::printf("%9s %12s %12s %14s %14s\n", "payload", "copy MB/s", "zc MB/s", "copy CPU s/GB", "zc CPU s/GB");
+
+    size_t crossover = 0;
+    bool completed = true;
+    for (size_t payloadSize = 16 * 1024; payloadSize <= 1024 * 1024; payloadSize *= 2)
+    {
+        const auto copied = Run(host, port, payloadSize, totalBytes, false);
+        const auto zeroCopy = Run(host, port, payloadSize, totalBytes, true);
+        completed = completed && copied.completed && zeroCopy.completed;
+
+        const double gb = std::max<size_t>(totalBytes / payloadSize, 1) * (double)payloadSize / 1e9;
+        std::printf("%9zu %12.1f %12.1f %14.3f %14.3f\n", payloadSize,
+            gb * 1e3 / copied.seconds, gb * 1e3 / zeroCopy.seconds,
+            copied.cpuSeconds / gb, zeroCopy.cpuSeconds / gb);
+
+        if (!crossover && zeroCopy.cpuSeconds < copied.cpuSeconds)
+            crossover = payloadSize;
+    }
+
+    // the loopback figures differ by noise only
+    if (!localSink)
+    {
+        if (crossover)
+            std::printf("Zero copy sends take less CPU from %zu bytes.\n", crossover);
+        else
+            std::printf("Zero copy sends take more CPU at all the sizes.\n");
+    }
+
+    sinkCtx.stop();
+    if (sinkThread.joinable())
+        sinkThread.join();
+
+    return completed ? 0 : 1;
+#else
+    std::printf("MSG_ZEROCOPY sends are Linux only.\n");
+    return 0;
+#endif
+}
@@ -50,6 +50,10 @@ namespace
 				LOG(info) << "server_addr=" << _options->serverAddress;
 				LOG(info) << "server_port=" << _options->serverPort;
 				LOG(info) << "log_level=" << _options->logLevel;
+				LOG(info) << "checksum=" << Checksum::Name(_options->checksum);
+				LOG(info) << "udp_iq=" << _options->udpIq;
+				LOG(info) << "multicast=" << _options->multicast;
+				LOG(info) << "local_channel=" << _options->localChannel;
 				LOG(trace) << "Setting log level to " << _options->logLevel;
 				_logKeeper->SetSeverityLevel((boost::log::trivial::severity_level)_options->logLevel);
 				}
@@ -39,6 +39,24 @@ namespace
             "ExtIoOverNet server port, default is 2056");
         desc.add_options()("log_level", po::value<int16_t>()->default_value(4), 
             "Integer value of logging level: trace=0; debug=1; info=2; warning=3; error=4; fatal=5, default is 4.");
+        desc.add_options()("checksum", po::value<std::string>()->default_value("crc32c"),
+            "Preferred packet checksum: crc32c; xxhash64; crc32; none, default is crc32c.");
+        desc.add_options()("udp_iq", po::value<bool>()->default_value(false),
+            "Receive IQ data over UDP, the lost datagrams are filled with zeros, default is false.");
+        desc.add_options()("multicast", po::value<bool>()->default_value(false),
+            "Join the IQ multicast group of a server shared by several clients, default is false.");
+        desc.add_options()("local_channel", po::value<bool>()->default_value(true),
+            "Receive IQ data through shared memory when the server runs on the same host, default is true.");
+        desc.add_options()("control_channel", po::value<bool>()->default_value(true),
+            "Send requests over a second connection not shared with IQ data, default is true.");
+        desc.add_options()("iq_codec", po::value<std::string>()->default_value("none"),
+            "Compression of the IQ data sent over TCP: rice; packed; none, default is none.");
+        desc.add_options()("iq_pack_bits", po::value<int>()->default_value(12),
+            "Bits per I or Q value of the packed IQ codec, 4..24, default is 12.");
+        desc.add_options()("ddc_offset", po::value<double>()->default_value(0.),
+            "Offset in Hz of the band the server downconverter mixes to 0 Hz from the device LO, default is 0.");
+        desc.add_options()("ddc_decimation", po::value<uint32_t>()->default_value(1),
+            "Decimation of the server downconverter, a power of two 2..256, 1 disables it, default is 1.");
 
         po::variables_map vm;
 
@@ -68,6 +86,34 @@ namespace
             opt.serverPort = vm["server_port"].as<uint16_t>();
         if (vm.count("log_level"))
             opt.logLevel = vm["log_level"].as<int16_t>();
+        if (vm.count("checksum"))
+        {
+            const auto name = vm["checksum"].as<std::string>();
+            for (auto c : { Checksum::Kind::Crc32, Checksum::Kind::Crc32c, Checksum::Kind::XxHash64, Checksum::Kind::None })
+                if (name == Checksum::Name(c))
+                    opt.checksum = c;
+        }
+        if (vm.count("udp_iq"))
+            opt.udpIq = vm["udp_iq"].as<bool>();
+        if (vm.count("multicast"))
+            opt.multicast = vm["multicast"].as<bool>();
+        if (vm.count("local_channel"))
+            opt.localChannel = vm["local_channel"].as<bool>();
+        if (vm.count("control_channel"))
+            opt.controlChannel = vm["control_channel"].as<bool>();
+        if (vm.count("iq_codec"))
+        {
+            const auto name = vm["iq_codec"].as<std::string>();
+            for (auto c : { IQCodec::Kind::None, IQCodec::Kind::Rice, IQCodec::Kind::Packed })
+                if (name == IQCodec::Name(c))
+                    opt.iqCodec = c;
+        }
+        if (vm.count("iq_pack_bits"))
+            opt.iqPackBits = std::clamp(vm["iq_pack_bits"].as<int>(), IQCodec::c_minPackBits, IQCodec::c_maxPackBits);
+        if (vm.count("ddc_offset"))
+            opt.ddcOffset = vm["ddc_offset"].as<double>();
+        if (vm.count("ddc_decimation"))
+            opt.ddcDecimation = vm["ddc_decimation"].as<uint32_t>();
         
     }}
 
@@ -20,6 +20,8 @@
 #pragma once
 
 #include "../utils/log.h"
+#include "../utils/Checksum.h"
+#include "../utils/IQCodec.h"
 
 class Options
 {
@@ -28,6 +30,15 @@ public:
     std::string serverAddress;
     uint16_t serverPort;
     int16_t logLevel = boost::log::trivial::severity_level::trace;
+    Checksum::Kind checksum = Checksum::Kind::Crc32c;
+    bool udpIq = false;
+    bool multicast = false;
+    bool localChannel = true;
+    bool controlChannel = true;
+    IQCodec::Kind iqCodec = IQCodec::Kind::None;
+    int iqPackBits = 12;
+    double ddcOffset = 0.;
+    uint32_t ddcDecimation = 1;
 
     Options(const std::filesystem::path& optionsFileName = {});
 };
@@ -22,6 +22,7 @@
 #include "../utils/Connection.h"
 #include "../utils/Protocol.h"
 #include "../utils/Messages.h"
+#include "../utils/IQDatagram.h"
 #include "../utils/IsAlive.h"
 #include "../utils/AtScopeExit.h"
 #include "../utils/GlobalDefs.h"
@@ -45,15 +46,36 @@ namespace
 
         std::unique_ptr<IConnection> _connection;
         std::unique_ptr<Protocol::IParser> _proto;
+        std::unique_ptr<IIQDatagramReceiver> _iqDatagrams;
+        std::unique_ptr<IConnection> _controlConnection;
+        std::unique_ptr<Protocol::IParser> _controlProto;
+        bool _controlAttached = false;
+        Protocol::LinkStats _linkStats;
+        IQCodec::Kind _iqCodec = IQCodec::Kind::None;
+        IQCodec::Stats _iqCodecStats;
+        std::vector<uint8_t> _iqDecoded;
 
         deadline_timer _reconnect_timer;
         bool _connectingStarted = false;
         bool _connectionEstablished = false;
         std::atomic_bool _apiLoaded = false;
+        bool _rawIqData = false;
+        bool _serverHeartbeat = false;
+        bool _localChannelFailed = false;      // the Hellos do not offer it any more
+        uint64_t _droppedSamples = 0;
         std::atomic_long _isHwStarted = -1;
         boost::synchronized_value<pfnExtIOCallback> _pfnExtIOCallback = nullptr;
         std::vector<std::promise<bool>> _initWaiters;
 
+        // The server opens the device before it answers LoadExtIOApi
+        static constexpr auto c_loadExtIOApiTimeout = std::chrono::seconds(60);
+
+        // Device tables pushed by the server, the enumerations are answered from them
+        std::mutex _capabilitiesMx;
+        std::optional<ExtIO_TCP_Proto::RqsCapabilities> _capabilities;
+        // statuses changing the capabilities received, a snapshot of a lower generation is stale
+        uint64_t _capabilityStatuses = 0;
+
         AliveInstance _inst;
 
     public:
@@ -66,7 +88,8 @@ namespace
         {
             LOG(trace) << "Service constructed.";
 
-            _connection = MakeConnection(_strand);
+            _connection = MakeConnection(_strand, ConnectionType::TcpWithLocalChannel);
+            _controlConnection = MakeConnection(_strand);
         }
 
         ~Service()
@@ -94,8 +117,10 @@ namespace
             _connectionEstablished = false;
             _reconnect_timer.cancel();
             if (_proto) _proto->Cancel();
+            _iqDatagrams.reset();
             if (_connection) _connection->Cancel();
             _connection->Close();
+            CloseControlChannel();
         }
 
         void Connect(IConnection::CbT&& cb)
@@ -146,12 +171,46 @@ namespace
 
             //AsyncReadData();
             AsyncReadRequest();
+            AsyncReadRawData();
 
             LOG(trace) << "Sending Hello request.";
 
+            std::vector<Checksum::Kind> checksums = { _options.checksum };
+            for (auto c : { Checksum::Kind::Crc32c, Checksum::Kind::XxHash64, Checksum::Kind::Crc32 })
+                if (c != _options.checksum) checksums.push_back(c);
+
+            std::optional<uint32_t> udpPort;
+            if (_options.udpIq)
+            {
+                try
+                {
+                    _iqDatagrams = MakeIQDatagramReceiver(_strand, _connection->RemoteEndpoint().address());
+                    udpPort = _iqDatagrams->LocalPort();
+                }
+                catch (const std::exception& e)
+                {
+                    LOG(warning) << "IQ datagrams are disabled: " << e.what();
+                }
+            }
+
             auto msg = Protocol::Make_Hello_Msg(
                 Protocol::c_protocolVersion, 
                 std::string(c_appName) + "-" + c_versionString);
+            auto& hello = *msg.mutable_hello();
+            hello.set_raw_iq_data(true);
+            for (auto c : checksums)
+                hello.add_checksums((ExtIO_TCP_Proto::ChecksumType)c);
+            if (udpPort)
+                hello.set_udp_port(*udpPort);
+            hello.set_multicast(_options.multicast);
+            hello.set_local_channel(_options.localChannel && !_localChannelFailed &&
+                _connection->RemoteEndpoint().address().is_loopback());
+            hello.set_control_channel(_options.controlChannel);
+            hello.set_max_frame_size((uint32_t)IConnection::c_maxFrameSize);
+            hello.set_heartbeat(true);
+            hello.add_iq_codecs((ExtIO_TCP_Proto::IQCodecType)_options.iqCodec);
+            if (_options.iqCodec == IQCodec::Kind::Packed)
+                hello.set_iq_pack_bits(_options.iqPackBits);
 
             auto h = [this, a = AliveFlag(), cb = std::move(cb)]
             (const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) mutable {
@@ -168,6 +227,8 @@ namespace
             _apiLoaded = false;
             LOG(trace) << "Disconnected, force Client to reconnnect.";
 
+            DropCapabilities();
+
             Cancel();
 
             auto fn = _pfnExtIOCallback.synchronize();
@@ -189,6 +250,71 @@ namespace
                 });
         }
 
+        void AsyncReadRawData()
+        {
+            _proto->AsyncReceiveRawData(
+                [this, a = AliveFlag()]
+                (const boost::system::error_code& ec, const PacketView& packet) {
+                    if (!a.IsAlive())
+                        return;
+                    OnRawData(ec, packet);
+                });
+        }
+
+        void OnRawData(const boost::system::error_code& ec, const PacketView& packet)
+        {
+            if (!CheckErrorCode(ec))
+                return;
+
+            void* IQdata = nullptr;
+            auto* head = Protocol::Parse_ExtIOCallback_RawPacket(packet, IQdata, _iqCodec);
+            if (!head)
+            {
+                LOG(trace) << "Malformed raw IQ packet, size: " << packet.size;
+                return;
+            }
+
+            if (head->droppedSamples)
+                OnSamplesDropped(head->droppedSamples);
+
+            if (_iqCodec != IQCodec::Kind::None && head->cnt > 0 && IQdata)
+            {
+                const auto started = std::chrono::steady_clock::now();
+                const size_t codedSize = packet.size - sizeof(Protocol::RawIQHead);
+                // the host reads cnt samples of the block format from the decoded data
+                if (!IQCodec::Decode(_iqCodec, (const uint8_t*)IQdata, codedSize, head->cnt, _iqDecoded) ||
+                    _iqDecoded.size() != (size_t)head->cnt * Protocol::SampleSize(head->sampleFormat))
+                {
+                    LOG(trace) << "Malformed coded IQ block, cnt: " << head->cnt << "; size: " << codedSize;
+                    return;
+                }
+                IQdata = _iqDecoded.data();
+                _iqCodecStats.blocks++;
+                _iqCodecStats.rawBytes += _iqDecoded.size();
+                _iqCodecStats.codedBytes += codedSize;
+                _iqCodecStats.cpuTime += std::chrono::steady_clock::now() - started;
+            }
+
+            if (head->cnt <= 0)
+            {
+                LOG(trace) << "Raw ExtIOCallback received, cnt: "
+                    << head->cnt
+                    << "; status: " << head->status;
+                OnStatus(head->status);
+            }
+
+            OnIQBlock(*head, IQdata);
+        }
+
+        void OnIQBlock(const Protocol::RawIQHead& head, void* IQdata)
+        {
+            auto p = _pfnExtIOCallback.synchronize();
+            if (*p)
+            {
+                (*p)(head.cnt, head.status, head.IQoffs, IQdata);
+            }
+        }
+
         void OnMessage(const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& msg, int64_t did)
         {
             if (!CheckErrorCode(ec))
@@ -198,6 +324,9 @@ namespace
             {
             case ExtIO_TCP_Proto::Message::ContentCase::kExtIOCallback:
                 return OnExtIOCallback(ec, msg, did);
+            case ExtIO_TCP_Proto::Message::ContentCase::kCapabilities:
+                OnCapabilities(msg);
+                break;
             default:
                 LOG(trace) << "Unexpected message: " << msg.DebugString();
             }
@@ -205,25 +334,177 @@ namespace
             AsyncReadRequest();
         }
 
+        void OnCapabilities(const ExtIO_TCP_Proto::Message& msg)
+        {
+            auto& caps = msg.capabilities();
+            LOG(trace) << "Capabilities received, HW: " << caps.hw_name()
+                << "; model: " << caps.hw_model();
+            std::scoped_lock _(_capabilitiesMx);
+            // the snapshot may overtake the status it follows, the IQ data delay it
+            if (caps.generation() < _capabilityStatuses)
+            {
+                LOG(trace) << "Stale capabilities dropped, generation: " << caps.generation();
+                return;
+            }
+            _capabilities = caps;
+        }
+
+        // The host enumerates the tables again on these, the server pushes them anew
+        void OnStatus(int status)
+        {
+            if (status == extHw_Changed_RF_IF
+                || status == extHw_Changed_SRATES
+                || status == extHw_Changed_AGCS)
+            {
+                std::scoped_lock _(_capabilitiesMx);
+                ++_capabilityStatuses;
+                if (_capabilities && _capabilities->generation() < _capabilityStatuses)
+                    _capabilities.reset();
+            }
+        }
+
+        // A new session counts the statuses from scratch
+        void DropCapabilities()
+        {
+            std::scoped_lock _(_capabilitiesMx);
+            _capabilities.reset();
+            _capabilityStatuses = 0;
+        }
+
+        // Answers an enumeration call from the snapshot: an entry is passed to fill
+        // and 0 is returned, past the end the result the device gave there.
+        // Nothing is returned if the snapshot does not tell, the server is asked then.
+        template<typename TableT, typename FillT>
+        std::optional<int> FromCapabilities(TableT&& table, int idx, FillT&& fill)
+        {
+            std::scoped_lock _(_capabilitiesMx);
+            if (!_capabilities || idx < 0)
+                return {};
+            auto* t = table(*_capabilities);
+            if (!t)
+                return {};
+            if (idx < std::max(t->values_size(), t->texts_size()))
+            {
+                fill(*t, idx);
+                return 0;
+            }
+            if (t->has_end_result())
+                return t->end_result();
+            return {};
+        }
+
         void OnExtIOCallback(const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& inmsg, int64_t did)
         {
             auto& data = inmsg.extiocallback();
 
+            if (data.dropped_samples())
+                OnSamplesDropped(data.dropped_samples());
+
             if (data.cnt() <= 0)
             {
                 LOG(trace) << "ExtIOCallback request received, cnt: "
                     << data.cnt()
                     << "; status: " << data.status()
                     << "; data.size(): " << data.iqdata().size();
+                OnStatus(data.status());
             }
 
+            // large IQ blocks are not copied into the message
+            const auto aliased = _proto->GetAliasedIQData();
+            void* IQdata = aliased.empty() ? (void*)data.iqdata().data() : (void*)aliased.data();
+
             auto p = _pfnExtIOCallback.synchronize();
             if (*p)
             {
-                (*p)(data.cnt(), data.status(), data.iqoffs(), const_cast<char*>(data.iqdata().data()));
+                (*p)(data.cnt(), data.status(), data.iqoffs(), IQdata);
             }
         }
 
+        void OnSamplesDropped(uint32_t dropped)
+        {
+            _droppedSamples += dropped;
+            LOG(warning) << "Server dropped " << dropped
+                << " IQ samples, total dropped: " << _droppedSamples;
+        }
+
+        // Requests go over a second connection, so their responces
+        // do not wait behind the IQ blocks queued on the data connection.
+        void ConnectControlChannel(uint64_t token)
+        {
+            CloseControlChannel();
+
+            _controlConnection->Connect(_options.serverAddress, _options.serverPort,
+                [this, a = AliveFlag(), token](const boost::system::error_code& ec)
+                {
+                    if (!a.IsAlive()) return;
+                    if (ec.failed())
+                    {
+                        LOG(warning) << "Control channel is not connected: " << ec.message();
+                        return;
+                    }
+
+                    _controlProto = Protocol::MakeParser(*_controlConnection);
+                    _controlProto->AsyncSendRequest(Protocol::Make_AttachControl_Msg(token, {}),
+                        [this, a](const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) {
+                            if (!a.IsAlive()) return;
+                            if (ec.failed() || !res.has_attachcontrol() ||
+                                res.attachcontrol().result() != ExtIO_TCP_Proto::ErrorCode::Success)
+                            {
+                                LOG(warning) << "Control channel is not attached, requests share the data connection.";
+                                return;
+                            }
+                            LOG(trace) << "Control channel attached.";
+                            _controlAttached = true;
+                        });
+                });
+        }
+
+        // A dead link is noticed within the heartbeat timeout and reconnected
+        void StartHeartbeat()
+        {
+            _proto->StartHeartbeat(_strand,
+                [this, a = AliveFlag()](const boost::system::error_code& ec, const Protocol::LinkStats& stats) {
+                    if (!a.IsAlive() || !CheckErrorCode(ec))
+                        return;
+                    _linkStats = stats;
+                    if (stats.pingsSent % 10 == 0)
+                    {
+                        LOG(trace) << "Link RTT: " << stats.rtt.count() << " us, jitter: " << stats.rttJitter.count()
+                            << " us, goodput: " << (uint64_t)stats.goodput << " B/s, throughput: " << (uint64_t)stats.throughput << " B/s.";
+                        if (_iqCodec != IQCodec::Kind::None)
+                        {
+                            LOG(trace) << "IQ codec " << IQCodec::Name(_iqCodec) << " ratio: " << _iqCodecStats.Ratio()
+                                << ", blocks: " << _iqCodecStats.blocks << ", decoding CPU time: "
+                                << std::chrono::duration_cast<std::chrono::milliseconds>(_iqCodecStats.cpuTime).count() << " ms.";
+                        }
+                    }
+                });
+        }
+
+        void CloseControlChannel()
+        {
+            _controlAttached = false;
+            if (_controlProto) _controlProto->Cancel();
+            _controlConnection->Close();
+        }
+
+        // A failed control channel is given up, the request is repeated over the data connection
+        void SendControlRequest(const ExtIO_TCP_Proto::Message& rqs, Protocol::OnMsgCb_T&& h)
+        {
+            _controlProto->AsyncSendRequest(rqs,
+                [this, a = AliveFlag(), rqs, h = std::move(h)]
+                (const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) mutable {
+                    // the server not answering in time is not a channel failure
+                    if (!a.IsAlive() || !ec.failed() || ec == boost::asio::error::timed_out ||
+                        !_controlAttached || !_connectionEstablished)
+                        return h(ec, res, did);
+
+                    LOG(warning) << "Control channel failed: " << ec.message();
+                    _controlAttached = false;
+                    _proto->AsyncSendRequest(rqs, std::move(h));
+                });
+        }
+
         void RestartConnection(unsigned delayMs)
         {
             _reconnect_timer.expires_from_now(boost::posix_time::milliseconds(delayMs));
@@ -275,37 +556,145 @@ namespace
 
             LOG(trace) << "Hello responce received: " << res.hello().version().client_version_name();
 
+            _rawIqData = res.hello().has_raw_iq_data() && res.hello().raw_iq_data();
+            LOG(trace) << "Raw IQ data mode: " << _rawIqData;
+
+            auto udpReceiver = std::move(_iqDatagrams);
+
+            if (res.hello().has_local_channel_name())
+            {
+                // the server sends the IQ data there only, the session is started anew without it
+                if (!_connection->OpenLocalChannel(res.hello().local_channel_name()))
+                {
+                    LOG(error) << "Cannot open the local channel, reconnecting to receive IQ data over TCP.";
+                    _localChannelFailed = true;
+                    const auto e = std::make_error_code(std::errc::io_error);
+                    CheckErrorCode(e);
+                    return e;
+                }
+                udpReceiver.reset();
+            }
+
+            if (res.hello().checksums_size() && Checksum::IsValid((uint8_t)res.hello().checksums(0)))
+            {
+                _connection->SetChecksum((Checksum::Kind)res.hello().checksums(0));
+                _controlConnection->SetChecksum((Checksum::Kind)res.hello().checksums(0));
+            }
+
+            if (res.hello().has_max_frame_size())
+            {
+                _connection->SetMaxFrameSize(res.hello().max_frame_size());
+                _controlConnection->SetMaxFrameSize(res.hello().max_frame_size());
+            }
+
+            // the server strand is busy opening the device until LoadExtIOApi is answered
+            _serverHeartbeat = res.hello().heartbeat();
+
+            _iqCodec = IQCodec::Kind::None;
+            if (res.hello().iq_codecs_size() && IQCodec::IsValid((uint8_t)res.hello().iq_codecs(0)))
+                _iqCodec = (IQCodec::Kind)res.hello().iq_codecs(0);
+            if (_iqCodec == IQCodec::Kind::Packed)
+                LOG(trace) << "IQ codec: " << IQCodec::Name(_iqCodec) << ", " << res.hello().iq_pack_bits() << " bits.";
+            else
+                LOG(trace) << "IQ codec: " << IQCodec::Name(_iqCodec);
+
+            if (res.hello().has_control_token())
+                ConnectControlChannel(res.hello().control_token());
+
+            _iqDatagrams.reset();
+            if (res.hello().has_multicast_group() && res.hello().udp_port())
+            {
+                try
+                {
+                    const boost::asio::ip::udp::endpoint group(
+                        boost::asio::ip::make_address(res.hello().multicast_group()),
+                        (uint16_t)res.hello().udp_port());
+                    // the server of several interfaces sends the group datagrams from the multicast one
+                    const auto source = res.hello().has_multicast_source() ?
+                        boost::asio::ip::make_address(res.hello().multicast_source()) :
+                        _connection->RemoteEndpoint().address();
+                    _iqDatagrams = MakeIQMulticastReceiver(_strand, group, source);
+                }
+                catch (const std::exception& e)
+                {
+                    LOG(error) << "Cannot join IQ multicast group: " << e.what();
+                }
+            }
+            else if (udpReceiver && res.hello().has_udp_port() && res.hello().udp_port())
+            {
+                LOG(trace) << "IQ datagrams come from server port " << res.hello().udp_port();
+                _iqDatagrams = std::move(udpReceiver);
+            }
+
+            if (_iqDatagrams)
+            {
+                _iqDatagrams->Start([this](const Protocol::RawIQHead& head, void* IQdata) {
+                    OnIQBlock(head, IQdata);
+                });
+            }
+
             auto msg = Protocol::Make_LoadExtIOApi_Msg(
                 ExtIO_TCP_Proto::ErrorCode::Unexpected);
 
             auto h = [this, a = AliveFlag()]
             (const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& msg, int64_t did) mutable {
                 if (!a.IsAlive()) return;
-                LOG(trace) << "LoadExtIOApi responce received.";
-                _apiLoaded = true;
-                for (auto& w : _initWaiters)
-                    w.set_value(true);
-                _initWaiters.clear();
-
-                auto cb = _pfnExtIOCallback.synchronize();
-                if (*cb) {
-                    //(*cb)(-1, extHw_READY, .0, nullptr);
-                    //(*cb)(-1, extHw_RUNNING, .0, nullptr);
-                    //(*cb)(-1, extHw_Start, .0, nullptr);
-                }
-
-                if (_isHwStarted > 0)
+                // a server stuck in the device opening is given up and connected again
+                if (ec == boost::asio::error::timed_out)
                 {
-                    auto rqs = Protocol::Make_StartHW_Msg({}, _isHwStarted);
-                    _proto->AsyncSendRequest(rqs, [](const boost::system::error_code&, const ExtIO_TCP_Proto::Message&, int64_t) {});
+                    CheckErrorCode(ec);
+                    return;
                 }
+                LOG(trace) << "LoadExtIOApi responce received.";
+                if (_options.ddcDecimation > 1)
+                    return SetDDC();
+                OnApiLoaded();
             };
 
-            _proto->AsyncSendRequest(msg, std::move(h));
+            _proto->AsyncSendRequest(msg, std::move(h), c_loadExtIOApiTimeout);
 
             return {};
         }
 
+        // Goes ahead of the host calls, so the first GetHWSR already returns the decimated rate
+        void SetDDC()
+        {
+            auto rqs = Protocol::Make_SetDDC_Msg({ true }, { _options.ddcOffset }, { _options.ddcDecimation }, {}, {});
+            _proto->AsyncSendRequest(rqs,
+                [this, a = AliveFlag()](const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) {
+                    if (!a.IsAlive()) return;
+                    if (!ec.failed() && res.has_setddc() && res.setddc().result() == ExtIO_TCP_Proto::ErrorCode::Success)
+                        LOG(trace) << "DDC enabled, samplerate: " << res.setddc().samplerate();
+                    else
+                        LOG(warning) << "DDC is not enabled, IQ data come at the device samplerate.";
+                    OnApiLoaded();
+                });
+        }
+
+        void OnApiLoaded()
+        {
+            _apiLoaded = true;
+            if (_serverHeartbeat)
+                StartHeartbeat();
+
+            for (auto& w : _initWaiters)
+                w.set_value(true);
+            _initWaiters.clear();
+
+            auto cb = _pfnExtIOCallback.synchronize();
+            if (*cb) {
+                //(*cb)(-1, extHw_READY, .0, nullptr);
+                //(*cb)(-1, extHw_RUNNING, .0, nullptr);
+                //(*cb)(-1, extHw_Start, .0, nullptr);
+            }
+
+            if (_isHwStarted > 0)
+            {
+                auto rqs = Protocol::Make_StartHW_Msg({}, _isHwStarted);
+                _proto->AsyncSendRequest(rqs, [](const boost::system::error_code&, const ExtIO_TCP_Proto::Message&, int64_t) {});
+            }
+        }
+
         bool WaitForApiLoaded(uint32_t ms = 4000)
         {
             std::promise<bool> prm;
@@ -376,6 +765,39 @@ namespace
             return _apiLoaded;
         }
 
+        std::future<ExtIO_TCP_Proto::Message> AsyncRequest(ExtIO_TCP_Proto::Message&& rqs) override
+        {
+            auto [p, f] = Protocol::MakePFPair<ExtIO_TCP_Proto::Message>();
+            AsyncRequest(std::move(rqs), [p = std::move(p)](const ExtIO_TCP_Proto::Message& res) mutable {
+                p.set_value(res);
+            });
+            return std::move(f);
+        }
+
+        void AsyncRequest(ExtIO_TCP_Proto::Message&& rqs, ResponceCb_T&& cb) override
+        {
+            LOG(trace) << "New request: " << Protocol::IParser::GetMessageName(rqs);
+            asio::dispatch(_strand, [this, a = AliveFlag(), rqs = std::move(rqs), cb = std::move(cb)]() mutable {
+                if (!a.IsAlive() || !_apiLoaded)
+                    return cb({});
+
+                auto h = [this, a, cb = std::move(cb)]
+                (const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) mutable {
+                    if (!a.IsAlive() || !_apiLoaded)
+                        return cb({});
+                    if (ec.failed())
+                        LOG(trace) << "Request [" << did << "] failed: " << ec.message();
+                    else
+                        LOG(trace) << "Responce [" << did << "]: " << Protocol::IParser::GetMessageName(res);
+                    cb(res);
+                };
+
+                if (_controlAttached)
+                    return SendControlRequest(rqs, std::move(h));
+                _proto->AsyncSendRequest(rqs, std::move(h));
+            });
+        }
+
         // IExtIO_API
         // All calls from other thread context
     private:
@@ -388,6 +810,17 @@ namespace
 
             LOG(trace) << "InitHW called";
 
+            // the IQ blocks are passed on in the device sample format
+            {
+                std::scoped_lock _(_capabilitiesMx);
+                if (_capabilities)
+                {
+                    strncpy_s(name, EXTIO_MAX_NAME_LEN, _capabilities->hw_name().c_str(), _TRUNCATE);
+                    strncpy_s(model, EXTIO_MAX_MODEL_LEN, _capabilities->hw_model().c_str(), _TRUNCATE);
+                    type = _capabilities->hw_type();
+                }
+            }
+
             return true;
 
             auto [p, f] = Protocol::MakePFPair<ExtIO_TCP_Proto::Message>();
@@ -510,31 +943,10 @@ namespace
 
         ExtIO_TCP_Proto::Message SyncSendRequest(ExtIO_TCP_Proto::Message&& rqs)
         {
-            LOG(trace) << "New request: " << Protocol::IParser::GetMessageName(rqs);
-            auto [p, f] = Protocol::MakePFPair<ExtIO_TCP_Proto::Message>();
-            int64_t _did = 0;
             auto const rqsContentCase = rqs.Content_case();
-            auto h = [this, a = AliveFlag(), p = std::move(p), &_did]
-            (const boost::system::error_code& ec, const ExtIO_TCP_Proto::Message& res, int64_t did) mutable {
-                if (!a.IsAlive() || !_apiLoaded) {
-                    p.set_value({});
-                    return;
-                }
-                _did = did;
-                p.set_value(res);
-            };
-            asio::dispatch(_strand, [this, a = AliveFlag(), rqs = std::move(rqs), h = std::move(h)]() mutable {
-                if (!a.IsAlive() || !_apiLoaded) {
-                    h({}, {}, -1);
-                    return;
-                }
-                _proto->AsyncSendRequest(rqs, std::move(h));
-                });
-            auto responce = std::move(f.get());
-            LOG(trace)
-                << "Responce [" << _did << "]: " 
-                << Protocol::IParser::GetMessageName(responce)
-                << (rqsContentCase == responce.Content_case()) ? "" : " >>> responce type is differ from request!";
+            auto responce = AsyncRequest(std::move(rqs)).get();
+            if (rqsContentCase != responce.Content_case())
+                LOG(trace) << "Responce type is differ from request!";
             return responce;
         }
 
@@ -568,6 +980,11 @@ namespace
 
         int GetAttenuators(int atten_idx, float* attenuation) override {
             LOG(trace) << "GetAttenuators[" << atten_idx << "] is called.";
+            auto cached = FromCapabilities(
+                [](auto& caps) { return caps.has_attenuators() ? &caps.attenuators() : nullptr; }, atten_idx,
+                [&](auto& table, int idx) { *attenuation = static_cast<float>(table.values(idx)); });
+            if (cached)
+                return *cached;
             auto msg = SyncSendRequest(
                 Protocol::Make_GetAttenuators_Msg({}, atten_idx, {}));
             if (msg.has_getattenuators()) {
@@ -625,6 +1042,11 @@ namespace
         {
             text[0] = 0;
             LOG(trace) << "ExtIoGetAGCs[" << agc_idx << "] is called.";
+            auto cached = FromCapabilities(
+                [](auto& caps) { return caps.has_agcs() ? &caps.agcs() : nullptr; }, agc_idx,
+                [&](auto& table, int idx) { strcpy(text, table.texts(idx).c_str()); });
+            if (cached)
+                return *cached;
             auto msg = SyncSendRequest(
                 Protocol::Make_ExtIoGetAGCs_Msg({}, agc_idx, {}));
             if (msg.has_extiogetagcs()) {
@@ -654,6 +1076,11 @@ namespace
         {
             *gain = 0.;
             LOG(trace) << "ExtIoGetMGCs[" << mgc_idx << "] is called.";
+            auto cached = FromCapabilities(
+                [](auto& caps) { return caps.has_mgcs() ? &caps.mgcs() : nullptr; }, mgc_idx,
+                [&](auto& table, int idx) { *gain = static_cast<float>(table.values(idx)); });
+            if (cached)
+                return *cached;
             auto msg = SyncSendRequest(
                 Protocol::Make_ExtIoGetMGCs_Msg({}, mgc_idx, {}));
             if (msg.has_extiogetmgcs()) {
@@ -683,6 +1110,11 @@ namespace
         {
             *samplerate = 0.;
             LOG(trace) << "ExtIoGetSrates[" << srate_idx << "] is called.";
+            auto cached = FromCapabilities(
+                [](auto& caps) { return caps.has_samplerates() ? &caps.samplerates() : nullptr; }, srate_idx,
+                [&](auto& table, int idx) { *samplerate = table.values(idx); });
+            if (cached)
+                return *cached;
             auto msg = SyncSendRequest(
                 Protocol::Make_ExtIoGetSrates_Msg({}, srate_idx, {}));
             if (msg.has_extiogetsrates()) {
@@ -728,6 +1160,12 @@ namespace
         long ExtIoGetBandwidth(int srate_idx) override
         {
             LOG(trace) << "ExtIoGetBandwidth(" << srate_idx << ") is called.";
+            long bandwidth = -1;
+            auto cached = FromCapabilities(
+                [](auto& caps) { return caps.has_bandwidths() ? &caps.bandwidths() : nullptr; }, srate_idx,
+                [&](auto& table, int idx) { bandwidth = static_cast<long>(table.values(idx)); });
+            if (cached)
+                return *cached == 0 ? bandwidth : *cached;
             auto responce = SyncSendRequest(
                 Protocol::Make_ExtIoGetBandwidth_Msg({}, srate_idx));
             if (responce.has_extiogetbandwidth()) {
@@ -21,6 +21,7 @@
 
 #include "options.h"
 #include "../ExtIO_API/LC_ExtIO_Types.h"
+#include "../utils/Protocol.h"
 
 class IExtIO_API
 {
@@ -65,6 +66,13 @@ public:
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsConnected() const = 0;
+
+    // Non-blocking calls, any number of requests may be in flight.
+    // An empty message is the responce of a failed request.
+    using ResponceCb_T = std::move_only_function<void(const ExtIO_TCP_Proto::Message&)>;
+    virtual std::future<ExtIO_TCP_Proto::Message> AsyncRequest(ExtIO_TCP_Proto::Message&& rqs) = 0;
+    // cb is called on the service strand
+    virtual void AsyncRequest(ExtIO_TCP_Proto::Message&& rqs, ResponceCb_T&& cb) = 0;
 };
 
 
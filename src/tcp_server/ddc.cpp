@@ -0,0 +1,370 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "stdafx.h"
+
+#include "ddc.h"
+#include "../utils/log.h"
+
+#include <bit>
+#include <cmath>
+#include <complex>
+#include <numbers>
+
+namespace
+{
+    // Half-band stages by their position from the output end. The last one keeps
+    // 0.4 of the output rate clean, the earlier ones have to reject the images of
+    // that band only, which are wide, so a few taps do.
+    constexpr int c_lastStagePairs = 15;     // 59 taps, 0.2..0.3 transition
+    constexpr int c_secondStagePairs = 5;    // 19 taps, 0.1..0.4
+    constexpr int c_earlyStagePairs = 4;     // 15 taps, 0.05..0.45 and wider
+    constexpr double c_kaiserBeta = 9.;      // ~90 dB stopband
+
+    // NCO rotations are anchored to the exact phase every chunk
+    constexpr size_t c_ncoChunk = 64;
+
+    double BesselI0(double x)
+    {
+        double sum = 1., term = 1.;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2. * k)) * (x / (2. * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Coefficients of the odd taps 1, 3, ..., 2 * pairs - 1 of a Kaiser windowed
+    // half-band, the center one is 0.5 and the even ones are 0
+    std::vector<float> DesignHalfBand(int pairs)
+    {
+        const int half = 2 * pairs - 1;
+        std::vector<double> c(pairs);
+        double sum = 0.5;
+        for (int j = 0; j < pairs; ++j)
+        {
+            const int k = 2 * j + 1;
+            const double r = double(k) / (half + 1);
+            const double w = BesselI0(c_kaiserBeta * std::sqrt(1. - r * r)) / BesselI0(c_kaiserBeta);
+            c[j] = std::sin(std::numbers::pi * k / 2.) / (std::numbers::pi * k) * w;
+            sum += 2. * c[j];
+        }
+        // unity gain at 0 Hz
+        std::vector<float> coeffs(pairs);
+        for (int j = 0; j < pairs; ++j)
+            coeffs[j] = float(c[j] / sum);
+        return coeffs;
+    }
+
+    // Decimates a real stream by 2. The odd taps of a half-band act on the
+    // even input phase only, the center tap picks the odd phase sample, so an
+    // output costs pairs multiplications and the loops are over contiguous data.
+    class HalfBand
+    {
+        const std::vector<float> _coeffs;
+        const size_t _history;
+        float _center;
+        std::vector<float> _x;              // history followed by the input
+        std::vector<float> _even, _odd;
+
+    public:
+
+        HalfBand(const std::vector<float>& coeffs)
+            : _coeffs(coeffs)
+            , _history(4 * coeffs.size() - 2)
+            , _x(_history, 0.f)
+        {
+            float sum = 0.f;
+            for (auto c : coeffs)
+                sum += 2.f * c;
+            _center = 1.f - sum;
+        }
+
+        void Process(const float* in, size_t n, std::vector<float>& out)
+        {
+            _x.insert(_x.end(), in, in + n);
+            const size_t pairs = _coeffs.size();
+            const size_t cnt = (_x.size() - _history) / 2;
+            out.resize(cnt);
+            if (!cnt)
+                return;
+
+            const size_t phaseSize = cnt + 2 * pairs - 1;
+            _even.resize(phaseSize);
+            _odd.resize(phaseSize);
+            for (size_t i = 0; i < phaseSize; ++i)
+            {
+                _even[i] = _x[2 * i];
+                _odd[i] = _x[2 * i + 1];
+            }
+
+            const float* odd = _odd.data() + pairs - 1;
+            for (size_t m = 0; m < cnt; ++m)
+                out[m] = _center * odd[m];
+            for (size_t j = 0; j < pairs; ++j)
+            {
+                const float c = _coeffs[j];
+                const float* a = _even.data() + pairs - 1 - j;
+                const float* b = _even.data() + pairs + j;
+                for (size_t m = 0; m < cnt; ++m)
+                    out[m] += c * (a[m] + b[m]);
+            }
+
+            _x.erase(_x.begin(), _x.begin() + 2 * cnt);
+        }
+    };
+
+    // Planar I and Q of the device sample format, U8 is centered
+    void Load(extHWtypeT dataType, const void* IQdata, size_t cnt, float* I, float* Q)
+    {
+        auto load = [&](auto&& value) {
+            for (size_t i = 0; i < cnt; ++i)
+            {
+                I[i] = value(2 * i);
+                Q[i] = value(2 * i + 1);
+            }
+        };
+
+        switch (dataType)
+        {
+        case exthwUSBdata16:
+            return load([p = (const int16_t*)IQdata](size_t i) { return float(p[i]); });
+        case exthwUSBdata24:
+            return load([p = (const uint8_t*)IQdata](size_t i) {
+                return float(int32_t(uint32_t(p[3 * i]) << 8 | uint32_t(p[3 * i + 1]) << 16 | uint32_t(p[3 * i + 2]) << 24) >> 8);
+            });
+        case exthwUSBdata32:
+        case exthwFullPCM32:
+            return load([p = (const int32_t*)IQdata](size_t i) { return float(p[i]); });
+        case exthwUSBfloat32:
+            return load([p = (const float*)IQdata](size_t i) { return p[i]; });
+        case exthwUSBdataU8:
+            return load([p = (const uint8_t*)IQdata](size_t i) { return float(p[i]) - 127.5f; });
+        case exthwUSBdataS8:
+            return load([p = (const int8_t*)IQdata](size_t i) { return float(p[i]); });
+        }
+    }
+
+    template<typename T>
+    T Round(float v, float lo, float hi)
+    {
+        return T(std::lrint(std::clamp(v, lo, hi)));
+    }
+
+    // Interleaves planar I and Q into the device sample format, rounded and saturated
+    void Store(extHWtypeT dataType, const float* I, const float* Q, size_t cnt, void* IQdata)
+    {
+        auto store = [&](auto&& value) {
+            for (size_t i = 0; i < cnt; ++i)
+            {
+                value(2 * i, I[i]);
+                value(2 * i + 1, Q[i]);
+            }
+        };
+
+        switch (dataType)
+        {
+        case exthwUSBdata16:
+            return store([p = (int16_t*)IQdata](size_t i, float v) { p[i] = Round<int16_t>(v, -32768.f, 32767.f); });
+        case exthwUSBdata24:
+            return store([p = (uint8_t*)IQdata](size_t i, float v) {
+                const auto s = Round<int32_t>(v, -8388608.f, 8388607.f);
+                p[3 * i] = uint8_t(s);
+                p[3 * i + 1] = uint8_t(s >> 8);
+                p[3 * i + 2] = uint8_t(s >> 16);
+            });
+        case exthwUSBdata32:
+        case exthwFullPCM32:
+            // the largest float below 2^31
+            return store([p = (int32_t*)IQdata](size_t i, float v) { p[i] = Round<int32_t>(v, -2147483648.f, 2147483520.f); });
+        case exthwUSBfloat32:
+            return store([p = (float*)IQdata](size_t i, float v) { p[i] = v; });
+        case exthwUSBdataU8:
+            return store([p = (uint8_t*)IQdata](size_t i, float v) { p[i] = Round<uint8_t>(v + 127.5f, 0.f, 255.f); });
+        case exthwUSBdataS8:
+            return store([p = (int8_t*)IQdata](size_t i, float v) { p[i] = Round<int8_t>(v, -128.f, 127.f); });
+        }
+    }
+
+    size_t SampleSize(extHWtypeT dataType)
+    {
+        switch (dataType)
+        {
+        case exthwUSBdata16:
+            return 4;
+        case exthwUSBdata24:
+            return 6;
+        case exthwUSBdata32:
+        case exthwFullPCM32:
+        case exthwUSBfloat32:
+            return 8;
+        case exthwUSBdataU8:
+        case exthwUSBdataS8:
+            return 2;
+        }
+        return 0;
+    }
+
+    class DDC : public IDDC
+    {
+        const extHWtypeT _dataType;
+        const size_t _sampleSize;
+        const Config _config;
+        size_t _blockSize = 0;
+
+        // NCO
+        double _phase = 0.;
+        double _phaseStep = 0.;
+        std::vector<std::complex<float>> _rotations;
+
+        std::vector<HalfBand> _stagesI, _stagesQ;
+
+        std::vector<float> _I, _Q, _tmpI, _tmpQ;
+        std::vector<float> _pendingI, _pendingQ;
+        std::vector<uint8_t> _block;
+
+    public:
+
+        DDC(extHWtypeT dataType, const Config& config, double inputRate, int blockSize)
+            : _dataType(dataType)
+            , _sampleSize(SampleSize(dataType))
+            , _config(config)
+        {
+            const int stages = std::countr_zero(config.decimation);
+            for (int s = 0; s < stages; ++s)
+            {
+                const int fromEnd = stages - 1 - s;
+                const auto coeffs = DesignHalfBand(
+                    fromEnd == 0 ? c_lastStagePairs :
+                    fromEnd == 1 ? c_secondStagePairs :
+                    c_earlyStagePairs);
+                _stagesI.emplace_back(coeffs);
+                _stagesQ.emplace_back(coeffs);
+            }
+
+            SetInputRate(inputRate);
+            SetBlockSize(blockSize);
+
+            LOG(trace) << "DDC created, offset: " << config.offsetHz << " Hz; decimation: " << config.decimation
+                << "; input rate: " << inputRate << " Hz.";
+        }
+
+        // IDDC
+    private:
+
+        void SetInputRate(double sampleRate) override
+        {
+            _phaseStep = sampleRate > 0. ? -2. * std::numbers::pi * _config.offsetHz / sampleRate : 0.;
+            _rotations.resize(c_ncoChunk);
+            for (size_t k = 0; k < c_ncoChunk; ++k)
+                _rotations[k] = std::complex<float>(std::polar(1., _phaseStep * k));
+        }
+
+        void SetBlockSize(int blockSize) override
+        {
+            _blockSize = blockSize > 0 ? blockSize : 0;
+        }
+
+        void Process(int cnt, const void* IQdata, const BlockCbT& cb) override
+        {
+            if (cnt <= 0 || !IQdata)
+                return;
+
+            _I.resize(cnt);
+            _Q.resize(cnt);
+            Load(_dataType, IQdata, cnt, _I.data(), _Q.data());
+
+            if (_phaseStep != 0.)
+                Mix(_I.data(), _Q.data(), cnt);
+
+            for (size_t s = 0; s < _stagesI.size(); ++s)
+            {
+                _stagesI[s].Process(_I.data(), _I.size(), _tmpI);
+                _stagesQ[s].Process(_Q.data(), _Q.size(), _tmpQ);
+                _I.swap(_tmpI);
+                _Q.swap(_tmpQ);
+            }
+
+            if (!_blockSize)
+            {
+                if (!_I.empty())
+                    Emit(_I.data(), _Q.data(), _I.size(), cb);
+                return;
+            }
+
+            _pendingI.insert(_pendingI.end(), _I.begin(), _I.end());
+            _pendingQ.insert(_pendingQ.end(), _Q.begin(), _Q.end());
+            size_t done = 0;
+            for (; _pendingI.size() - done >= _blockSize; done += _blockSize)
+                Emit(_pendingI.data() + done, _pendingQ.data() + done, _blockSize, cb);
+            _pendingI.erase(_pendingI.begin(), _pendingI.begin() + done);
+            _pendingQ.erase(_pendingQ.begin(), _pendingQ.begin() + done);
+        }
+
+        const Config& GetConfig() const override
+        {
+            return _config;
+        }
+
+    private:
+
+        // Multiplies by exp(j * phase), the chunk start rotation comes from the
+        // double precision phase, so the float error does not accumulate
+        void Mix(float* I, float* Q, size_t cnt)
+        {
+            for (size_t i = 0; i < cnt; i += c_ncoChunk)
+            {
+                const auto anchor = std::complex<float>(std::polar(1., _phase));
+                const size_t n = std::min(c_ncoChunk, cnt - i);
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const auto z = anchor * _rotations[k];
+                    const float re = I[i + k] * z.real() - Q[i + k] * z.imag();
+                    const float im = I[i + k] * z.imag() + Q[i + k] * z.real();
+                    I[i + k] = re;
+                    Q[i + k] = im;
+                }
+                _phase = std::remainder(_phase + _phaseStep * n, 2. * std::numbers::pi);
+            }
+        }
+
+        void Emit(const float* I, const float* Q, size_t cnt, const BlockCbT& cb)
+        {
+            _block.resize(cnt * _sampleSize);
+            Store(_dataType, I, Q, cnt, _block.data());
+            cb((int)cnt, _block.data());
+        }
+    };
+}
+
+bool IsValidDDCConfig(const IDDC::Config& config)
+{
+    return config.decimation >= 2
+        && config.decimation <= IDDC::c_maxDecimation
+        && std::has_single_bit(config.decimation)
+        && std::isfinite(config.offsetHz);
+}
+
+std::unique_ptr<IDDC> MakeDDC(extHWtypeT dataType, const IDDC::Config& config, double inputRate, int blockSize)
+{
+    if (!IsValidDDCConfig(config) || !SampleSize(dataType))
+        return {};
+    return std::make_unique<DDC>(dataType, config, inputRate, blockSize);
+}
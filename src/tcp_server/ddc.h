@@ -0,0 +1,57 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include "../ExtIO_API/LC_ExtIO_Types.h"
+#include <functional>
+
+// Digital downconverter of the session IQ stream. The band at an offset from
+// the device LO is mixed to 0 Hz by an NCO and decimated by a power of two
+// with a cascade of half-band filters. The blocks keep the device sample
+// format, so the host sees a device of the reduced sample rate.
+class IDDC
+{
+public:
+
+    static constexpr uint32_t c_maxDecimation = 256;
+
+    struct Config
+    {
+        double offsetHz = 0.;       // of the band center from the device LO
+        uint32_t decimation = 1;    // a power of two 2..c_maxDecimation
+    };
+
+    using BlockCbT = std::function<void(int cnt, void* IQdata)>;
+
+    virtual ~IDDC() = default;
+
+    // The NCO frequency is relative to the device sample rate
+    virtual void SetInputRate(double sampleRate) = 0;
+    // Decimated samples per block, 0 passes on whatever a Process call yields
+    virtual void SetBlockSize(int blockSize) = 0;
+    // Completed blocks are passed to cb, their data are valid during the cb call only
+    virtual void Process(int cnt, const void* IQdata, const BlockCbT& cb) = 0;
+    virtual const Config& GetConfig() const = 0;
+};
+
+bool IsValidDDCConfig(const IDDC::Config& config);
+
+// Returns nullptr for a config or a sample format the DDC does not handle
+std::unique_ptr<IDDC> MakeDDC(extHWtypeT dataType, const IDDC::Config& config, double inputRate, int blockSize);
@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "stdafx.h"
+
+#include "iq_handoff.h"
+#include "../utils/log.h"
+
+namespace
+{
+    // Records are 8 bytes aligned, a record of size 0 marks the wrap to the ring start
+    constexpr size_t c_recordAlign = 8;
+    // Room kept free for status blocks when the data fills the ring
+    constexpr size_t c_statusReserve = 4 * 1024;
+
+    struct RecordHead
+    {
+        uint32_t size;  // with the head and padding
+        int32_t cnt;
+        int32_t status;
+        float IQoffs;
+        uint64_t bytes;
+    };
+
+    constexpr size_t AlignRecord(size_t size)
+    {
+        return (size + c_recordAlign - 1) & ~(c_recordAlign - 1);
+    }
+
+    class IQHandoff : public IIQHandoff
+    {
+        std::vector<uint8_t> _ring;
+        const WakeCbT _wake;
+
+        // positions grow monotonically, the ring offset is the position modulo the size
+        alignas(64) std::atomic<size_t> _head = 0;     // consumer
+        alignas(64) std::atomic<size_t> _tail = 0;     // producer
+        alignas(64) std::atomic_bool _wakePending = false;
+
+        std::atomic<uint64_t> _overrunSamples = 0;
+        std::atomic<uint64_t> _blocks = 0;
+        std::atomic<uint64_t> _wakeups = 0;
+        std::atomic<uint64_t> _overrunBlocks = 0;
+        std::atomic<uint64_t> _overrunSamplesTotal = 0;
+
+    public:
+
+        IQHandoff(size_t capacityBytes, WakeCbT&& wake)
+            : _ring(AlignRecord(capacityBytes))
+            , _wake(std::move(wake))
+        {
+        }
+
+        ~IQHandoff()
+        {
+            LOG(info) << "IQ handoff stats, blocks: " << _blocks
+                << "; wakeups: " << _wakeups
+                << "; overrun blocks: " << _overrunBlocks
+                << "; overrun samples: " << _overrunSamplesTotal;
+        }
+
+        // IIQHandoff
+    private:
+
+        bool Push(int cnt, int status, float IQoffs, const void* IQdata, size_t bytes) override
+        {
+            const size_t need = AlignRecord(sizeof(RecordHead) + bytes);
+            const size_t tail = _tail.load(std::memory_order_relaxed);
+            const size_t offset = tail % _ring.size();
+            const size_t skip = offset + need > _ring.size() ? _ring.size() - offset : 0;
+            const size_t used = tail - _head.load(std::memory_order_acquire);
+            const size_t reserve = cnt > 0 ? c_statusReserve : 0;
+
+            if (skip + need + reserve > _ring.size() - used)
+            {
+                _overrunBlocks.fetch_add(1, std::memory_order_relaxed);
+                if (cnt > 0)
+                {
+                    _overrunSamples.fetch_add(cnt, std::memory_order_relaxed);
+                    _overrunSamplesTotal.fetch_add(cnt, std::memory_order_relaxed);
+                }
+                return false;
+            }
+
+            if (skip)
+                reinterpret_cast<RecordHead*>(_ring.data() + offset)->size = 0;
+
+            auto* rec = _ring.data() + (skip ? 0 : offset);
+            auto& head = *reinterpret_cast<RecordHead*>(rec);
+            head.size = (uint32_t)need;
+            head.cnt = cnt;
+            head.status = status;
+            head.IQoffs = IQoffs;
+            head.bytes = bytes;
+            if (bytes)
+                std::memcpy(rec + sizeof(RecordHead), IQdata, bytes);
+
+            // seq_cst pairs with Drain, either it sees the block or the flag is cleared and it is woken
+            _tail.store(tail + skip + need);
+            _blocks.fetch_add(1, std::memory_order_relaxed);
+
+            if (!_wakePending.exchange(true))
+            {
+                _wakeups.fetch_add(1, std::memory_order_relaxed);
+                _wake();
+            }
+
+            return true;
+        }
+
+        void Drain(const BlockCbT& cb) override
+        {
+            // blocks pushed from now on wake the consumer again
+            _wakePending.store(false);
+
+            size_t head = _head.load(std::memory_order_relaxed);
+            const size_t tail = _tail.load();
+
+            while (head != tail)
+            {
+                const size_t offset = head % _ring.size();
+                auto* rec = _ring.data() + offset;
+                const auto& rh = *reinterpret_cast<const RecordHead*>(rec);
+
+                if (!rh.size)
+                {
+                    head += _ring.size() - offset;
+                    continue;
+                }
+
+                Block b;
+                b.cnt = rh.cnt;
+                b.status = rh.status;
+                b.IQoffs = rh.IQoffs;
+                b.bytes = rh.bytes;
+                b.IQdata = rh.bytes ? rec + sizeof(RecordHead) : nullptr;
+                cb(b);
+
+                head += rh.size;
+                _head.store(head, std::memory_order_release);
+            }
+
+            _head.store(head, std::memory_order_release);
+        }
+
+        uint64_t TakeOverrunSamples() override
+        {
+            return _overrunSamples.exchange(0, std::memory_order_relaxed);
+        }
+
+        Stats GetStats() const override
+        {
+            Stats s;
+            s.blocks = _blocks;
+            s.wakeups = _wakeups;
+            s.overrunBlocks = _overrunBlocks;
+            s.overrunSamples = _overrunSamplesTotal;
+            return s;
+        }
+    };
+}
+
+size_t IQHandoffCapacity(size_t blockBytes, size_t blocks)
+{
+    // a record may also skip the ring end of up to its own size
+    return (blocks + 1) * AlignRecord(sizeof(RecordHead) + blockBytes) + c_statusReserve;
+}
+
+std::unique_ptr<IIQHandoff> MakeIQHandoff(size_t capacityBytes, IIQHandoff::WakeCbT&& wake)
+{
+    return std::make_unique<IQHandoff>(capacityBytes, std::move(wake));
+}
+
+void IQHandoffSwap::Replace(std::unique_ptr<IIQHandoff>&& ring)
+{
+    assert(!_retired);
+    _retired = std::move(_current);
+    _current = std::move(ring);
+    _in.store(_current.get(), std::memory_order_release);
+}
+
+void IQHandoffSwap::Drain(const std::function<bool(IIQHandoff&)>& drain)
+{
+    if (_retired)
+        drain(*_retired);
+
+    const bool drained = drain(*_current);
+
+    // a single thread pushes, a block in the new ring means it is done with the old one
+    if (_retired && drained)
+    {
+        drain(*_retired);
+        _retired.reset();
+    }
+}
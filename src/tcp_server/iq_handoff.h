@@ -0,0 +1,96 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <atomic>
+
+// Preallocated single producer / single consumer ring of IQ blocks between
+// the ExtIO driver thread and the session strand. Push copies the samples
+// into the ring and never blocks nor allocates, a data block which does not
+// fit is counted as overrun. Status blocks (cnt <= 0) have a reserved room.
+// The wake callback is called for the first block pushed after the consumer
+// started draining, so a burst of blocks costs a single wakeup.
+class IIQHandoff
+{
+public:
+
+    struct Block
+    {
+        int cnt = 0;
+        int status = 0;
+        float IQoffs = 0;
+        void* IQdata = nullptr;
+        size_t bytes = 0;
+    };
+
+    struct Stats
+    {
+        uint64_t blocks = 0;
+        uint64_t wakeups = 0;
+        uint64_t overrunBlocks = 0;
+        uint64_t overrunSamples = 0;
+    };
+
+    using WakeCbT = std::function<void()>;
+    using BlockCbT = std::function<void(const Block&)>;
+
+    virtual ~IIQHandoff() = default;
+
+    // Producer thread, returns false if the block is dropped
+    virtual bool Push(int cnt, int status, float IQoffs, const void* IQdata, size_t bytes) = 0;
+    // Consumer thread, the block data is valid during the cb call only
+    virtual void Drain(const BlockCbT& cb) = 0;
+    // Consumer thread, samples dropped by Push since the previous call
+    virtual uint64_t TakeOverrunSamples() = 0;
+    virtual Stats GetStats() const = 0;
+};
+
+std::unique_ptr<IIQHandoff> MakeIQHandoff(size_t capacityBytes, IIQHandoff::WakeCbT&& wake);
+
+// The capacity a ring needs to hold the data blocks besides the status room
+size_t IQHandoffCapacity(size_t blockBytes, size_t blocks);
+
+// The ring the producer thread pushes to, the consumer replaces it by a larger
+// one without stopping the producer. The blocks pushed to the old ring until
+// the producer moves on are drained before the old ring is released.
+class IQHandoffSwap
+{
+public:
+
+    // Producer thread
+    IIQHandoff& In() const { return *_in.load(std::memory_order_acquire); }
+
+    // Consumer thread, a replaced ring is drained until the producer moves on
+    bool Replacing() const { return (bool)_retired; }
+    void Replace(std::unique_ptr<IIQHandoff>&& ring);
+
+    // Consumer thread, drain is called for each ring to drain and returns true if
+    // it got some block. A block the producer pushes to the old ring meanwhile
+    // comes after the ones of the new ring.
+    void Drain(const std::function<bool(IIQHandoff&)>& drain);
+
+private:
+
+    std::unique_ptr<IIQHandoff> _current;
+    std::unique_ptr<IIQHandoff> _retired;
+    std::atomic<IIQHandoff*> _in = nullptr;
+};
@@ -0,0 +1,231 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "stdafx.h"
+
+#include "iq_queue.h"
+#include "../utils/IsAlive.h"
+#include "../utils/log.h"
+
+namespace
+{
+    using namespace Protocol;
+
+    // blocks handed to the connection at once, enough to keep the socket busy
+    constexpr size_t c_maxBlocksInFlight = 4;
+
+    class IQSendQueue : public IIQSendQueue
+    {
+        using clock = std::chrono::steady_clock;
+
+        struct block
+        {
+            IConnection::buffer_ptr raw;
+            std::unique_ptr<ExtIO_TCP_Proto::Message> msg;
+            int cnt = 0;
+            size_t bytes = 0;
+            clock::time_point queued;
+
+            bool is_data() const { return cnt > 0; }
+        };
+
+        IParser& _proto;
+        IIQDatagramSender* _datagrams = nullptr;
+        const Limits _limits;
+        std::deque<block> _queue;
+        size_t _queuedBytes = 0;
+        size_t _inFlight = 0;
+        uint64_t _pendingDropped = 0;
+        Stats _stats;
+        AliveInstance _inst;
+
+    public:
+
+        IQSendQueue(IParser& proto, const Limits& limits)
+            : _proto(proto)
+            , _limits(limits)
+        {}
+
+        ~IQSendQueue()
+        {
+            LOG(info) << "IQ queue stats, sent blocks: " << _stats.sentBlocks
+                << "; dropped blocks: " << _stats.droppedBlocks
+                << "; dropped samples: " << _stats.droppedSamples
+                << "; high water bytes: " << _stats.highWaterBytes
+                << "; high water blocks: " << _stats.highWaterBlocks;
+        }
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+        // IIQSendQueue
+    private:
+
+        void Push(IConnection::buffer_ptr&& rawPacket, int cnt) override
+        {
+            const auto bytes = rawPacket->size();
+            Push({ std::move(rawPacket), {}, cnt, bytes, clock::now() });
+        }
+
+        void Push(std::unique_ptr<ExtIO_TCP_Proto::Message>&& msg, int cnt, size_t bytes) override
+        {
+            Push({ {}, std::move(msg), cnt, bytes, clock::now() });
+        }
+
+        void AddDropped(uint64_t samples) override
+        {
+            _stats.droppedSamples += samples;
+            _pendingDropped += samples;
+        }
+
+        void Clear() override
+        {
+            _queue.clear();
+            _queuedBytes = 0;
+            _pendingDropped = 0;
+        }
+
+        void SetDatagramSender(IIQDatagramSender* sender) override
+        {
+            _datagrams = sender;
+        }
+
+        Stats GetStats() const override
+        {
+            return _stats;
+        }
+
+    private:
+
+        void Push(block&& b)
+        {
+            if (b.is_data() && IsOverLimits(b))
+            {
+                if (_limits.dropNewest)
+                {
+                    Drop(b);
+                    return;
+                }
+
+                while (IsOverLimits(b))
+                {
+                    auto it = OldestData();
+                    if (it == _queue.end())
+                        break;
+                    Drop(*it);
+                    _queuedBytes -= it->bytes;
+                    _queue.erase(it);
+                }
+            }
+
+            _queuedBytes += b.bytes;
+            _queue.push_back(std::move(b));
+
+            _stats.highWaterBytes = std::max(_stats.highWaterBytes, _queuedBytes);
+            _stats.highWaterBlocks = std::max(_stats.highWaterBlocks, _queue.size());
+
+            Pump();
+        }
+
+        std::deque<block>::iterator OldestData()
+        {
+            return std::find_if(_queue.begin(), _queue.end(), [](const block& b) { return b.is_data(); });
+        }
+
+        bool IsOverLimits(const block& incoming)
+        {
+            if (_limits.maxBytes && _queuedBytes + incoming.bytes > _limits.maxBytes)
+                return true;
+
+            if (_limits.maxAge.count())
+            {
+                auto it = OldestData();
+                if (it != _queue.end() && incoming.queued - it->queued > _limits.maxAge)
+                    return true;
+            }
+
+            return false;
+        }
+
+        void Drop(const block& b)
+        {
+            if (!_pendingDropped)
+                LOG(trace) << "IQ queue is over limits, dropping "
+                    << (_limits.dropNewest ? "newest" : "oldest") << " blocks.";
+
+            ++_stats.droppedBlocks;
+            _stats.droppedSamples += b.cnt;
+            _pendingDropped += b.cnt;
+        }
+
+        void Pump()
+        {
+            while (_inFlight < c_maxBlocksInFlight && !_queue.empty())
+            {
+                auto b = std::move(_queue.front());
+                _queue.pop_front();
+                _queuedBytes -= b.bytes;
+
+                if (_pendingDropped)
+                {
+                    LOG(trace) << "IQ queue dropped " << _pendingDropped << " samples.";
+                    MarkDropped(b, (uint32_t)std::min<uint64_t>(_pendingDropped, UINT32_MAX));
+                    _pendingDropped = 0;
+                }
+
+                ++_inFlight;
+                ++_stats.sentBlocks;
+
+                auto cb = [this, a = AliveFlag()](const boost::system::error_code& ec) {
+                    if (!a.IsAlive())
+                        return;
+                    --_inFlight;
+                    if (ec.failed())
+                    {
+                        Clear();
+                        return;
+                    }
+                    Pump();
+                };
+
+                if (b.raw && b.is_data() && _datagrams)
+                    _datagrams->AsyncSend(b.raw, std::move(cb));
+                else if (b.raw)
+                    _proto.AsyncSendRawData(b.raw, std::move(cb));
+                else
+                    _proto.AsyncSendMessage(std::move(b.msg), std::move(cb));
+            }
+        }
+
+        static void MarkDropped(block& b, uint32_t dropped)
+        {
+            if (b.raw)
+                reinterpret_cast<RawIQHead*>(b.raw->data())->droppedSamples = dropped;
+            else
+                b.msg->mutable_extiocallback()->set_dropped_samples(dropped);
+        }
+    };
+}
+
+std::unique_ptr<IIQSendQueue> MakeIQSendQueue(Protocol::IParser& proto, const IIQSendQueue::Limits& limits)
+{
+    return std::make_unique<IQSendQueue>(proto, limits);
+}
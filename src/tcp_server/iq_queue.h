@@ -0,0 +1,64 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include "../utils/Protocol.h"
+#include "../utils/IQDatagram.h"
+
+// Staging queue of the IQ stream in front of the connection write queue.
+// Only a few IQ blocks are handed to the connection at once, the rest wait
+// here bounded by bytes and age. When a bound is exceeded IQ data blocks are
+// dropped according to the policy, status blocks (cnt <= 0) are never dropped.
+// The number of samples dropped is sent with the next block.
+// Data blocks go to the datagram sender once it is set, status blocks
+// always go over the connection.
+// All the methods must be called from within the connection strand.
+class IIQSendQueue
+{
+public:
+
+    struct Limits
+    {
+        size_t maxBytes = 0;                    // 0 - unbounded
+        std::chrono::milliseconds maxAge{ 0 };  // 0 - unbounded
+        bool dropNewest = false;                // drop the incoming block instead of the oldest queued one
+    };
+
+    struct Stats
+    {
+        uint64_t sentBlocks = 0;
+        uint64_t droppedBlocks = 0;
+        uint64_t droppedSamples = 0;
+        size_t highWaterBytes = 0;
+        size_t highWaterBlocks = 0;
+    };
+
+    virtual ~IIQSendQueue() = default;
+
+    virtual void Push(IConnection::buffer_ptr&& rawPacket, int cnt) = 0;
+    virtual void Push(std::unique_ptr<ExtIO_TCP_Proto::Message>&& msg, int cnt, size_t bytes) = 0;
+    // Samples lost before reaching the queue, reported with the next block as the dropped ones
+    virtual void AddDropped(uint64_t samples) = 0;
+    virtual void Clear() = 0;
+    virtual void SetDatagramSender(IIQDatagramSender* sender) = 0;
+    virtual Stats GetStats() const = 0;
+};
+
+std::unique_ptr<IIQSendQueue> MakeIQSendQueue(Protocol::IParser& proto, const IIQSendQueue::Limits& limits);
@@ -74,6 +74,7 @@ int main(int argc, const char* argv[])
 		<< "--extio_path=<Path to the ExtIO_XXX.dll>  - ExtIO API dynamic linking library to be propagated over the network. This is mandatory parameter.\n"
 		<< "--listening_port=12345  - The port number to be listened for client connections, default is 2056.\n"
 		<< "--log_level=0  - Integer value of logging level: trace=0; debug=1; info=2; warning=3; error=4; fatal=5, default is 4.\n"
+		<< "--write_batch_limit=262144  - Max number of bytes of queued packets sent by one socket write, default is 262144.\n"
 		<< "\n\n";
 
 	auto log = Logging::MakeLog(true, "ExtIoOverNet_server");
@@ -91,6 +92,16 @@ int main(int argc, const char* argv[])
 		LOG(trace) << "extio_path=" << Options::get().extIoSharedLibName;
 		LOG(trace) << "listening_port=" << Options::get().listeningPort;
 		LOG(trace) << "log_level=" << Options::get().logLevel;
+		LOG(trace) << "write_batch_limit=" << Options::get().writeBatchLimit;
+		LOG(trace) << "iq_queue_max_bytes=" << Options::get().iqQueueMaxBytes;
+		LOG(trace) << "iq_queue_max_ms=" << Options::get().iqQueueMaxMs;
+		LOG(trace) << "iq_drop_policy=" << (Options::get().iqDropNewest ? "newest" : "oldest");
+		LOG(trace) << "udp_loss_percent=" << Options::get().udpLossPercent;
+		LOG(trace) << "multicast_group=" << Options::get().multicastGroup;
+		LOG(trace) << "multicast_port=" << Options::get().multicastPort;
+		LOG(trace) << "multicast_ttl=" << Options::get().multicastTtl;
+		LOG(trace) << "socket_backend=" << (Options::get().ioUring ? "io_uring" : "asio");
+		LOG(trace) << "zerocopy_threshold=" << Options::get().zeroCopyThreshold;
 	}
 
 	LOG(trace) << "Setting log level to " << Options::get().logLevel;
@@ -50,6 +50,26 @@ void Options::parse_options(int argc, const char* argv[])
 			("listening_port", po::value<uint16_t>()->default_value(2056), "The port number to be listened for client connections, default is 2056.");
 		desc.add_options()
 			("log_level", po::value<int16_t>()->default_value(4), "Integer value of logging level: trace=0; debug=1; info=2; warning=3; error=4; fatal=5, default is 4.");
+		desc.add_options()
+			("write_batch_limit", po::value<uint32_t>()->default_value(256 * 1024), "Max number of bytes of queued packets sent by one socket write, default is 262144.");
+		desc.add_options()
+			("iq_queue_max_bytes", po::value<uint32_t>()->default_value(8 * 1024 * 1024), "Max number of bytes of IQ data waiting to be sent, 0 is unbounded, default is 8388608.");
+		desc.add_options()
+			("iq_queue_max_ms", po::value<uint32_t>()->default_value(500), "Max age in milliseconds of IQ data waiting to be sent, 0 is unbounded, default is 500.");
+		desc.add_options()
+			("iq_drop_policy", po::value<std::string>()->default_value("oldest"), "IQ data dropped when the queue is over limits: oldest or newest, default is oldest.");
+		desc.add_options()
+			("udp_loss_percent", po::value<double>()->default_value(0), "Percent of IQ datagrams dropped on purpose to test the UDP data plane, default is 0.");
+		desc.add_options()
+			("multicast_group", po::value<std::string>(), "Multicast group address the IQ data of the shared device are sent to, enables the multicast mode.");
+		desc.add_options()
+			("multicast_port", po::value<uint16_t>()->default_value(5400), "Port number of the IQ multicast group, default is 5400.");
+		desc.add_options()
+			("multicast_ttl", po::value<int>()->default_value(1), "Time to live of the IQ multicast datagrams, default is 1.");
+		desc.add_options()
+			("socket_backend", po::value<std::string>()->default_value("asio"), "Client connections socket I/O: asio or io_uring (Linux only), default is asio.");
+		desc.add_options()
+			("zerocopy_threshold", po::value<uint32_t>()->default_value(0), "Min size in bytes of IQ packets sent with MSG_ZEROCOPY (Linux asio backend only), 0 is off, default is 0.");
 
 		po::variables_map vm;
 		po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -61,6 +81,40 @@ void Options::parse_options(int argc, const char* argv[])
 			listeningPort = vm["listening_port"].as<uint16_t>();
 		if (vm.count("log_level"))
 			logLevel = vm["log_level"].as<int16_t>();
+		if (vm.count("write_batch_limit"))
+			writeBatchLimit = vm["write_batch_limit"].as<uint32_t>();
+		if (vm.count("iq_queue_max_bytes"))
+			iqQueueMaxBytes = vm["iq_queue_max_bytes"].as<uint32_t>();
+		if (vm.count("iq_queue_max_ms"))
+			iqQueueMaxMs = vm["iq_queue_max_ms"].as<uint32_t>();
+		if (vm.count("iq_drop_policy"))
+		{
+			const auto policy = vm["iq_drop_policy"].as<std::string>();
+			if (policy != "oldest" && policy != "newest")
+				throw std::invalid_argument("Invalid iq_drop_policy value: " + policy);
+			iqDropNewest = policy == "newest";
+		}
+		if (vm.count("udp_loss_percent"))
+			udpLossPercent = vm["udp_loss_percent"].as<double>();
+		if (vm.count("multicast_group"))
+		{
+			multicastGroup = vm["multicast_group"].as<std::string>();
+			if (!boost::asio::ip::make_address(multicastGroup).is_multicast())
+				throw std::invalid_argument("Not a multicast address: " + multicastGroup);
+		}
+		if (vm.count("multicast_port"))
+			multicastPort = vm["multicast_port"].as<uint16_t>();
+		if (vm.count("multicast_ttl"))
+			multicastTtl = vm["multicast_ttl"].as<int>();
+		if (vm.count("socket_backend"))
+		{
+			const auto backend = vm["socket_backend"].as<std::string>();
+			if (backend != "asio" && backend != "io_uring")
+				throw std::invalid_argument("Invalid socket_backend value: " + backend);
+			ioUring = backend == "io_uring";
+		}
+		if (vm.count("zerocopy_threshold"))
+			zeroCopyThreshold = vm["zerocopy_threshold"].as<uint32_t>();
 	}
 	catch (const std::exception& e)
 	{
@@ -33,4 +33,14 @@ struct Options
     uint16_t listeningPort = 1235;
     std::string extIoSharedLibName;
     int16_t logLevel = boost::log::trivial::severity_level::trace;
+    uint32_t writeBatchLimit = 256 * 1024;
+    uint32_t iqQueueMaxBytes = 8 * 1024 * 1024;
+    uint32_t iqQueueMaxMs = 500;
+    bool iqDropNewest = false;
+    double udpLossPercent = 0;
+    std::string multicastGroup;
+    uint16_t multicastPort = 5400;
+    int multicastTtl = 1;
+    bool ioUring = false;
+    uint32_t zeroCopyThreshold = 0;
 };
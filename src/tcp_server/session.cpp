@@ -27,6 +27,9 @@
 #include "../utils/GlobalDefs.h"
 #include "ExtIO_DLL.h"
 #include "options.h"
+#include "iq_queue.h"
+#include "iq_handoff.h"
+#include "ddc.h"
 #include "WindowsMessageLoop.h"
 
 using namespace boost;
@@ -35,51 +38,55 @@ namespace
 {
     using namespace Protocol;
 
+    using ExtIOCallbackFnT = std::function<int(int, int, float, void*)>;
+
+    // The driver thread calls cb without locking,
+    // FreeExtIOCallback waits for the call in progress to return.
     template<size_t idx>
     struct ExtIOCallbackNode
     {
-        static inline std::mutex mx;
-        static inline std::function<int(int, int, float, void*)> fn;
+        static inline std::atomic<ExtIOCallbackFnT*> fn = nullptr;
+        static inline std::atomic_int calls = 0;
         static int cb(int cnt, int status, float IQoffs, void* IQdata)
         {
-            std::lock_guard _(mx);
-            if (!fn) return -1;
-            return fn(cnt, status, IQoffs, IQdata);
+            calls.fetch_add(1);
+            int result = -1;
+            if (auto f = fn.load())
+                result = (*f)(cnt, status, IQoffs, IQdata);
+            calls.fetch_sub(1);
+            return result;
         }
     };
 
     struct ExtIOCallback
     {
-        using ExtIOCallbackFnT = std::function<int(int, int, float, void*)>;
-
-        std::mutex& mx;
+        std::atomic<ExtIOCallbackFnT*>& fn;
+        std::atomic_int& calls;
         pfnExtIOCallback  cb;
-        ExtIOCallbackFnT& fn;
     };
 
     ExtIOCallback g_extIOCallbacks[] = {
-        {ExtIOCallbackNode<0>::mx, ExtIOCallbackNode<0>::cb, ExtIOCallbackNode<0>::fn },
-        {ExtIOCallbackNode<1>::mx, ExtIOCallbackNode<1>::cb, ExtIOCallbackNode<1>::fn },
-        {ExtIOCallbackNode<2>::mx, ExtIOCallbackNode<2>::cb, ExtIOCallbackNode<2>::fn },
-        {ExtIOCallbackNode<3>::mx, ExtIOCallbackNode<3>::cb, ExtIOCallbackNode<3>::fn },
-        {ExtIOCallbackNode<4>::mx, ExtIOCallbackNode<4>::cb, ExtIOCallbackNode<4>::fn },
+        {ExtIOCallbackNode<0>::fn, ExtIOCallbackNode<0>::calls, ExtIOCallbackNode<0>::cb },
+        {ExtIOCallbackNode<1>::fn, ExtIOCallbackNode<1>::calls, ExtIOCallbackNode<1>::cb },
+        {ExtIOCallbackNode<2>::fn, ExtIOCallbackNode<2>::calls, ExtIOCallbackNode<2>::cb },
+        {ExtIOCallbackNode<3>::fn, ExtIOCallbackNode<3>::calls, ExtIOCallbackNode<3>::cb },
+        {ExtIOCallbackNode<4>::fn, ExtIOCallbackNode<4>::calls, ExtIOCallbackNode<4>::cb },
     };
 
     constexpr size_t g_extIOCallbacksNumber = sizeof(g_extIOCallbacks) / sizeof(g_extIOCallbacks[0]);
     unsigned g_nextExtIOCallbacksIdx = 0;
     std::mutex g_nextExtIOCallbacksIdxMx;
 
-    std::tuple<unsigned, pfnExtIOCallback> SetupExtIOCallback(ExtIOCallback::ExtIOCallbackFnT&& fn)
+    std::tuple<unsigned, pfnExtIOCallback> SetupExtIOCallback(ExtIOCallbackFnT&& fn)
     {
         std::scoped_lock _(g_nextExtIOCallbacksIdxMx);
         for (size_t i = 0; i < g_extIOCallbacksNumber; ++i) {
             const auto handle = g_nextExtIOCallbacksIdx++;
             if (g_nextExtIOCallbacksIdx == g_extIOCallbacksNumber)
                 g_nextExtIOCallbacksIdx = 0;
-            std::scoped_lock __(g_extIOCallbacks[handle].mx);
-            if (g_extIOCallbacks[handle].fn)
+            if (g_extIOCallbacks[handle].fn.load())
                 continue;
-            g_extIOCallbacks[handle].fn = std::move(fn);
+            g_extIOCallbacks[handle].fn.store(new ExtIOCallbackFnT(std::move(fn)));
             return std::make_tuple(handle, g_extIOCallbacks[handle].cb);
         }
         return {};
@@ -88,11 +95,19 @@ namespace
     void FreeExtIOCallback(unsigned handle)
     {
         assert(handle < g_extIOCallbacksNumber);
-        std::scoped_lock __(g_extIOCallbacks[handle].mx);
-        assert(g_extIOCallbacks[handle].fn);
-        g_extIOCallbacks[handle].fn = {};
+        auto* fn = g_extIOCallbacks[handle].fn.exchange(nullptr);
+        assert(fn);
+        while (g_extIOCallbacks[handle].calls.load())
+            std::this_thread::yield();
+        delete fn;
     }
 
+    // IQ blocks waiting for the session strand, a few hundreds of ms of a wideband receiver.
+    // StartHW grows the ring to hold c_iqHandoffBlocks of the driver blocks, up to the cap.
+    constexpr size_t c_iqHandoffBytes = 8 * 1024 * 1024;
+    constexpr size_t c_iqHandoffBlocks = 4;
+    constexpr size_t c_maxIQHandoffBytes = 256 * 1024 * 1024;
+
     struct exec_ctx
     {
         boost::asio::io_context _ctx;
@@ -121,6 +136,7 @@ namespace
         extHWtypeT dataType = exthwNone;
         std::string hwName;
         std::string hwModel;
+        std::optional<ExtIO_TCP_Proto::Message> capabilities;
 
         size_t SampleSize()
         {
@@ -141,6 +157,24 @@ namespace
             assert(0);
             return 2;
         }
+
+        // Bytes of the I or Q value of the integer formats the IQ codec compresses
+        size_t IntegerValueSize()
+        {
+            switch (dataType)
+            {
+            case exthwUSBdata16:
+                return 2;
+            case exthwUSBdata24:
+                return 3;
+            case exthwUSBdata32:
+            case exthwFullPCM32:
+                return 4;
+            case exthwUSBdataS8:
+                return 1;
+            }
+            return 0;
+        }
     };
 
     class Session : public ISession, public std::enable_shared_from_this<Session>
@@ -149,12 +183,42 @@ namespace
         std::shared_ptr<Session> _this;
         std::unique_ptr<IConnection> _connection;
         std::unique_ptr<IParser> _proto;
+        std::unique_ptr<IIQDatagramSender> _iqDatagrams;
+        std::unique_ptr<IIQSendQueue> _iqQueue;
+        // the ring the driver thread pushes to
+        IQHandoffSwap _iqHandoff;
         std::unique_ptr<ExtIO_Dll> _dll;
         bool _bOpenHWSuccidded = false;
         AliveInstance _inst;
         HW_cache _hwCache;
         unsigned _callBackHandle = -1;
         std::unique_ptr<IMessageLoop> _msgLoop;
+        std::atomic_bool _rawIqData = false;
+        Protocol::LinkStats _linkStats;
+        IQCodec::Config _iqCodec;
+        IQCodec::Stats _iqCodecStats;
+        std::unique_ptr<IDDC> _ddc;
+        // statuses changing the capabilities queued to the client, the snapshots carry it
+        uint64_t _capabilityStatuses = 0;
+
+        // Multicast mode: the session which opened the device owns the tuning rights,
+        // the others are listeners forwarding their queries to its thread.
+        static inline std::mutex s_deviceOwnerMx;
+        static inline std::weak_ptr<Session> s_deviceOwner;
+        bool _multicast = false;
+        bool _isListener = false;
+        std::weak_ptr<Session> _owner;
+        std::vector<std::weak_ptr<Session>> _listeners;
+        int32_t _startHWResult = -1;
+        size_t _iqHandoffSize = c_iqHandoffBytes;
+
+        // Control channel: a second connection of the client carries its requests,
+        // their responces do not wait behind the IQ blocks queued on this one.
+        static inline std::mutex s_controlTokensMx;
+        static inline std::map<uint64_t, std::weak_ptr<Session>> s_controlTokens;
+        bool _isControl = false;
+        std::weak_ptr<Session> _dataSession;
+        std::weak_ptr<Session> _controlSession;
 
     public:
 
@@ -162,11 +226,20 @@ namespace
             std::shared_ptr<exec_ctx>&& ctx,
             asio::ip::tcp::socket&& socket)
             : _ctx(std::move(ctx))
-            , _connection(MakeConnection(_ctx->_strand))
+            , _connection(MakeConnection(_ctx->_strand, ConnectionType::TcpWithLocalChannel,
+                Options::get().ioUring ? SocketBackend::IoUring : SocketBackend::Asio))
             , _proto(Protocol::MakeParser(*_connection))
+            , _iqQueue(MakeIQSendQueue(*_proto, {
+                Options::get().iqQueueMaxBytes,
+                std::chrono::milliseconds(Options::get().iqQueueMaxMs),
+                Options::get().iqDropNewest }))
             , _msgLoop(MakeMessageLoop())
         {
             _connection->Attach(std::move(socket));
+            _connection->SetWriteBatchLimit(Options::get().writeBatchLimit);
+            _connection->SetZeroCopyThreshold(Options::get().zeroCopyThreshold);
+
+            _iqHandoff.Replace(MakeIQHandoff(c_iqHandoffBytes));
         }
 
         ~Session()
@@ -191,6 +264,29 @@ namespace
         {
             LOG(trace) << reason;
 
+            _iqQueue->Clear();
+
+            for (auto& l : _listeners)
+            {
+                if (auto listener = l.lock())
+                {
+                    asio::post(listener->_ctx->_strand, [l]() {
+                        if (auto listener = l.lock())
+                            listener->AsyncDestroySession("Device owner session is closed.");
+                    });
+                }
+            }
+            _listeners.clear();
+
+            if (auto control = _controlSession.lock())
+            {
+                asio::post(control->_ctx->_strand, [c = _controlSession]() {
+                    if (auto control = c.lock())
+                        control->AsyncDestroySession("Data session is closed.");
+                });
+            }
+            _controlSession.reset();
+
             if (_dll)
             {
                 if (_bOpenHWSuccidded)
@@ -274,6 +370,23 @@ namespace
                 return OnCommunicationError(ec);
 
             LOG(trace) << "New request [" << did << "] (" << _proto->GetMessageName(msg) << ") received...";
+
+            auto responce =
+                IsControl() ? HandleControlRequest(msg, did) :
+                IsListener() ? HandleListenerRequest(msg, did, weak_from_this()) :
+                HandleRequest(msg, did);
+
+            if (responce.has_value()) {
+                LOG(trace) << "Request [" << did << "] (" << _proto->GetMessageName(msg) << ") sending responce with ("
+                    << _proto->GetMessageName(*responce) << ") content...";
+                _proto->AsyncSendResponce(*responce, did, OnServingRequestFinishedCB());
+            }
+            else
+                OnServingRequestFinishedCB()({});
+        }
+
+        std::optional<ExtIO_TCP_Proto::Message> HandleRequest(const ExtIO_TCP_Proto::Message& msg, int64_t did)
+        {
             std::optional<ExtIO_TCP_Proto::Message> responce;
             switch (msg.Content_case())
             {
@@ -283,6 +396,8 @@ namespace
                 responce = OnInitHW(msg); break;
             case ExtIO_TCP_Proto::Message::ContentCase::kLoadExtIOApi:
                 responce = OnLoadExtIOApi(msg, did); break;
+            case ExtIO_TCP_Proto::Message::ContentCase::kAttachControl:
+                responce = OnAttachControl(msg); break;
             case ExtIO_TCP_Proto::Message::ContentCase::kOpenHW:
                 responce = OnOpenHW(msg); break;
             case ExtIO_TCP_Proto::Message::ContentCase::kSetHWLO:
@@ -319,6 +434,8 @@ namespace
                 responce = OnExtIoSetSrate(msg); break;
             case ExtIO_TCP_Proto::Message::ContentCase::kExtIoGetBandwidth:
                 responce = OnExtIoGetBandwidth(msg); break;
+            case ExtIO_TCP_Proto::Message::ContentCase::kSetDDC:
+                responce = OnSetDDC(msg); break;
 
             case ExtIO_TCP_Proto::Message::ContentCase::kShowGUI:
                 responce = OnShowGUI(msg); break;
@@ -329,14 +446,197 @@ namespace
             default:
                 responce = OnUnhandledMessage(msg);
             }
+            return responce;
+        }
 
-            if (responce.has_value()) {
-                LOG(trace) << "Request [" << did << "] (" << _proto->GetMessageName(msg) << ") sending responce with ("
-                    << _proto->GetMessageName(*responce) << ") content...";
-                _proto->AsyncSendResponce(*responce, did, OnServingRequestFinishedCB());
+        bool IsListener() const
+        {
+            return _isListener;
+        }
+
+        bool IsControl() const
+        {
+            return _isControl;
+        }
+
+        // Listeners do not touch the device: tuning is rejected,
+        // queries are executed by the owner session and answered to replyTo.
+        std::optional<ExtIO_TCP_Proto::Message> HandleListenerRequest(
+            const ExtIO_TCP_Proto::Message& msg, int64_t did, const std::weak_ptr<Session>& replyTo)
+        {
+            switch (msg.Content_case())
+            {
+            case ExtIO_TCP_Proto::Message::ContentCase::kHello:
+            case ExtIO_TCP_Proto::Message::ContentCase::kInitHW:
+                return HandleRequest(msg, did);
+            case ExtIO_TCP_Proto::Message::ContentCase::kLoadExtIOApi:
+                return Protocol::Make_LoadExtIOApi_Msg(ExtIO_TCP_Proto::ErrorCode::Success);
+            case ExtIO_TCP_Proto::Message::ContentCase::kOpenHW:
+                return Protocol::Make_OpenHW_Msg(true);
+            case ExtIO_TCP_Proto::Message::ContentCase::kStopHW:
+                return Protocol::Make_StopHW_Msg({ ExtIO_TCP_Proto::ErrorCode::Success });
+            case ExtIO_TCP_Proto::Message::ContentCase::kVersionInfo:
+                return Protocol::Make_VersionInfo_Msg({}, {}, {});
+            case ExtIO_TCP_Proto::Message::ContentCase::kSetHWLO:
+            case ExtIO_TCP_Proto::Message::ContentCase::kSetHWLO64:
+            case ExtIO_TCP_Proto::Message::ContentCase::kExtIoSetSrate:
+            case ExtIO_TCP_Proto::Message::ContentCase::kExtIoShowMGC:
+            case ExtIO_TCP_Proto::Message::ContentCase::kShowGUI:
+            case ExtIO_TCP_Proto::Message::ContentCase::kHideGUI:
+            case ExtIO_TCP_Proto::Message::ContentCase::kSwitchGUI:
+            case ExtIO_TCP_Proto::Message::ContentCase::kSetDDC:
+                return Protocol::Make_Error_Msg(ExtIO_TCP_Proto::ErrorCode::NoTuningRights);
+            case ExtIO_TCP_Proto::Message::ContentCase::kAttachControl:
+                return Protocol::Make_AttachControl_Msg({}, ExtIO_TCP_Proto::ErrorCode::LogicError);
+            default:
+                ForwardToOwner(msg, did, replyTo);
+                return {};
             }
-            else
-                OnServingRequestFinishedCB()({});
+        }
+
+        // The control session has no device, its requests are executed by the data session
+        // the same way as they come over the data connection, the responces go back here.
+        std::optional<ExtIO_TCP_Proto::Message> HandleControlRequest(const ExtIO_TCP_Proto::Message& msg, int64_t did)
+        {
+            switch (msg.Content_case())
+            {
+            case ExtIO_TCP_Proto::Message::ContentCase::kHello:
+            case ExtIO_TCP_Proto::Message::ContentCase::kLoadExtIOApi:
+            case ExtIO_TCP_Proto::Message::ContentCase::kAttachControl:
+                return Protocol::Make_Error_Msg(ExtIO_TCP_Proto::ErrorCode::LogicError);
+            default:
+                break;
+            }
+
+            if (_dataSession.expired())
+            {
+                AsyncDestroySession("Data session is closed.");
+                return {};
+            }
+
+            asio::post(_dataSession.lock()->_ctx->_strand, [d = _dataSession, c = weak_from_this(), msg, did]() {
+                auto data = d.lock();
+                if (!data)
+                    return;
+
+                auto responce = data->IsListener() ?
+                    data->HandleListenerRequest(msg, did, c) :
+                    data->HandleRequest(msg, did);
+                if (responce)
+                    PostResponce(c, std::move(*responce), did);
+            });
+            return {};
+        }
+
+        static void PostResponce(const std::weak_ptr<Session>& to, ExtIO_TCP_Proto::Message&& responce, int64_t did)
+        {
+            auto session = to.lock();
+            if (!session)
+                return;
+
+            asio::post(session->_ctx->_strand, [to, responce = std::move(responce), did]() {
+                if (auto session = to.lock())
+                    session->_proto->AsyncSendResponce(responce, did, [](const boost::system::error_code& ec) {});
+            });
+        }
+
+        void ForwardToOwner(const ExtIO_TCP_Proto::Message& msg, int64_t did, const std::weak_ptr<Session>& replyTo)
+        {
+            auto owner = _owner.lock();
+            if (!owner)
+            {
+                AsyncDestroySession("Device owner session is closed.");
+                return;
+            }
+
+            asio::post(owner->_ctx->_strand, [o = _owner, replyTo, msg, did]() {
+                auto owner = o.lock();
+                if (!owner)
+                    return;
+
+                // the listener gets the owner StartHW result which is the IQ block size
+                auto responce = msg.has_starthw() ?
+                    Protocol::Make_StartHW_Msg({ owner->_startHWResult }, {}) :
+                    owner->HandleRequest(msg, did);
+                if (!responce)
+                    responce = Protocol::Make_Error_Msg(ExtIO_TCP_Proto::ErrorCode::Unexpected);
+
+                PostResponce(replyTo, std::move(*responce), did);
+            });
+        }
+
+        bool IsMulticastMode() const
+        {
+            return !Options::get().multicastGroup.empty();
+        }
+
+        // Makes this session a listener of the owner session device, the reply is sent on success
+        void AttachToOwner(const std::shared_ptr<Session>& owner, int64_t did)
+        {
+            _owner = owner;
+
+            asio::post(owner->_ctx->_strand, [o = _owner, l = weak_from_this(), did]() {
+                auto owner = o.lock();
+                auto listener = l.lock();
+                if (!owner || !listener)
+                    return;
+
+                // samples reach the listeners only if the owner multicasts them
+                const bool publishing = owner->_bOpenHWSuccidded && owner->_iqDatagrams;
+                if (publishing)
+                {
+                    std::erase_if(owner->_listeners, [](auto& w) { return w.expired(); });
+                    owner->_listeners.push_back(l);
+                }
+
+                asio::post(listener->_ctx->_strand, [l, publishing, hwCache = owner->_hwCache, did]() {
+                    auto listener = l.lock();
+                    if (!listener)
+                        return;
+
+                    if (!publishing)
+                    {
+                        listener->_owner.reset();
+                        LOG(trace) << "Device owner session does not multicast IQ data.";
+                        auto msg = Protocol::Make_LoadExtIOApi_Msg(ExtIO_TCP_Proto::ErrorCode::DeviceIsBusy);
+                        listener->_proto->AsyncSendResponce(msg, did, [](const boost::system::error_code& ec) {});
+                        return;
+                    }
+
+                    LOG(trace) << "Session is a listener of the device owner session.";
+                    listener->_hwCache = hwCache;
+                    listener->_isListener = true;
+                    listener->_bOpenHWSuccidded = true;
+                    if (hwCache.capabilities)
+                        listener->_proto->AsyncSendResponce(*hwCache.capabilities, 0, [](const boost::system::error_code& ec) {});
+                    auto msg = Protocol::Make_LoadExtIOApi_Msg(ExtIO_TCP_Proto::ErrorCode::Success);
+                    listener->_proto->AsyncSendResponce(msg, did, [](const boost::system::error_code& ec) {});
+                });
+            });
+        }
+
+        // The client reported to answer pings, a silent one is dropped after the heartbeat timeout
+        void StartHeartbeat()
+        {
+            _proto->StartHeartbeat(_ctx->_strand,
+                [this, a = AliveFlag()](const boost::system::error_code& ec, const Protocol::LinkStats& stats) {
+                    if (!a.IsAlive())
+                        return;
+                    if (ec.failed())
+                        return AsyncDestroySession("Heartbeat failed: " + ec.message());
+                    _linkStats = stats;
+                    if (stats.pingsSent % 10 == 0)
+                    {
+                        LOG(trace) << "Link RTT: " << stats.rtt.count() << " us, jitter: " << stats.rttJitter.count()
+                            << " us, goodput: " << (uint64_t)stats.goodput << " B/s, throughput: " << (uint64_t)stats.throughput << " B/s.";
+                        if (_iqCodec.kind != IQCodec::Kind::None)
+                        {
+                            LOG(trace) << "IQ codec " << IQCodec::Name(_iqCodec.kind) << " ratio: " << _iqCodecStats.Ratio()
+                                << ", blocks: " << _iqCodecStats.blocks << ", encoding CPU time: "
+                                << std::chrono::duration_cast<std::chrono::milliseconds>(_iqCodecStats.cpuTime).count() << " ms.";
+                        }
+                    }
+                });
         }
 
         void OnCommunicationError(const boost::system::error_code& ec)
@@ -357,15 +657,201 @@ namespace
         {
             auto& hello = inmsg.hello();
 
-            return Protocol::Make_Hello_Msg(
+            _rawIqData = hello.has_raw_iq_data() && hello.raw_iq_data();
+            LOG(trace) << "Raw IQ data mode: " << _rawIqData;
+
+            // the first checksum of the client preference list we know
+            std::vector<Checksum::Kind> checksum;
+            for (auto c : hello.checksums())
+            {
+                if (!Checksum::IsValid((uint8_t)c))
+                    continue;
+                checksum.push_back((Checksum::Kind)c);
+                _connection->SetChecksum(checksum.front());
+                break;
+            }
+
+            std::optional<uint32_t> udpPort;
+            std::optional<std::string> multicastGroup;
+            std::optional<std::string> multicastSource;
+            std::optional<std::string> localChannel;
+            std::optional<uint64_t> controlToken;
+
+            if (hello.control_channel())
+                controlToken = RegisterControlToken();
+
+            if (hello.heartbeat())
+                StartHeartbeat();
+
+            // large packets are fragmented only for a client able to reassemble them
+            if (hello.has_max_frame_size())
+                _connection->SetMaxFrameSize(hello.max_frame_size());
+
+            // IQ data blocks of the device owner are multicast to all the sessions
+            _multicast = IsMulticastMode() && _rawIqData && hello.has_multicast() && hello.multicast();
+
+            // a client of the same host reads IQ data blocks from shared memory
+            if (!_multicast && _rawIqData && hello.local_channel() &&
+                _connection->RemoteEndpoint().address().is_loopback())
+            {
+                if (auto name = _connection->CreateLocalChannel(); !name.empty())
+                    localChannel = name;
+            }
+
+            if (_multicast)
+            {
+                multicastGroup = Options::get().multicastGroup;
+                udpPort = Options::get().multicastPort;
+                try
+                {
+                    const auto source = MulticastSourceAddress(_ctx->_strand,
+                        { boost::asio::ip::make_address(*multicastGroup), (uint16_t)*udpPort });
+                    if (!source.is_unspecified())
+                        multicastSource = source.to_string();
+                }
+                catch (const std::exception& e)
+                {
+                    LOG(warning) << "IQ multicast source is unknown: " << e.what();
+                }
+            }
+            else if (localChannel)
+            {
+                LOG(trace) << "IQ data blocks go through the local channel <" << *localChannel << ">.";
+            }
+            // IQ data blocks go over UDP to the client address and the port it listens to
+            else if (_rawIqData && hello.has_udp_port() && hello.udp_port() && !_iqDatagrams)
+            {
+                try
+                {
+                    const auto remote = _connection->RemoteEndpoint();
+                    _iqDatagrams = MakeIQDatagramSender(
+                        _ctx->_strand,
+                        { remote.address(), (uint16_t)hello.udp_port() },
+                        Options::get().udpLossPercent);
+                    _iqQueue->SetDatagramSender(_iqDatagrams.get());
+                    udpPort = _iqDatagrams->LocalPort();
+                }
+                catch (const std::exception& e)
+                {
+                    LOG(warning) << "IQ datagrams are disabled: " << e.what();
+                }
+            }
+
+            // the coded blocks are for the TCP stream, the datagrams and the
+            // local channel carry the samples as they are
+            std::vector<IQCodec::Kind> iqCodec;
+            std::optional<uint32_t> iqPackBits;
+            if (hello.iq_codecs_size())
+            {
+                _iqCodec = {};
+                if (_rawIqData && !_multicast && !localChannel && !_iqDatagrams)
+                {
+                    for (auto c : hello.iq_codecs())
+                    {
+                        if (!IQCodec::IsValid((uint8_t)c))
+                            continue;
+                        _iqCodec.kind = (IQCodec::Kind)c;
+                        break;
+                    }
+                }
+                iqCodec.push_back(_iqCodec.kind);
+                if (_iqCodec.kind == IQCodec::Kind::Packed)
+                {
+                    if (hello.has_iq_pack_bits())
+                        _iqCodec.packBits = std::clamp((int)std::min(hello.iq_pack_bits(), 32u), IQCodec::c_minPackBits, IQCodec::c_maxPackBits);
+                    iqPackBits = _iqCodec.packBits;
+                    LOG(trace) << "IQ codec: " << IQCodec::Name(_iqCodec.kind) << ", " << _iqCodec.packBits << " bits.";
+                }
+                else
+                    LOG(trace) << "IQ codec: " << IQCodec::Name(_iqCodec.kind);
+            }
+
+            auto msg = Protocol::Make_Hello_Msg(
                 Protocol::c_protocolVersion,
                 std::string(c_appName) + "-" + c_versionString);
+            auto& responce = *msg.mutable_hello();
+            responce.set_raw_iq_data(_rawIqData);
+            for (auto c : checksum)
+                responce.add_checksums((ExtIO_TCP_Proto::ChecksumType)c);
+            if (udpPort)
+                responce.set_udp_port(*udpPort);
+            if (multicastGroup)
+                responce.set_multicast_group(*multicastGroup);
+            if (multicastSource)
+                responce.set_multicast_source(*multicastSource);
+            if (localChannel)
+                responce.set_local_channel_name(*localChannel);
+            if (controlToken)
+                responce.set_control_token(*controlToken);
+            responce.set_max_frame_size((uint32_t)IConnection::c_maxFrameSize);
+            responce.set_heartbeat(hello.heartbeat());
+            for (auto c : iqCodec)
+                responce.add_iq_codecs((ExtIO_TCP_Proto::IQCodecType)c);
+            if (iqPackBits)
+                responce.set_iq_pack_bits(*iqPackBits);
+            return msg;
+        }
+
+        // The token is good for a single AttachControl
+        uint64_t RegisterControlToken()
+        {
+            std::scoped_lock _(s_controlTokensMx);
+            // the token grants the session to whoever presents it, so it comes from
+            // the system CSPRNG and not from a generator its outputs would reveal
+            static std::random_device rng;
+            std::erase_if(s_controlTokens, [](auto& t) { return t.second.expired(); });
+            uint64_t token = 0;
+            while (!token || s_controlTokens.contains(token))
+                token = (uint64_t)rng() << 32 | rng();
+            s_controlTokens[token] = weak_from_this();
+            return token;
+        }
+
+        std::optional<ExtIO_TCP_Proto::Message> OnAttachControl(const ExtIO_TCP_Proto::Message& inmsg)
+        {
+            std::shared_ptr<Session> data;
+            {
+                std::scoped_lock _(s_controlTokensMx);
+                if (auto it = s_controlTokens.find(inmsg.attachcontrol().token()); it != s_controlTokens.end())
+                {
+                    data = it->second.lock();
+                    s_controlTokens.erase(it);
+                }
+            }
+
+            if (!data || data.get() == this)
+                return Protocol::Make_AttachControl_Msg({}, ExtIO_TCP_Proto::ErrorCode::InvalidArgument);
+
+            LOG(trace) << "Session is the control channel of another session.";
+
+            _isControl = true;
+            _dataSession = data;
+
+            asio::post(data->_ctx->_strand, [d = _dataSession, c = weak_from_this()]() {
+                if (auto data = d.lock())
+                    data->_controlSession = c;
+            });
+
+            return Protocol::Make_AttachControl_Msg({}, ExtIO_TCP_Proto::ErrorCode::Success);
         }
 
         std::optional<ExtIO_TCP_Proto::Message> OnLoadExtIOApi(const ExtIO_TCP_Proto::Message& inmsg, int64_t did)
         {
             auto& LoadExtIOApi = inmsg.loadextioapi();
 
+            if (IsMulticastMode())
+            {
+                std::scoped_lock _(s_deviceOwnerMx);
+                if (auto owner = s_deviceOwner.lock(); owner && owner.get() != this)
+                {
+                    if (!_multicast)
+                        return Protocol::Make_LoadExtIOApi_Msg(ExtIO_TCP_Proto::ErrorCode::DeviceIsBusy);
+                    AttachToOwner(owner, did);
+                    return {};
+                }
+                s_deviceOwner = weak_from_this();
+            }
+
             _dll = LoadLibrary(Options::get().extIoSharedLibName);
             if (!_dll)
             {
@@ -440,6 +926,12 @@ namespace
 
                     _bOpenHWSuccidded = true;
 
+                    if (_multicast && !_iqDatagrams)
+                        StartMulticast();
+
+                    // goes ahead of the responce, the client has the tables by the time it returns
+                    PushCapabilities();
+
                     auto msg = Protocol::Make_LoadExtIOApi_Msg(ExtIO_TCP_Proto::ErrorCode::Success);
                     _proto->AsyncSendResponce(msg, did, OnServingRequestFinishedCB());
                 }
@@ -495,6 +987,7 @@ namespace
         {
             long result = -1;
             if (_dll) result = _dll->GetHWSR();
+            if (result > 0) result = (long)DDCRate(result);
             return Protocol::Make_GetHWSR_Msg({ result });
         }
 
@@ -506,6 +999,11 @@ namespace
             const auto& starthw = inmsg.starthw();
             if (starthw.has_extlofreq()) extLOfreq = starthw.extlofreq();
             if (_dll) result = _dll->StartHW(extLOfreq);
+            _startHWResult = result;
+            if (result > 0)
+                GrowIQHandoff((size_t)result * _hwCache.SampleSize());
+            // the host takes the result for the samples per callback
+            if (_ddc) _ddc->SetBlockSize(result);
             return Protocol::Make_StartHW_Msg({ result }, {});
         }
 
@@ -517,22 +1015,272 @@ namespace
             return Protocol::Make_StopHW_Msg({ ExtIO_TCP_Proto::ErrorCode::Success});
         }
 
+        // The driver thread, the block is copied to the handoff ring only
         int ExtIOCallback(int cnt, int status, float IQoffs, void* IQdata)
         {
             if(cnt<=0) 
                 LOG(trace) << "ExtIOCallback is called with cnt: " << cnt << "; status: " << status;
 
+            const size_t bytes = (cnt > 0 && IQdata) ? static_cast<size_t>(cnt) * _hwCache.SampleSize() : 0;
+            _iqHandoff.In().Push(cnt, status, IQoffs, IQdata, bytes);
+
+            return 0;
+        }
+
+        // a burst of driver callbacks costs one post
+        std::unique_ptr<IIQHandoff> MakeIQHandoff(size_t bytes)
+        {
+            return ::MakeIQHandoff(bytes, [this, a = ::AliveFlag(_inst)]() {
+                asio::post(_ctx->_strand, [this, a]() {
+                    if (!a.IsAlive()) return;
+                    DrainIQBlocks();
+                });
+            });
+        }
+
+        // The ring is replaced without stopping the driver thread, the blocks it
+        // pushes to the old one until it sees the new one are drained before
+        void GrowIQHandoff(size_t blockBytes)
+        {
+            size_t bytes = IQHandoffCapacity(blockBytes, c_iqHandoffBlocks);
+            if (bytes > c_maxIQHandoffBytes)
+            {
+                LOG(warning) << "IQ blocks of " << blockBytes << " bytes are over the handoff ring cap of "
+                    << c_maxIQHandoffBytes << " bytes, fewer of them are buffered.";
+                bytes = c_maxIQHandoffBytes;
+            }
+
+            if (bytes <= _iqHandoffSize || _iqHandoff.Replacing())
+                return;
+
+            LOG(trace) << "IQ handoff ring grows to " << bytes << " bytes.";
+            _iqHandoff.Replace(MakeIQHandoff(bytes));
+            _iqHandoffSize = bytes;
+        }
+
+        void DrainIQBlocks()
+        {
+            _iqHandoff.Drain([this](IIQHandoff& handoff) { return DrainIQHandoff(handoff); });
+        }
+
+        // Returns true if some block was drained
+        bool DrainIQHandoff(IIQHandoff& handoff)
+        {
+            if (auto overrun = handoff.TakeOverrunSamples())
+            {
+                LOG(trace) << "IQ handoff overrun, dropped " << overrun << " samples.";
+                _iqQueue->AddDropped(_ddc ? overrun / _ddc->GetConfig().decimation : overrun);
+            }
+
+            bool capabilitiesChanged = false;
+            bool drained = false;
+            handoff.Drain([this, &capabilitiesChanged, &drained](const IIQHandoff::Block& b) {
+                drained = true;
+                if (_ddc && b.cnt > 0 && b.IQdata)
+                {
+                    _ddc->Process(b.cnt, b.IQdata, [this, &b](int cnt, void* IQdata) {
+                        QueueIQBlock(cnt, b.status, b.IQoffs, IQdata);
+                    });
+                }
+                else
+                    QueueIQBlock(b.cnt, b.status, b.IQoffs, b.IQdata);
+
+                if (b.cnt <= 0 && b.status == extHw_Changed_SampleRate && _ddc)
+                    _ddc->SetInputRate((double)_dll->GetHWSR());
+
+                if (b.cnt <= 0 && ChangesCapabilities(b.status))
+                    capabilitiesChanged = true;
+
+                // status changes reach the listeners over their own connections
+                if (b.cnt <= 0 && _multicast)
+                {
+                    for (auto& l : _listeners)
+                    {
+                        if (auto listener = l.lock())
+                        {
+                            asio::post(listener->_ctx->_strand, [l, cnt = b.cnt, status = b.status, IQoffs = b.IQoffs]() {
+                                if (auto listener = l.lock())
+                                    listener->QueueIQBlock(cnt, status, IQoffs, nullptr);
+                            });
+                        }
+                    }
+                }
+            });
+
+            // the clients drop the snapshots older than the status, a fresh one follows it
+            if (capabilitiesChanged)
+                PushCapabilities();
+
+            return drained;
+        }
+
+        static bool ChangesCapabilities(int status)
+        {
+            return status == extHw_Changed_RF_IF
+                || status == extHw_Changed_SRATES
+                || status == extHw_Changed_AGCS;
+        }
+
+        // Enumerates the device tables the host asks for one entry per round trip otherwise
+        ExtIO_TCP_Proto::Message CollectCapabilities()
+        {
+            auto msg = Protocol::Make_Capabilities_Msg(_hwCache.hwName, _hwCache.hwModel, _hwCache.dataType);
+            auto& caps = *msg.mutable_capabilities();
+
+            // calls get(idx) until it fails, a table longer than maxEntries is left open
+            auto collect = [](ExtIO_TCP_Proto::CapabilityTable& table, int maxEntries, auto&& get) {
+                for (int idx = 0; idx < maxEntries; ++idx)
+                {
+                    if (auto result = get(idx, table); result != 0)
+                    {
+                        table.set_end_result(result);
+                        return;
+                    }
+                }
+            };
+
+            if (_dll->GetAttenuators)
+            {
+                collect(*caps.mutable_attenuators(), EXTIO_MAX_ATT_GAIN_VALUES, [this](int idx, auto& table) {
+                    float attenuation = 0.;
+                    auto result = _dll->GetAttenuators(idx, &attenuation);
+                    if (result == 0) table.add_values(attenuation);
+                    return result;
+                });
+            }
+
+            if (_dll->ExtIoGetSrates)
+            {
+                collect(*caps.mutable_samplerates(), EXTIO_MAX_SRATE_VALUES, [this](int idx, auto& table) {
+                    double samplerate = 0.;
+                    auto result = _dll->ExtIoGetSrates(idx, &samplerate);
+                    if (result == 0) table.add_values(DDCRate(samplerate));
+                    return result;
+                });
+            }
+
+            if (_dll->ExtIoGetAGCs)
+            {
+                collect(*caps.mutable_agcs(), EXTIO_MAX_AGC_VALUES, [this](int idx, auto& table) {
+                    char text[EXTIO_MAX_AGC_VALUES]; text[0] = 0;
+                    auto result = _dll->ExtIoGetAGCs(idx, text);
+                    if (result == 0) table.add_texts(text);
+                    return result;
+                });
+            }
+
+            if (_dll->ExtIoGetMGCs)
+            {
+                collect(*caps.mutable_mgcs(), EXTIO_MAX_MGC_VALUES, [this](int idx, auto& table) {
+                    float gain = 0.;
+                    auto result = _dll->ExtIoGetMGCs(idx, &gain);
+                    if (result == 0) table.add_values(gain);
+                    return result;
+                });
+            }
+
+            // the host asks for the bandwidth of the enumerated samplerates only
+            if (_dll->ExtIoGetBandwidth && caps.has_samplerates())
+            {
+                auto& bandwidths = *caps.mutable_bandwidths();
+                for (int idx = 0; idx < caps.samplerates().values_size(); ++idx)
+                    bandwidths.add_values(DDCBandwidth(_dll->ExtIoGetBandwidth(idx), caps.samplerates().values(idx)));
+            }
+
+            LOG(trace) << "Capabilities collected, attenuators: " << caps.attenuators().values_size()
+                << "; samplerates: " << caps.samplerates().values_size()
+                << "; AGCs: " << caps.agcs().texts_size()
+                << "; MGCs: " << caps.mgcs().values_size();
+
+            return msg;
+        }
+
+        // Sends the snapshot to the client and to the listeners of the device
+        void PushCapabilities()
+        {
+            if (!_dll || !_bOpenHWSuccidded)
+                return;
+
+            _hwCache.capabilities = CollectCapabilities();
+            _hwCache.capabilities->mutable_capabilities()->set_generation(_capabilityStatuses);
+            _proto->AsyncSendResponce(*_hwCache.capabilities, 0, [](const boost::system::error_code& ec) {});
+
+            for (auto& l : _listeners)
+            {
+                if (auto listener = l.lock())
+                {
+                    asio::post(listener->_ctx->_strand, [l, msg = *_hwCache.capabilities]() {
+                        auto listener = l.lock();
+                        if (!listener || !listener->_proto)
+                            return;
+                        // stamped with the statuses the listener has queued itself
+                        listener->_hwCache.capabilities = msg;
+                        listener->_hwCache.capabilities->mutable_capabilities()->set_generation(listener->_capabilityStatuses);
+                        listener->_proto->AsyncSendResponce(*listener->_hwCache.capabilities, 0, [](const boost::system::error_code& ec) {});
+                    });
+                }
+            }
+        }
+
+        // Called within the session strand, it counts the statuses changing the capabilities
+        void QueueIQBlock(int cnt, int status, float IQoffs, void* IQdata)
+        {
+            if (cnt <= 0 && ChangesCapabilities(status))
+                ++_capabilityStatuses;
+
+            if (_rawIqData)
+            {
+                // the status blocks the listeners get carry no samples
+                const bool coded = _iqCodec.kind != IQCodec::Kind::None && cnt > 0 && IQdata;
+                const auto started = coded ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+                auto buf = Protocol::Make_ExtIOCallback_RawPacket(
+                    _connection->GetBufferPool(), cnt, status, IQoffs, IQdata, _hwCache.SampleSize(), _hwCache.dataType,
+                    _iqCodec, _hwCache.IntegerValueSize());
+                if (coded)
+                {
+                    _iqCodecStats.blocks++;
+                    _iqCodecStats.rawBytes += cnt * _hwCache.SampleSize();
+                    _iqCodecStats.codedBytes += buf->size() - sizeof(Protocol::RawIQHead);
+                    _iqCodecStats.cpuTime += std::chrono::steady_clock::now() - started;
+                }
+
+                boost::asio::dispatch(_ctx->_strand, [this, a = AliveFlag(), buf = std::move(buf), cnt]() mutable {
+                    if (!a.IsAlive() || !_bOpenHWSuccidded || !_proto) {
+                        return;
+                    }
+                    _iqQueue->Push(std::move(buf), cnt);
+                });
+
+                return;
+            }
+
             auto msg = Protocol::Make_ExtIOCallback_Msg(
                 cnt, status, IQoffs, IQdata, _hwCache.SampleSize());
+            const size_t bytes = msg->extiocallback().iqdata().size();
 
-            boost::asio::dispatch(_ctx->_strand, [this, a = AliveFlag(), msg = std::move(msg)]() mutable {
+            boost::asio::dispatch(_ctx->_strand, [this, a = AliveFlag(), msg = std::move(msg), cnt, bytes]() mutable {
                 if (!a.IsAlive() || !_bOpenHWSuccidded || !_proto) {
                     return;
                 }
-                _proto->AsyncSendMessage(std::move(msg), [](const boost::system::error_code& ec) {});
+                _iqQueue->Push(std::move(msg), cnt, bytes);
             });
+        }
 
-            return 0;
+        void StartMulticast()
+        {
+            try
+            {
+                const boost::asio::ip::udp::endpoint group(
+                    boost::asio::ip::make_address(Options::get().multicastGroup),
+                    Options::get().multicastPort);
+                _iqDatagrams = MakeIQDatagramSender(
+                    _ctx->_strand, group, Options::get().udpLossPercent, Options::get().multicastTtl);
+                _iqQueue->SetDatagramSender(_iqDatagrams.get());
+            }
+            catch (const std::exception& e)
+            {
+                LOG(warning) << "IQ multicast is disabled: " << e.what();
+            }
         }
 
         std::optional<ExtIO_TCP_Proto::Message> OnVersionInfo(const ExtIO_TCP_Proto::Message& request) {
@@ -648,7 +1396,7 @@ namespace
             int retVal = -1;
             if (_dll->ExtIoGetSrates)
                 retVal = _dll->ExtIoGetSrates(msg.srate_idx(), &samplerate);
-            return Protocol::Make_ExtIoGetSrates_Msg(retVal, {}, samplerate);
+            return Protocol::Make_ExtIoGetSrates_Msg(retVal, {}, DDCRate(samplerate));
         }
 
         std::optional<ExtIO_TCP_Proto::Message> OnExtIoGetActualSrateIdx(const ExtIO_TCP_Proto::Message& request) {
@@ -677,9 +1425,51 @@ namespace
             if (!msg.has_srate_idx())
                 return Protocol::Make_Error_Msg(ExtIO_TCP_Proto::ErrorCode::InvalidArgument);
             auto result = _dll->ExtIoGetBandwidth(msg.srate_idx());
+            double samplerate = 0.;
+            if (_ddc && _dll->ExtIoGetSrates && _dll->ExtIoGetSrates(msg.srate_idx(), &samplerate) == 0)
+                result = DDCBandwidth(result, DDCRate(samplerate));
             return Protocol::Make_ExtIoGetBandwidth_Msg(result, {});
         }
 
+        // The host sees a device of the decimated rate, it is told to ask for the rate again
+        std::optional<ExtIO_TCP_Proto::Message> OnSetDDC(const ExtIO_TCP_Proto::Message& request) {
+            if (!_dll) return Protocol::Make_Error_Msg(ExtIO_TCP_Proto::ErrorCode::ExtIO_DllIsNotLoaded);
+            auto const& msg = request.setddc();
+            // the multicast stream is shared by all the listeners
+            if (_multicast)
+                return Protocol::Make_SetDDC_Msg({}, {}, {}, ExtIO_TCP_Proto::ErrorCode::NotImplemented, {});
+
+            std::unique_ptr<IDDC> ddc;
+            if (msg.enabled())
+            {
+                ddc = MakeDDC(_hwCache.dataType, { msg.offset_hz(), msg.decimation() }, (double)_dll->GetHWSR(), _startHWResult);
+                if (!ddc)
+                    return Protocol::Make_SetDDC_Msg({}, {}, {}, ExtIO_TCP_Proto::ErrorCode::InvalidArgument, {});
+            }
+            _ddc = std::move(ddc);
+
+            const auto samplerate = (int64_t)DDCRate((double)_dll->GetHWSR());
+            LOG(trace) << "DDC " << (_ddc ? "enabled" : "disabled") << ", samplerate: " << samplerate;
+
+            PushCapabilities();
+            QueueIQBlock(-1, extHw_Changed_SampleRate, 0.f, nullptr);
+
+            return Protocol::Make_SetDDC_Msg({ _ddc != nullptr }, {}, {}, ExtIO_TCP_Proto::ErrorCode::Success, { samplerate });
+        }
+
+        double DDCRate(double deviceRate) const
+        {
+            return _ddc ? deviceRate / _ddc->GetConfig().decimation : deviceRate;
+        }
+
+        // The decimation filters pass 0.8 of the reduced rate
+        long DDCBandwidth(long deviceBandwidth, double samplerate) const
+        {
+            if (!_ddc || deviceBandwidth <= 0)
+                return deviceBandwidth;
+            return std::min(deviceBandwidth, (long)(0.8 * samplerate));
+        }
+
     private:
 
         bool CheckRcvError(const boost::system::error_code& ec)
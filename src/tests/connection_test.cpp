@@ -0,0 +1,541 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Loopback checks of the connection framing: a raw socket writes the packet
+// stream in pieces which the connection reads and parses, the packets must
+// come out whole whatever the reads split. Covers the receive buffer bounds,
+// the fragments of several streams interleaved, the corrupt fragments and the
+// fragmenting writer. Exits with a nonzero code on a failure.
+
+#include "stdafx.h"
+
+#include "../utils/Connection.h"
+#include "../utils/BufferPool.h"
+
+namespace
+{
+    using PacketType = PacketBuffer::PacketType;
+    using Bytes = std::vector<uint8_t>;
+
+    constexpr size_t c_headSize = PacketBuffer::head_size();
+    constexpr size_t c_maxPayload = IConnection::c_maxFrameSize;
+    constexpr auto c_timeout = std::chrono::seconds(10);
+
+    struct Received
+    {
+        PacketType type;
+        Bytes payload;
+    };
+
+    Bytes Payload(size_t size, uint32_t seed)
+    {
+        Bytes b(size);
+        std::mt19937 rng(seed);
+        for (auto& v : b)
+            v = uint8_t(rng());
+        return b;
+    }
+
+    Bytes MakePacket(PacketType type, const Bytes& payload, Checksum::Kind checksum = Checksum::Kind::Crc32c)
+    {
+        PacketBuffer::PacketHead head;
+        head.type = type;
+        head.checksum = checksum;
+        head.size = (uint32_t)payload.size();
+        head.crc = Checksum::Calc(checksum, payload.data(), payload.size());
+        Bytes b(c_headSize);
+        std::memcpy(b.data(), &head, c_headSize);
+        b.insert(b.end(), payload.begin(), payload.end());
+        return b;
+    }
+
+    PacketBuffer::FragmentHead FragmentOf(PacketType type, uint8_t stream, size_t totalSize)
+    {
+        PacketBuffer::FragmentHead fragment;
+        fragment.type = type;
+        fragment.stream = stream;
+        fragment.totalSize = (uint32_t)totalSize;
+        return fragment;
+    }
+
+    Bytes MakeFragment(PacketBuffer::FragmentHead fragment, const uint8_t* data, size_t size)
+    {
+        Bytes payload(sizeof(fragment));
+        std::memcpy(payload.data(), &fragment, sizeof(fragment));
+        payload.insert(payload.end(), data, data + size);
+        return MakePacket(PacketType::Fragment, payload);
+    }
+
+    // The Fragment packets of a packet, chunk bytes of its payload each
+    std::vector<Bytes> Fragments(PacketType type, uint8_t stream, const Bytes& payload, size_t chunk)
+    {
+        std::vector<Bytes> out;
+        for (size_t pos = 0; pos < payload.size(); pos += chunk)
+        {
+            auto fragment = FragmentOf(type, stream, payload.size());
+            const size_t n = std::min(chunk, payload.size() - pos);
+            fragment.last = pos + n == payload.size();
+            out.push_back(MakeFragment(fragment, payload.data() + pos, n));
+        }
+        return out;
+    }
+
+    void Append(Bytes& stream, const Bytes& packet)
+    {
+        stream.insert(stream.end(), packet.begin(), packet.end());
+    }
+
+    // A connection reading the packets a raw socket writes to it
+    class Loopback
+    {
+    public:
+
+        boost::asio::io_context ctx;
+        IConnection::strand_type strand = boost::asio::make_strand(ctx);
+        boost::asio::ip::tcp::socket raw{ ctx };
+        std::unique_ptr<IConnection> conn = MakeConnection(strand);
+        std::vector<Received> received;
+        size_t readLimit = SIZE_MAX;
+        boost::system::error_code readError;
+
+        Loopback()
+        {
+            boost::asio::ip::tcp::acceptor acceptor(ctx, { boost::asio::ip::address_v4::loopback(), 0 });
+            raw.connect(acceptor.local_endpoint());
+            raw.set_option(boost::asio::ip::tcp::no_delay(true));
+            auto socket = acceptor.accept();
+            OnStrand([&]() {
+                conn->Attach(std::move(socket));
+                Read();
+            });
+        }
+
+        ~Loopback()
+        {
+            OnStrand([&]() { conn->Close(); });
+        }
+
+        // The connection strand, the reads stop once readLimit packets are received
+        void Read()
+        {
+            conn->AsyncReadPackets([this](const boost::system::error_code& ec, const PacketView& view) {
+                if (ec.failed())
+                {
+                    readError = ec;
+                    return false;
+                }
+                const auto* data = (const uint8_t*)view.data;
+                received.push_back({ view.head.type, Bytes(data, data + view.size) });
+                return received.size() < readLimit;
+            });
+        }
+
+        template<typename F>
+        void OnStrand(F&& f)
+        {
+            bool done = false;
+            boost::asio::post(strand, [&]() { f(); done = true; });
+            RunUntil([&]() { return done; });
+        }
+
+        template<typename F>
+        bool RunUntil(F&& f)
+        {
+            const auto until = std::chrono::steady_clock::now() + c_timeout;
+            while (!f() && std::chrono::steady_clock::now() < until)
+            {
+                if (ctx.stopped())
+                    ctx.restart();
+                ctx.run_one_for(std::chrono::milliseconds(10));
+            }
+            return f();
+        }
+
+        // Writes the stream in pieces of up to maxPiece bytes, the connection reads
+        // whatever has arrived after each of them
+        void Send(const Bytes& stream, size_t maxPiece, uint32_t seed = 1)
+        {
+            std::mt19937 rng(seed);
+            for (size_t pos = 0; pos < stream.size();)
+            {
+                const size_t n = std::min<size_t>(1 + rng() % maxPiece, stream.size() - pos);
+                bool written = false;
+                boost::asio::async_write(raw, boost::asio::buffer(stream.data() + pos, n),
+                    [&](const boost::system::error_code&, size_t) { written = true; });
+                // the connection stops reading after a failure, the rest is not written then
+                RunUntil([&]() { return written || readError.failed(); });
+                if (!written)
+                {
+                    raw.cancel();
+                    RunUntil([&]() { return written; });
+                    return;
+                }
+                ctx.poll();
+                pos += n;
+            }
+        }
+
+        bool WaitFor(size_t packets)
+        {
+            return RunUntil([&]() { return received.size() >= packets || readError.failed(); });
+        }
+    };
+
+    bool CheckReceived(const char* name, const Loopback& lb, const std::vector<Received>& expected)
+    {
+        if (lb.readError.failed())
+        {
+            printf("%s: read failed: %s\n", name, lb.readError.message().c_str());
+            return false;
+        }
+        if (lb.received.size() != expected.size())
+        {
+            printf("%s: %zu packets received of %zu\n", name, lb.received.size(), expected.size());
+            return false;
+        }
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            if (lb.received[i].type != expected[i].type || lb.received[i].payload != expected[i].payload)
+            {
+                printf("%s: packet %zu differs, type: %d; size: %zu of %zu\n", name, i,
+                    (int)lb.received[i].type, lb.received[i].payload.size(), expected[i].payload.size());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Packets split across the reads at every offset, heads included
+    bool CheckSplitReads()
+    {
+        bool ok = true;
+        for (size_t maxPiece : { 1, 7, 100, 5000, 70000 })
+        {
+            Loopback lb;
+            std::vector<Received> expected;
+            Bytes stream;
+            std::mt19937 rng((uint32_t)maxPiece);
+            const int packets = maxPiece == 1 ? 50 : 200;
+            for (int i = 0; i < packets; ++i)
+            {
+                const auto type = i % 3 ? PacketType::RawData : PacketType::Message;
+                // a few of the packets are empty
+                const size_t size = i % 17 == 0 ? 0 : rng() % (maxPiece == 1 ? 300 : 40000);
+                expected.push_back({ type, Payload(size, i) });
+                Append(stream, MakePacket(type, expected.back().payload,
+                    i % 2 ? Checksum::Kind::Crc32 : Checksum::Kind::Crc32c));
+            }
+            lb.Send(stream, maxPiece);
+            lb.WaitFor(expected.size());
+            ok = CheckReceived(("split reads of " + std::to_string(maxPiece)).c_str(), lb, expected) && ok;
+        }
+        return ok;
+    }
+
+    // Packets of the max size, a pair of them exactly filling the 2 MB receive
+    // buffer, and one over the max size which fails the read
+    bool CheckBufferBounds()
+    {
+        bool ok = true;
+        for (size_t maxPiece : { c_maxPayload / 3, 4 * c_maxPayload })
+        {
+            Loopback lb;
+            std::vector<Received> expected;
+            Bytes stream;
+            const size_t sizes[] = { c_maxPayload, c_maxPayload - c_headSize, c_maxPayload - c_headSize,
+                c_maxPayload, 1, c_maxPayload, c_maxPayload - 1, 0, c_maxPayload };
+            for (size_t i = 0; i < std::size(sizes); ++i)
+            {
+                expected.push_back({ PacketType::RawData, Payload(sizes[i], uint32_t(i)) });
+                Append(stream, MakePacket(PacketType::RawData, expected.back().payload));
+            }
+            lb.Send(stream, maxPiece);
+            lb.WaitFor(expected.size());
+            ok = CheckReceived(("buffer bounds in pieces of " + std::to_string(maxPiece)).c_str(), lb, expected) && ok;
+        }
+
+        // the reads stop with the buffer drained, the pair written meanwhile
+        // is read into the buffer at once as far as the socket holds it
+        {
+            Loopback lb;
+            lb.readLimit = 1;
+            std::vector<Received> expected = { { PacketType::Message, Payload(100, 1) } };
+            lb.Send(MakePacket(PacketType::Message, expected[0].payload), 1000);
+            lb.WaitFor(1);
+
+            Bytes pair;
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                expected.push_back({ PacketType::RawData, Payload(c_maxPayload - c_headSize, 2 + i) });
+                Append(pair, MakePacket(PacketType::RawData, expected.back().payload));
+            }
+            bool written = false;
+            boost::asio::async_write(lb.raw, boost::asio::buffer(pair),
+                [&](const boost::system::error_code&, size_t) { written = true; });
+            const auto settle = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+            lb.RunUntil([&]() { return written || std::chrono::steady_clock::now() > settle; });
+
+            lb.readLimit = SIZE_MAX;
+            lb.OnStrand([&]() { lb.Read(); });
+            lb.WaitFor(expected.size());
+            lb.RunUntil([&]() { return written; });
+
+            expected.push_back({ PacketType::RawData, Payload(c_maxPayload, 4) });
+            lb.Send(MakePacket(PacketType::RawData, expected.back().payload), 4 * c_maxPayload);
+            lb.WaitFor(expected.size());
+            ok = CheckReceived("buffer filled at once", lb, expected) && ok;
+        }
+
+        {
+            Loopback lb;
+            Bytes stream = MakePacket(PacketType::RawData, Payload(100, 1));
+            Append(stream, MakePacket(PacketType::RawData, Payload(c_maxPayload + 1, 2)));
+            lb.Send(stream, stream.size());
+            lb.WaitFor(2);
+            if (lb.received.size() != 1 || lb.readError != std::errc::bad_message)
+            {
+                printf("oversized packet: %zu packets received, error: %s\n",
+                    lb.received.size(), lb.readError.message().c_str());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // Fragments of the four streams interleaved at random with whole packets,
+    // a packet comes out when its last fragment arrives
+    bool CheckInterleavedFragments()
+    {
+        Loopback lb;
+        std::mt19937 rng(5);
+        std::vector<Received> expected;
+        std::array<std::vector<Bytes>, IConnection::c_priorityClasses> pending;
+        std::array<Bytes, IConnection::c_priorityClasses> payloads;
+        std::array<size_t, IConnection::c_priorityClasses> next{};
+        Bytes stream;
+        int wholes = 0;
+        int packets = 0;
+
+        const auto refill = [&](uint8_t s) {
+            const size_t size = 1 + rng() % (3 * c_maxPayload);
+            payloads[s] = Payload(size, 100 + packets++);
+            pending[s] = Fragments(s % 2 ? PacketType::RawData : PacketType::Message, s, payloads[s], 1 + rng() % 100000);
+            next[s] = 0;
+        };
+        for (uint8_t s = 0; s < pending.size(); ++s)
+            refill(s);
+
+        while (packets < 40)
+        {
+            if (rng() % 8 == 0)
+            {
+                expected.push_back({ PacketType::RawData, Payload(rng() % 1000, 1000 + wholes++) });
+                Append(stream, MakePacket(PacketType::RawData, expected.back().payload));
+                continue;
+            }
+            const uint8_t s = uint8_t(rng() % pending.size());
+            Append(stream, pending[s][next[s]++]);
+            if (next[s] == pending[s].size())
+            {
+                expected.push_back({ s % 2 ? PacketType::RawData : PacketType::Message, payloads[s] });
+                refill(s);
+            }
+        }
+
+        lb.Send(stream, 300000);
+        lb.WaitFor(expected.size());
+        return CheckReceived("interleaved fragments", lb, expected);
+    }
+
+    // A corrupt fragment fails the read, the packets before it are delivered
+    bool CheckCorruptFragments()
+    {
+        const Bytes payload = Payload(50000, 7);
+        const auto good = Fragments(PacketType::RawData, 1, payload, 20000);
+
+        struct Case
+        {
+            const char* name;
+            std::function<Bytes()> make;
+        };
+        const Case cases[] = {
+            { "crc", [&]() {
+                Bytes b = good[1];
+                b.back() ^= 1;
+                return b; } },
+            { "total size changed", [&]() {
+                auto fragment = FragmentOf(PacketType::RawData, 1, payload.size() + 1);
+                return MakeFragment(fragment, payload.data() + 20000, 20000); } },
+            { "stream out of range", [&]() {
+                auto fragment = FragmentOf(PacketType::RawData, uint8_t(IConnection::c_priorityClasses), payload.size());
+                return MakeFragment(fragment, payload.data() + 20000, 20000); } },
+            { "over the total size", [&]() {
+                auto fragment = FragmentOf(PacketType::RawData, 1, payload.size());
+                return MakeFragment(fragment, payload.data(), 40000); } },
+            { "last before the total size", [&]() {
+                auto fragment = FragmentOf(PacketType::RawData, 1, payload.size());
+                fragment.last = 1;
+                return MakeFragment(fragment, payload.data() + 20000, 20000); } },
+            { "over the reassembly limit", [&]() {
+                auto fragment = FragmentOf(PacketType::RawData, 2, size_t(1) << 30);
+                return MakeFragment(fragment, payload.data(), 100); } },
+            { "nested fragment", [&]() {
+                auto fragment = FragmentOf(PacketType::Fragment, 1, payload.size());
+                return MakeFragment(fragment, payload.data() + 20000, 20000); } },
+            { "no fragment head", [&]() {
+                return MakePacket(PacketType::Fragment, Payload(sizeof(PacketBuffer::FragmentHead) - 1, 8)); } },
+        };
+
+        bool ok = true;
+        for (const auto& c : cases)
+        {
+            Loopback lb;
+            const Bytes before = Payload(100, 9);
+            Bytes stream = MakePacket(PacketType::Message, before);
+            Append(stream, good[0]);
+            Append(stream, c.make());
+            Append(stream, good[2]);
+            Append(stream, MakePacket(PacketType::Message, before));
+            lb.Send(stream, 10000);
+            lb.RunUntil([&]() { return lb.readError.failed(); });
+            if (!lb.readError.failed() || lb.received.size() != 1 || lb.received[0].payload != before)
+            {
+                printf("corrupt fragment, %s: %zu packets received, error: %s\n",
+                    c.name, lb.received.size(), lb.readError.message().c_str());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // The writer fragments the packets over the peer max frame size, the ones of
+    // the different priorities interleave on the wire and keep their order
+    // within a priority. A packet over the reassembly limit fails its write.
+    bool CheckFragmentingWriter()
+    {
+        Loopback lb;
+        boost::asio::ip::tcp::socket socket(lb.ctx);
+        boost::asio::ip::tcp::acceptor acceptor(lb.ctx, { boost::asio::ip::address_v4::loopback(), 0 });
+        auto writer = MakeConnection(lb.strand);
+        bool ok = true;
+
+        std::vector<Received> reads;
+        boost::system::error_code readError;
+        bool connected = false;
+        acceptor.async_accept(socket, [&](const boost::system::error_code&) {});
+        lb.OnStrand([&]() {
+            writer->Connect("127.0.0.1", acceptor.local_endpoint().port(), [&](const boost::system::error_code& ec) {
+                connected = !ec.failed();
+            });
+        });
+        lb.RunUntil([&]() { return connected && socket.is_open(); });
+        auto reader = MakeConnection(lb.strand);
+
+        constexpr int c_packets = 48;
+        std::array<std::vector<Bytes>, IConnection::c_priorityClasses> sent;
+        int written = 0;
+        boost::system::error_code oversizedError;
+        lb.OnStrand([&]() {
+            reader->Attach(std::move(socket));
+            reader->AsyncReadPackets([&](const boost::system::error_code& ec, const PacketView& view) {
+                if (ec.failed())
+                {
+                    readError = ec;
+                    return false;
+                }
+                const auto* data = (const uint8_t*)view.data;
+                reads.push_back({ view.head.type, Bytes(data, data + view.size) });
+                return true;
+            });
+
+            writer->SetChecksum(Checksum::Kind::Crc32c);
+            writer->SetMaxFrameSize(64 * 1024);
+            for (int i = 0; i < c_packets; ++i)
+            {
+                const size_t prio = i % IConnection::c_priorityClasses;
+                auto buf = writer->GetBufferPool().Acquire();
+                buf->set_packet_type(PacketType::RawData);
+                const auto payload = Payload(1 + (i * 7919) % (2 * c_maxPayload), 200 + i);
+                buf->resize(payload.size());
+                std::memcpy(buf->data(), payload.data(), payload.size());
+                // the payload leads with its priority, the reader sorts by it
+                ((uint8_t*)buf->data())[0] = uint8_t(prio);
+                sent[prio].push_back(Bytes((uint8_t*)buf->data(), (uint8_t*)buf->data() + buf->size()));
+                writer->AsyncWritePacket(buf, IConnection::Priority(prio), [&](const boost::system::error_code& ec) {
+                    if (ec.failed())
+                        ok = false;
+                    ++written;
+                });
+            }
+
+            auto huge = writer->GetBufferPool().Acquire();
+            huge->set_packet_type(PacketType::RawData);
+            huge->resize(64 * 1024 * 1024 + 1);
+            writer->AsyncWritePacket(huge, IConnection::Priority::Telemetry, [&](const boost::system::error_code& ec) {
+                oversizedError = ec;
+            });
+        });
+
+        lb.RunUntil([&]() { return (written == c_packets && reads.size() == c_packets) || readError.failed(); });
+
+        std::array<size_t, IConnection::c_priorityClasses> next{};
+        for (const auto& r : reads)
+        {
+            const size_t prio = r.payload.empty() ? 0 : r.payload[0];
+            if (prio >= next.size() || next[prio] >= sent[prio].size() || r.payload != sent[prio][next[prio]])
+            {
+                printf("fragmenting writer: packet of %zu bytes out of order or corrupt\n", r.payload.size());
+                ok = false;
+                break;
+            }
+            ++next[prio];
+        }
+        if (!ok || readError.failed() || reads.size() != c_packets || written != c_packets)
+        {
+            printf("fragmenting writer: %zu packets read, %d written of %d, error: %s\n",
+                reads.size(), written, c_packets, readError.message().c_str());
+            ok = false;
+        }
+        if (oversizedError != std::errc::message_size)
+        {
+            printf("fragmenting writer: oversized packet error: %s\n", oversizedError.message().c_str());
+            ok = false;
+        }
+
+        lb.OnStrand([&]() {
+            writer->Close();
+            reader->Close();
+        });
+        return ok;
+    }
+}
+
+int main()
+{
+    // the failures provoked here are logged as errors
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::fatal);
+
+    bool ok = CheckSplitReads();
+    ok = CheckBufferBounds() && ok;
+    ok = CheckInterleavedFragments() && ok;
+    ok = CheckCorruptFragments() && ok;
+    ok = CheckFragmentingWriter() && ok;
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
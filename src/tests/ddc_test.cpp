@@ -0,0 +1,259 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Checks of the server DDC: a passband tone comes out of every sample format
+// at its level, the tones folding into the output band are rejected, the
+// blocks are rebuilt to the block size whatever the input chunks are and the
+// invalid configs are refused. Exits with a nonzero code on a failure.
+
+#include "stdafx.h"
+
+#include "../tcp_server/ddc.h"
+
+namespace
+{
+    constexpr double c_inputRate = 2.048e6;
+    constexpr double c_offsetHz = 300e3;
+
+    using Samples = std::vector<std::complex<double>>;
+
+    struct Format
+    {
+        extHWtypeT dataType;
+        size_t valueSize;
+        double amplitude;       // of the test tone, below the full scale
+        double minSNR;          // dB, the output quantization limits it
+    };
+
+    const Format c_formats[] = {
+        { exthwUSBdataU8, 1, 100., 40. },
+        { exthwUSBdataS8, 1, 100., 40. },
+        { exthwUSBdata16, 2, 20000., 85. },
+        { exthwUSBdata24, 3, 4e6, 100. },
+        { exthwUSBdata32, 4, 1e9, 100. },
+        { exthwUSBfloat32, 4, 1000., 100. },
+    };
+
+    void StoreValue(const Format& format, double v, uint8_t* p)
+    {
+        if (format.dataType == exthwUSBfloat32)
+        {
+            const float f = float(v);
+            memcpy(p, &f, sizeof(f));
+            return;
+        }
+        const int64_t s = format.dataType == exthwUSBdataU8 ? std::llrint(v + 127.5) : std::llrint(v);
+        for (size_t b = 0; b < format.valueSize; ++b)
+            p[b] = uint8_t(s >> (8 * b));
+    }
+
+    double LoadValue(const Format& format, const uint8_t* p)
+    {
+        if (format.dataType == exthwUSBfloat32)
+        {
+            float f;
+            memcpy(&f, p, sizeof(f));
+            return f;
+        }
+        if (format.dataType == exthwUSBdataU8)
+            return *p - 127.5;
+        int64_t v = 0;
+        for (size_t b = 0; b < format.valueSize; ++b)
+            v |= int64_t(p[b]) << (8 * b);
+        const int shift = int(64 - 8 * format.valueSize);
+        return double((v << shift) >> shift);
+    }
+
+    struct BlockStats
+    {
+        size_t samples = 0;
+        int malformed = 0;      // blocks not of the block size
+    };
+
+    // Output of the DDC fed with a complex tone of the frequency relative to the
+    // device LO, in chunks of chunkSize samples or of random sizes when it is 0
+    Samples Run(const Format& format, const IDDC::Config& config, double toneHz, size_t cnt,
+        size_t chunkSize = 16384, int blockSize = 0, BlockStats* stats = nullptr)
+    {
+        auto ddc = MakeDDC(format.dataType, config, c_inputRate, blockSize);
+        Samples out;
+        std::vector<uint8_t> in;
+        std::mt19937 rng(3);
+        for (size_t pos = 0; pos < cnt;)
+        {
+            const size_t n = std::min<size_t>(chunkSize ? chunkSize : 1 + rng() % 5000, cnt - pos);
+            in.resize(n * 2 * format.valueSize);
+            for (size_t i = 0; i < n; ++i)
+            {
+                const auto v = std::polar(format.amplitude, 2 * std::numbers::pi * toneHz * double(pos + i) / c_inputRate);
+                StoreValue(format, v.real(), &in[2 * i * format.valueSize]);
+                StoreValue(format, v.imag(), &in[(2 * i + 1) * format.valueSize]);
+            }
+            ddc->Process(int(n), in.data(), [&](int cnt, void* IQdata) {
+                if (stats)
+                {
+                    stats->samples += cnt;
+                    stats->malformed += cnt != blockSize;
+                }
+                const auto* p = (const uint8_t*)IQdata;
+                for (int i = 0; i < cnt; ++i)
+                    out.emplace_back(
+                        LoadValue(format, p + 2 * i * format.valueSize),
+                        LoadValue(format, p + (2 * i + 1) * format.valueSize));
+            });
+            pos += n;
+        }
+        // the filters settle
+        out.erase(out.begin(), out.begin() + std::min<size_t>(200, out.size()));
+        return out;
+    }
+
+    // Complex amplitude of the tone at the frequency relative to the output rate
+    std::complex<double> ToneAmplitude(const Samples& y, double f)
+    {
+        std::complex<double> sum;
+        for (size_t n = 0; n < y.size(); ++n)
+            sum += y[n] * std::polar(1., -2 * std::numbers::pi * f * double(n));
+        return sum / double(y.size());
+    }
+
+    double ResidualPower(const Samples& y, double f, std::complex<double> a)
+    {
+        double sum = 0.;
+        for (size_t n = 0; n < y.size(); ++n)
+            sum += std::norm(y[n] - a * std::polar(1., 2 * std::numbers::pi * f * double(n)));
+        return sum / double(y.size());
+    }
+
+    double dB(double power)
+    {
+        return 10. * std::log10(power);
+    }
+
+    bool CheckConfigs()
+    {
+        bool ok = true;
+        for (uint32_t decimation : { 0u, 1u, 3u, 12u, 2 * IDDC::c_maxDecimation })
+            if (MakeDDC(exthwUSBdata16, { 0., decimation }, c_inputRate, 0))
+            {
+                printf("DDC of decimation %u is created\n", decimation);
+                ok = false;
+            }
+        if (MakeDDC(exthwUSBdata16, { NAN, 2 }, c_inputRate, 0) || MakeDDC(exthwNone, { 0., 2 }, c_inputRate, 0))
+        {
+            printf("DDC of an invalid offset or sample format is created\n");
+            ok = false;
+        }
+        return ok;
+    }
+
+    // A tone at 0.3 of the output rate keeps its level and is not buried in spurs
+    bool CheckFormats()
+    {
+        bool ok = true;
+        for (const auto& format : c_formats)
+            for (uint32_t decimation : { 2u, 16u, 256u })
+            {
+                const double outputRate = c_inputRate / decimation;
+                const auto y = Run(format, { c_offsetHz, decimation }, c_offsetHz + 0.3 * outputRate,
+                    std::max<size_t>(1 << 16, 1000 * decimation));
+                const auto a = ToneAmplitude(y, 0.3);
+                const double gain = dB(std::norm(a) / (format.amplitude * format.amplitude));
+                const double snr = dB(std::norm(a) / ResidualPower(y, 0.3, a));
+                if (std::abs(gain) > 0.05 || snr < format.minSNR)
+                {
+                    printf("Format %d, decimation %u: gain %.3f dB; SNR %.1f dB\n",
+                        int(format.dataType), decimation, gain, snr);
+                    ok = false;
+                }
+            }
+        return ok;
+    }
+
+    // Tones outside 0.6 of the output rate fold into 0.4 of it at -80 dB at most
+    bool CheckAliases()
+    {
+        const auto& format = c_formats[std::size(c_formats) - 1];
+        bool ok = true;
+        for (uint32_t decimation : { 2u, 16u, 256u })
+        {
+            const double outputRate = c_inputRate / decimation;
+            for (double rel : { -0.6, 0.65, -1.3, 1.7, 2.3, -3.1, 7.3, -19.7, 61.9 })
+            {
+                const double toneHz = rel * outputRate;
+                const double folded = rel - std::round(rel);
+                if (std::abs(c_offsetHz + toneHz) > 0.49 * c_inputRate || std::abs(folded) > 0.4)
+                    continue;
+                const auto y = Run(format, { c_offsetHz, decimation }, c_offsetHz + toneHz,
+                    std::max<size_t>(1 << 16, 1000 * decimation));
+                const double alias = dB(std::norm(ToneAmplitude(y, folded)) / (format.amplitude * format.amplitude));
+                if (alias > -80.)
+                {
+                    printf("Decimation %u: tone at %.2f of the output rate aliases at %.1f dB\n", decimation, rel, alias);
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    // Odd input chunks give the blocks of the block size and the output of the whole chunks
+    bool CheckBlocks()
+    {
+        constexpr uint32_t c_decimation = 8;
+        constexpr int c_blockSize = 1000;
+        constexpr size_t c_cnt = 1 << 20;
+        bool ok = true;
+        for (const auto& format : c_formats)
+        {
+            const IDDC::Config config{ -250e3, c_decimation };
+            const double toneHz = -250e3 + 20e3;
+            BlockStats stats;
+            const auto chunked = Run(format, config, toneHz, c_cnt, 0, c_blockSize, &stats);
+            const auto whole = Run(format, config, toneHz, c_cnt, c_cnt);
+
+            const size_t expected = c_cnt / c_decimation / c_blockSize * c_blockSize;
+            double maxDiff = 0.;
+            for (size_t i = 0; i < std::min(chunked.size(), whole.size()); ++i)
+                maxDiff = std::max(maxDiff, std::abs(chunked[i] - whole[i]));
+            // the NCO is anchored per chunk, the float rounding differs at the level of its
+            // precision and moves the integer output by a step of the rounding
+            const double tolerance = format.amplitude * 1e-6 + (format.dataType == exthwUSBfloat32 ? 0. : 1.5);
+            if (stats.malformed || stats.samples != expected || maxDiff > tolerance)
+            {
+                printf("Format %d: %zu of %zu samples, %d malformed blocks; difference %g\n",
+                    int(format.dataType), stats.samples, expected, stats.malformed, maxDiff);
+                ok = false;
+            }
+        }
+        return ok;
+    }
+}
+
+int main()
+{
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    bool ok = CheckConfigs();
+    ok = CheckFormats() && ok;
+    ok = CheckAliases() && ok;
+    ok = CheckBlocks() && ok;
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
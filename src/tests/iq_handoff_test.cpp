@@ -0,0 +1,216 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Checks of the IQ handoff: a producer thread streams numbered blocks while the
+// consumer thread drains them and replaces the ring by larger ones. Every block
+// comes out once with its data unless Push refused it, and in the push order
+// within a ring. Meant to be run under ASan and TSan as well.
+// Exits with a nonzero code on a failure.
+
+#include "stdafx.h"
+
+#include "../tcp_server/iq_handoff.h"
+
+namespace
+{
+    constexpr uint32_t c_blocks = 100000;
+    constexpr int c_maxCnt = 4096;
+    constexpr size_t c_sampleSize = 4;
+    constexpr int c_swaps = 8;
+
+    // status blocks are interleaved with the data ones
+    bool IsStatus(uint32_t seq) { return seq % 17 == 0; }
+
+    int BlockCnt(uint32_t seq) { return IsStatus(seq) ? 0 : 1 + int(seq * 7919u % c_maxCnt); }
+
+    struct Consumer
+    {
+        std::mutex mx;
+        std::condition_variable cv;
+        bool woken = false;
+        bool stop = false;
+
+        void Wake()
+        {
+            std::lock_guard lock(mx);
+            woken = true;
+            cv.notify_one();
+        }
+    };
+
+    // The blocks left in a replaced ring come out first, the ring is released
+    // once the producer pushed to the new one
+    bool CheckSwapOrder()
+    {
+        const auto makeRing = []() { return MakeIQHandoff(IQHandoffCapacity(c_maxCnt * c_sampleSize, 4), []() {}); };
+        std::vector<int> order;
+        const auto drain = [&order](IIQHandoff& handoff) {
+            bool drained = false;
+            handoff.Drain([&](const IIQHandoff::Block& b) { drained = true; order.push_back(b.status); });
+            return drained;
+        };
+
+        IQHandoffSwap swap;
+        swap.Replace(makeRing());
+        swap.In().Push(0, 1, 0, nullptr, 0);
+        swap.In().Push(0, 2, 0, nullptr, 0);
+        swap.Replace(makeRing());
+        const bool replacingBefore = swap.Replacing();
+        swap.Drain(drain);
+        const bool replacingIdle = swap.Replacing();
+        swap.In().Push(0, 3, 0, nullptr, 0);
+        swap.Drain(drain);
+
+        const bool ok = replacingBefore && replacingIdle && !swap.Replacing() && order == std::vector<int>{ 1, 2, 3 };
+        if (!ok)
+            printf("swap order: %zu blocks drained, replacing %d %d %d\n",
+                order.size(), replacingBefore, replacingIdle, swap.Replacing());
+        return ok;
+    }
+
+    bool CheckSwapUnderLoad()
+    {
+        Consumer consumer;
+        const auto makeRing = [&consumer](size_t blocks) {
+            return MakeIQHandoff(IQHandoffCapacity(c_maxCnt * c_sampleSize, blocks), [&consumer]() { consumer.Wake(); });
+        };
+
+        IQHandoffSwap swap;
+        swap.Replace(makeRing(2));
+
+        std::vector<uint8_t> received(c_blocks);
+        std::vector<uint8_t> refused(c_blocks);
+        std::map<const IIQHandoff*, int64_t> lastSeq;
+        int malformed = 0;
+        int disordered = 0;
+        int swaps = 0;
+        uint32_t count = 0;
+        uint32_t maxSeq = 0;
+
+        const auto drain = [&](IIQHandoff& handoff) {
+            bool drained = false;
+            handoff.Drain([&](const IIQHandoff::Block& b) {
+                drained = true;
+                const uint32_t seq = uint32_t(b.status);
+                if (seq >= c_blocks || b.cnt != BlockCnt(seq) || b.bytes != size_t(b.cnt) * c_sampleSize ||
+                    (b.cnt > 0 && (!b.IQdata ||
+                        std::memcmp(b.IQdata, &seq, sizeof(seq)) ||
+                        std::memcmp((const uint8_t*)b.IQdata + b.bytes - sizeof(seq), &seq, sizeof(seq)))))
+                {
+                    ++malformed;
+                    return;
+                }
+                ++received[seq];
+                ++count;
+                maxSeq = std::max(maxSeq, seq);
+                auto [it, _] = lastSeq.try_emplace(&handoff, -1);
+                if (int64_t(seq) <= it->second)
+                    ++disordered;
+                it->second = seq;
+            });
+            return drained;
+        };
+
+        std::thread consumerThread([&]() {
+            for (;;)
+            {
+                bool stop;
+                {
+                    std::unique_lock lock(consumer.mx);
+                    consumer.cv.wait(lock, [&]() { return consumer.woken || consumer.stop; });
+                    consumer.woken = false;
+                    stop = consumer.stop;
+                }
+                swap.Drain(drain);
+
+                // a larger ring every few thousands of blocks, while the producer pushes
+                if (swaps < c_swaps && maxSeq > uint32_t(swaps + 1) * c_blocks / (c_swaps + 2) && !swap.Replacing())
+                {
+                    ++swaps;
+                    // the new ring may reuse the memory of a released one
+                    auto ring = makeRing(2 + swaps);
+                    lastSeq.erase(ring.get());
+                    swap.Replace(std::move(ring));
+                }
+
+                if (stop)
+                    break;
+            }
+        });
+
+        std::thread producer([&]() {
+            std::vector<uint8_t> data(c_maxCnt * c_sampleSize);
+            for (uint32_t seq = 0; seq < c_blocks; ++seq)
+            {
+                const int cnt = BlockCnt(seq);
+                const size_t bytes = size_t(cnt) * c_sampleSize;
+                if (bytes)
+                {
+                    std::memcpy(data.data(), &seq, sizeof(seq));
+                    std::memcpy(data.data() + bytes - sizeof(seq), &seq, sizeof(seq));
+                }
+                if (!swap.In().Push(cnt, int(seq), 0, bytes ? data.data() : nullptr, bytes))
+                    refused[seq] = 1;
+                // the consumer mostly keeps up, some blocks still overrun the small rings
+                if (seq % 16 == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+
+        producer.join();
+        {
+            std::lock_guard lock(consumer.mx);
+            consumer.stop = true;
+            consumer.cv.notify_one();
+        }
+        consumerThread.join();
+        // the blocks pushed to a replaced ring after the last wake
+        swap.Drain(drain);
+        swap.Drain(drain);
+
+        int lost = 0;
+        int duplicated = 0;
+        uint32_t refusedCount = 0;
+        for (uint32_t seq = 0; seq < c_blocks; ++seq)
+        {
+            refusedCount += refused[seq];
+            if (received[seq] + refused[seq] == 0)
+                ++lost;
+            else if (received[seq] + refused[seq] > 1)
+                ++duplicated;
+        }
+
+        const bool ok = !lost && !duplicated && !malformed && !disordered && swaps == c_swaps;
+        if (!ok)
+            printf("swap under load: lost %d; duplicated %d; malformed %d; disordered %d; swaps %d\n",
+                lost, duplicated, malformed, disordered, swaps);
+        printf("swap under load: %u blocks received, %u refused, %d swaps\n", count, refusedCount, swaps);
+        return ok;
+    }
+}
+
+int main()
+{
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    bool ok = CheckSwapOrder();
+    ok = CheckSwapUnderLoad() && ok;
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+// Round trips of the IQ codecs over the integer sample formats and the signal
+// shapes they meet, and the decoding of malformed coded blocks.
+// Exits with a nonzero code on the first mismatch.
+
+#include "stdafx.h"
+
+#include "../utils/IQCodec.h"
+
+namespace
+{
+    enum class Signal
+    {
+        Noise,          // full scale random values
+        Aligned12Bit,   // a 12 bit ADC left aligned in the value
+        Tone,           // a sine with a few bits of noise
+        Zero,
+        Extremes,       // the minimum and the maximum values alternating
+    };
+
+    // cnt samples of I and Q little endian signed values of valueSize bytes
+    std::vector<uint8_t> MakeSamples(Signal signal, size_t cnt, size_t valueSize, std::mt19937& rng)
+    {
+        std::vector<uint8_t> samples(cnt * 2 * valueSize);
+        const int bits = int(8 * valueSize);
+        for (size_t i = 0; i < cnt * 2; ++i)
+        {
+            int64_t v = 0;
+            switch (signal)
+            {
+            case Signal::Noise:
+                v = int64_t(rng());
+                break;
+            case Signal::Aligned12Bit:
+                v = int64_t(int(rng() % 4096) - 2048) << (bits > 12 ? bits - 12 : 0);
+                break;
+            case Signal::Tone:
+                v = int64_t(std::ldexp(std::sin(i * 0.01), bits - 4)) + int(rng() % 16) - 8;
+                break;
+            case Signal::Zero:
+                break;
+            case Signal::Extremes:
+                v = (i & 1) ? -(int64_t(1) << (bits - 1)) : (int64_t(1) << (bits - 1)) - 1;
+                break;
+            }
+            for (size_t b = 0; b < valueSize; ++b)
+                samples[i * valueSize + b] = uint8_t(v >> (8 * b));
+        }
+        return samples;
+    }
+
+    bool RoundTrip(const IQCodec::Config& config, const std::vector<uint8_t>& samples, size_t cnt, size_t valueSize)
+    {
+        std::vector<uint8_t> coded(IQCodec::MaxCodedSize(samples.size()));
+        const size_t codedSize = IQCodec::Encode(config, samples.data(), cnt, 2 * valueSize, valueSize, coded.data());
+        std::vector<uint8_t> decoded;
+        return codedSize <= coded.size() &&
+            IQCodec::Decode(config.kind, coded.data(), codedSize, cnt, decoded) &&
+            decoded == samples;
+    }
+
+    bool CheckRice(std::mt19937& rng)
+    {
+        bool ok = true;
+        for (size_t valueSize = 1; valueSize <= 4; ++valueSize)
+            for (auto signal : { Signal::Noise, Signal::Aligned12Bit, Signal::Tone, Signal::Zero, Signal::Extremes })
+                for (size_t cnt : { 1, 7, 33, 1000, 65536 })
+                {
+                    const auto samples = MakeSamples(signal, cnt, valueSize, rng);
+                    if (!RoundTrip({ IQCodec::Kind::Rice }, samples, cnt, valueSize))
+                    {
+                        printf("Rice round trip failed, value size: %zu; signal: %d; cnt: %zu\n",
+                            valueSize, int(signal), cnt);
+                        ok = false;
+                    }
+                }
+        return ok;
+    }
+
+    int64_t LoadValue(const uint8_t* p, size_t valueSize)
+    {
+        int64_t v = 0;
+        for (size_t b = 0; b < valueSize; ++b)
+            v |= int64_t(p[b]) << (8 * b);
+        const int shift = int(64 - 8 * valueSize);
+        return (v << shift) >> shift;
+    }
+
+    // Values having packBits significant bits come back as they are, the error
+    // of wider ones is bounded by the precision left at the exponent of their group
+    bool CheckPacked(std::mt19937& rng)
+    {
+        bool ok = true;
+        for (size_t valueSize = 1; valueSize <= 4; ++valueSize)
+            for (int bits = IQCodec::c_minPackBits; bits <= IQCodec::c_maxPackBits; ++bits)
+                for (size_t cnt : { 1, 7, 63, 64, 65, 1000 })
+                {
+                    const int fitBits = std::min(bits, int(8 * valueSize));
+                    std::vector<uint8_t> fit(cnt * 2 * valueSize);
+                    for (size_t i = 0; i < cnt * 2; ++i)
+                    {
+                        const int64_t v = int64_t(rng() % (uint64_t(1) << fitBits)) - (int64_t(1) << (fitBits - 1));
+                        for (size_t b = 0; b < valueSize; ++b)
+                            fit[i * valueSize + b] = uint8_t(v >> (8 * b));
+                    }
+                    if (!RoundTrip({ IQCodec::Kind::Packed, bits }, fit, cnt, valueSize))
+                    {
+                        printf("Packed round trip failed, value size: %zu; bits: %d; cnt: %zu\n", valueSize, bits, cnt);
+                        ok = false;
+                    }
+
+                    for (auto signal : { Signal::Noise, Signal::Extremes })
+                    {
+                        const auto samples = MakeSamples(signal, cnt, valueSize, rng);
+                        std::vector<uint8_t> coded(IQCodec::MaxCodedSize(samples.size()));
+                        const size_t codedSize = IQCodec::Encode(
+                            { IQCodec::Kind::Packed, bits }, samples.data(), cnt, 2 * valueSize, valueSize, coded.data());
+                        std::vector<uint8_t> decoded;
+                        if (!IQCodec::Decode(IQCodec::Kind::Packed, coded.data(), codedSize, cnt, decoded) ||
+                            decoded.size() != samples.size())
+                        {
+                            printf("Packed decoding failed, value size: %zu; bits: %d; cnt: %zu\n", valueSize, bits, cnt);
+                            ok = false;
+                            continue;
+                        }
+
+                        for (size_t group = 0; group < cnt; group += 64)
+                        {
+                            int64_t peak = 0, error = 0;
+                            for (size_t i = 2 * group; i < std::min(2 * cnt, 2 * group + 128); ++i)
+                            {
+                                const int64_t in = LoadValue(&samples[i * valueSize], valueSize);
+                                const int64_t out = LoadValue(&decoded[i * valueSize], valueSize);
+                                peak = std::max(peak, std::abs(in));
+                                error = std::max(error, std::abs(in - out));
+                            }
+                            if (error > std::max<int64_t>(1, peak >> (bits - 2)))
+                            {
+                                printf("Packed error %lld of peak %lld, value size: %zu; bits: %d\n",
+                                    (long long)error, (long long)peak, valueSize, bits);
+                                ok = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+        return ok;
+    }
+
+    bool CheckMalformed(std::mt19937& rng)
+    {
+        bool ok = true;
+        std::vector<uint8_t> decoded;
+
+        // the value size of the head is checked before the output is sized
+        for (uint8_t valueSize : { 0, 5, 255 })
+        {
+            std::vector<uint8_t> coded(64, 0);
+            coded[0] = 1;
+            coded[1] = valueSize;
+            if (IQCodec::Decode(IQCodec::Kind::Rice, coded.data(), coded.size(), 16, decoded))
+            {
+                printf("Rice block of value size %d is accepted\n", int(valueSize));
+                ok = false;
+            }
+        }
+
+        // random blocks are rejected or decoded, they must not read or write out of bounds
+        for (int i = 0; i < 20000; ++i)
+        {
+            std::vector<uint8_t> coded(rng() % 300);
+            for (auto& b : coded)
+                b = uint8_t(rng());
+            if (coded.size() > 0)
+                coded[0] = 1;
+            if (coded.size() > 1)
+                coded[1] = uint8_t(1 + rng() % 4);
+            IQCodec::Decode(IQCodec::Kind::Rice, coded.data(), coded.size(), rng() % 2000, decoded);
+        }
+        for (int i = 0; i < 20000; ++i)
+        {
+            std::vector<uint8_t> coded(rng() % 300);
+            for (auto& b : coded)
+                b = uint8_t(rng());
+            if (coded.size() > 0)
+                coded[0] = 2;
+            if (coded.size() > 1)
+                coded[1] = uint8_t(1 + rng() % 4);
+            if (coded.size() > 2)
+                coded[2] = uint8_t(IQCodec::c_minPackBits + rng() % (IQCodec::c_maxPackBits - IQCodec::c_minPackBits + 1));
+            IQCodec::Decode(IQCodec::Kind::Packed, coded.data(), coded.size(), rng() % 200, decoded);
+        }
+        return ok;
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    bool ok = CheckRice(rng);
+    ok = CheckPacked(rng) && ok;
+    ok = CheckMalformed(rng) && ok;
+    printf("%s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "BufferPool.h"
+
+#include <mutex>
+
+namespace
+{
+    // Payload capacity of the size classes: 256B, 1K, 4K, ..., 1M
+    constexpr size_t c_minClassSize = 256;
+    constexpr size_t c_classesNumber = 7;
+    // Free buffers kept per class, the excess is released to the heap
+    constexpr size_t c_maxFreePerClass = 64;
+    constexpr size_t c_maxFreeCtrlBlocks = c_classesNumber * c_maxFreePerClass;
+
+    constexpr size_t ClassSize(size_t cls)
+    {
+        return c_minClassSize << (2 * cls);
+    }
+
+    class BufferPool : public IBufferPool, public std::enable_shared_from_this<BufferPool>
+    {
+        // Allocates the shared_ptr control blocks from the pool,
+        // it also keeps the pool alive while any buffer is out.
+        template<typename T>
+        struct CtrlBlockAllocator
+        {
+            using value_type = T;
+
+            std::shared_ptr<BufferPool> pool;
+
+            CtrlBlockAllocator(std::shared_ptr<BufferPool> p) : pool(std::move(p)) {}
+
+            template<typename U>
+            CtrlBlockAllocator(const CtrlBlockAllocator<U>& other) : pool(other.pool) {}
+
+            T* allocate(size_t n) { return static_cast<T*>(pool->AllocateCtrlBlock(n * sizeof(T))); }
+            void deallocate(T* p, size_t n) { pool->FreeCtrlBlock(p, n * sizeof(T)); }
+
+            template<typename U>
+            bool operator == (const CtrlBlockAllocator<U>& other) const { return pool == other.pool; }
+        };
+
+        struct Recycler
+        {
+            BufferPool* pool;
+            void operator()(PacketBuffer* p) const { pool->Recycle(p); }
+        };
+
+        mutable std::mutex _mx;
+        std::array<std::vector<PacketBuffer*>, c_classesNumber> _free;
+        std::vector<void*> _freeCtrlBlocks;
+        size_t _ctrlBlockSize = 0;
+
+        std::atomic_uint64_t _hits = 0;
+        std::atomic_uint64_t _misses = 0;
+        std::atomic_uint64_t _outstanding = 0;
+
+    public:
+
+        BufferPool()
+        {
+            for (auto& f : _free)
+                f.reserve(c_maxFreePerClass);
+            _freeCtrlBlocks.reserve(c_maxFreeCtrlBlocks);
+        }
+
+        ~BufferPool()
+        {
+            for (auto& f : _free)
+                for (auto* p : f)
+                    delete p;
+            for (auto* p : _freeCtrlBlocks)
+                ::operator delete(p);
+        }
+
+        // IBufferPool
+    private:
+
+        IConnection::buffer_ptr Acquire(size_t payloadSizeHint) override
+        {
+            PacketBuffer* p = nullptr;
+
+            {
+                std::scoped_lock _(_mx);
+                // the smallest non empty class able to hold the hint
+                for (auto cls = ClassOf(payloadSizeHint); cls < c_classesNumber && !p; ++cls)
+                {
+                    if (_free[cls].empty())
+                        continue;
+                    p = _free[cls].back();
+                    _free[cls].pop_back();
+                }
+            }
+
+            if (p)
+            {
+                ++_hits;
+                p->reset();
+                p->reserve(payloadSizeHint);
+            }
+            else
+            {
+                ++_misses;
+                p = new PacketBuffer();
+                p->reserve(std::max(payloadSizeHint, ClassSize(ClassOf(payloadSizeHint))));
+            }
+
+            ++_outstanding;
+
+            return IConnection::buffer_ptr(p, Recycler{ this }, CtrlBlockAllocator<PacketBuffer>(shared_from_this()));
+        }
+
+        Stats GetStats() const override
+        {
+            return { _hits, _misses, _outstanding };
+        }
+
+    private:
+
+        static size_t ClassOf(size_t payloadSize)
+        {
+            size_t cls = 0;
+            while (cls + 1 < c_classesNumber && ClassSize(cls) < payloadSize)
+                ++cls;
+            return cls;
+        }
+
+        void Recycle(PacketBuffer* p)
+        {
+            --_outstanding;
+
+            const auto capacity = p->capacity();
+
+            // the largest class the buffer can serve without reallocation
+            size_t cls = c_classesNumber;
+            while (cls > 0 && ClassSize(cls - 1) > capacity)
+                --cls;
+
+            if (cls > 0)
+            {
+                std::scoped_lock _(_mx);
+                auto& f = _free[cls - 1];
+                if (f.size() < c_maxFreePerClass)
+                {
+                    f.push_back(p);
+                    return;
+                }
+            }
+
+            delete p;
+        }
+
+        void* AllocateCtrlBlock(size_t size)
+        {
+            {
+                std::scoped_lock _(_mx);
+                if (!_ctrlBlockSize)
+                    _ctrlBlockSize = size;
+                if (size == _ctrlBlockSize && !_freeCtrlBlocks.empty())
+                {
+                    auto* p = _freeCtrlBlocks.back();
+                    _freeCtrlBlocks.pop_back();
+                    return p;
+                }
+            }
+            return ::operator new(size);
+        }
+
+        void FreeCtrlBlock(void* p, size_t size)
+        {
+            {
+                std::scoped_lock _(_mx);
+                if (size == _ctrlBlockSize && _freeCtrlBlocks.size() < c_maxFreeCtrlBlocks)
+                {
+                    _freeCtrlBlocks.push_back(p);
+                    return;
+                }
+            }
+            ::operator delete(p);
+        }
+    };
+}
+
+std::shared_ptr<IBufferPool> MakeBufferPool()
+{
+    return std::make_shared<BufferPool>();
+}
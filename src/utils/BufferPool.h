@@ -0,0 +1,46 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include "Connection.h"
+
+// Size-classed free lists of PacketBuffers. A buffer returns to the pool
+// when its last buffer_ptr is dropped and keeps its capacity, the shared_ptr
+// control blocks are recycled as well, so a steady packet flow does not
+// touch the heap. Acquire() and the buffers release are thread safe.
+class IBufferPool
+{
+public:
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t outstanding = 0;
+    };
+
+    virtual ~IBufferPool() = default;
+
+    // Returns an empty Message packet able to hold payloadSizeHint bytes without reallocation.
+    virtual IConnection::buffer_ptr Acquire(size_t payloadSizeHint = 0) = 0;
+    virtual Stats GetStats() const = 0;
+};
+
+std::shared_ptr<IBufferPool> MakeBufferPool();
@@ -0,0 +1,357 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "Checksum.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CHECKSUM_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+#define CHECKSUM_ARM
+#include <arm_acle.h>
+#endif
+
+namespace
+{
+    using namespace Checksum;
+
+    // ========================================================================
+    // CRC32C (Castagnoli)
+
+    constexpr uint32_t c_crc32cPoly = 0x82F63B78;
+
+    using SlicingTable = std::array<std::array<uint32_t, 256>, 8>;
+
+    constexpr SlicingTable MakeSlicingTable()
+    {
+        SlicingTable t{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (c >> 1) ^ c_crc32cPoly : c >> 1;
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (size_t s = 1; s < 8; ++s)
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        return t;
+    }
+
+    constexpr SlicingTable c_slicingTable = MakeSlicingTable();
+
+    uint32_t Crc32cSoft(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = c_slicingTable;
+
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc =
+                t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        }
+
+        for (; size; --size, ++p)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+
+        return crc;
+    }
+
+#if defined(CHECKSUM_X86)
+
+    bool DetectSse42()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (ecx & bit_SSE4_2) != 0;
+#endif
+    }
+
+#if !defined(_MSC_VER)
+    __attribute__((target("sse4.2")))
+#endif
+    uint32_t Crc32cHard(uint32_t crc, const uint8_t* p, size_t size)
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        uint64_t c = crc;
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            c = _mm_crc32_u64(c, v);
+        }
+        crc = (uint32_t)c;
+#endif
+        for (; size >= 4; size -= 4, p += 4)
+        {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            crc = _mm_crc32_u32(crc, v);
+        }
+        for (; size; --size, ++p)
+            crc = _mm_crc32_u8(crc, *p);
+        return crc;
+    }
+
+    const bool g_hasHardwareCrc32c = DetectSse42();
+
+#elif defined(CHECKSUM_ARM)
+
+    uint32_t Crc32cHard(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            crc = __crc32cd(crc, v);
+        }
+        for (; size; --size, ++p)
+            crc = __crc32cb(crc, *p);
+        return crc;
+    }
+
+    const bool g_hasHardwareCrc32c = true;
+
+#else
+
+    uint32_t Crc32cHard(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        return Crc32cSoft(crc, p, size);
+    }
+
+    const bool g_hasHardwareCrc32c = false;
+
+#endif
+
+    // ========================================================================
+    // XXH64
+
+    constexpr uint64_t P1 = 11400714785074694791ULL;
+    constexpr uint64_t P2 = 14029467366897019727ULL;
+    constexpr uint64_t P3 = 1609587929392839161ULL;
+    constexpr uint64_t P4 = 9650029242287828579ULL;
+    constexpr uint64_t P5 = 2870177450012600261ULL;
+
+    inline uint64_t Rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t Read64(const uint8_t* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    inline uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint64_t Round(uint64_t acc, uint64_t input)
+    {
+        acc += input * P2;
+        acc = Rotl(acc, 31);
+        return acc * P1;
+    }
+
+    inline uint64_t MergeRound(uint64_t acc, uint64_t val)
+    {
+        acc ^= Round(0, val);
+        return acc * P1 + P4;
+    }
+
+    inline void Stripe(uint64_t* v, const uint8_t* p)
+    {
+        v[0] = Round(v[0], Read64(p));
+        v[1] = Round(v[1], Read64(p + 8));
+        v[2] = Round(v[2], Read64(p + 16));
+        v[3] = Round(v[3], Read64(p + 24));
+    }
+}
+
+namespace Checksum
+{
+    bool IsValid(uint8_t kind)
+    {
+        return kind <= (uint8_t)Kind::None;
+    }
+
+    const char* Name(Kind kind)
+    {
+        switch (kind)
+        {
+        case Kind::Crc32: return "crc32";
+        case Kind::Crc32c: return "crc32c";
+        case Kind::XxHash64: return "xxhash64";
+        case Kind::None: return "none";
+        }
+        return "<unknown>";
+    }
+
+    bool HasHardwareCrc32c()
+    {
+        return g_hasHardwareCrc32c;
+    }
+
+    Calculator::Calculator(Kind kind)
+        : _kind(kind)
+    {
+        switch (_kind)
+        {
+        case Kind::Crc32:
+            break;
+        case Kind::Crc32c:
+            _crc = 0xFFFFFFFF;
+            break;
+        case Kind::XxHash64:
+            _v[0] = P1 + P2;
+            _v[1] = P2;
+            _v[2] = 0;
+            _v[3] = 0 - P1;
+            break;
+        case Kind::None:
+            break;
+        }
+    }
+
+    void Calculator::process_bytes(const void* data, size_t size)
+    {
+        auto* p = static_cast<const uint8_t*>(data);
+
+        switch (_kind)
+        {
+        case Kind::Crc32:
+            _crc32.process_bytes(p, size);
+            break;
+        case Kind::Crc32c:
+            _crc = g_hasHardwareCrc32c ? Crc32cHard(_crc, p, size) : Crc32cSoft(_crc, p, size);
+            break;
+        case Kind::XxHash64:
+        {
+            _totalLen += size;
+
+            if (_memSize + size < 32)
+            {
+                std::memcpy(_mem + _memSize, p, size);
+                _memSize += (uint32_t)size;
+                return;
+            }
+
+            if (_memSize)
+            {
+                const size_t fill = 32 - _memSize;
+                std::memcpy(_mem + _memSize, p, fill);
+                Stripe(_v, _mem);
+                p += fill;
+                size -= fill;
+                _memSize = 0;
+            }
+
+            for (; size >= 32; size -= 32, p += 32)
+                Stripe(_v, p);
+
+            std::memcpy(_mem, p, size);
+            _memSize = (uint32_t)size;
+            break;
+        }
+        case Kind::None:
+            break;
+        }
+    }
+
+    uint32_t Calculator::checksum() const
+    {
+        switch (_kind)
+        {
+        case Kind::Crc32:
+            return _crc32.checksum();
+        case Kind::Crc32c:
+            return ~_crc;
+        case Kind::XxHash64:
+        {
+            uint64_t h;
+            if (_totalLen >= 32)
+            {
+                h = Rotl(_v[0], 1) + Rotl(_v[1], 7) + Rotl(_v[2], 12) + Rotl(_v[3], 18);
+                h = MergeRound(h, _v[0]);
+                h = MergeRound(h, _v[1]);
+                h = MergeRound(h, _v[2]);
+                h = MergeRound(h, _v[3]);
+            }
+            else
+                h = _v[2] + P5;
+
+            h += _totalLen;
+
+            const uint8_t* p = _mem;
+            size_t size = _memSize;
+            for (; size >= 8; size -= 8, p += 8)
+            {
+                h ^= Round(0, Read64(p));
+                h = Rotl(h, 27) * P1 + P4;
+            }
+            if (size >= 4)
+            {
+                h ^= (uint64_t)Read32(p) * P1;
+                h = Rotl(h, 23) * P2 + P3;
+                p += 4;
+                size -= 4;
+            }
+            for (; size; --size, ++p)
+            {
+                h ^= (*p) * P5;
+                h = Rotl(h, 11) * P1;
+            }
+
+            h ^= h >> 33;
+            h *= P2;
+            h ^= h >> 29;
+            h *= P3;
+            h ^= h >> 32;
+            return (uint32_t)h;
+        }
+        case Kind::None:
+            return 0;
+        }
+        return 0;
+    }
+}
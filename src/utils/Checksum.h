@@ -0,0 +1,72 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <boost/crc.hpp>
+
+namespace Checksum
+{
+    // Packet payload checksum algorithm, it is recorded in every PacketHead
+    // and negotiated by the Hello handshake. Values match ExtIO_TCP_Proto::ChecksumType.
+    enum class Kind : uint8_t
+    {
+        Crc32 = 0,      // boost::crc_32_type, the legacy one
+        Crc32c = 1,     // SSE4.2 / ARMv8 crc instructions, slicing-by-8 otherwise
+        XxHash64 = 2,   // lower 32 bits of the XXH64
+        None = 3,       // TCP checksum only
+    };
+
+    bool IsValid(uint8_t kind);
+    const char* Name(Kind kind);
+    bool HasHardwareCrc32c();
+
+    // Incremental calculator, the result does not depend on
+    // how the data is split between process_bytes() calls.
+    class Calculator
+    {
+    public:
+
+        explicit Calculator(Kind kind);
+
+        void process_bytes(const void* data, size_t size);
+        uint32_t checksum() const;
+
+    private:
+
+        Kind _kind;
+        uint32_t _crc = 0;
+        boost::crc_32_type _crc32;
+
+        // XXH64 state
+        uint64_t _v[4] = {};
+        uint64_t _totalLen = 0;
+        uint8_t _mem[32] = {};
+        uint32_t _memSize = 0;
+    };
+
+    inline uint32_t Calc(Kind kind, const void* data, size_t size)
+    {
+        Calculator c(kind);
+        c.process_bytes(data, size);
+        return c.checksum();
+    }
+}
@@ -18,14 +18,32 @@
  *****************************************************************************/
 
 #include "Connection.h"
+#include "LocalChannel.h"
+#include "SocketBackend.h"
+#include "BufferPool.h"
 #include "IsAlive.h"
 #include "AtScopeExit.h"
 #include <queue>
+#include <span>
 
 #include "log.h"
 
 namespace
 {
+    // Upper bound of the scatter/gather list of one write, it is the
+    // common IOV_MAX / WSASend buffers limit
+    constexpr size_t c_maxWriteBatchBuffers = 64;
+
+    constexpr size_t c_maxPacketSize = IConnection::c_maxFrameSize;
+    // Upper bound of a packet reassembled from fragments
+    constexpr size_t c_maxReassembledSize = 64 * 1024 * 1024;
+    // The max frame size the peer may ask for, smaller frames cost too many heads
+    constexpr size_t c_minFrameSize = 4 * 1024;
+    // Receive buffer holds at least one packet of the max size plus the next ones head
+    constexpr size_t c_receiveBufferSize = 2 * c_maxPacketSize;
+    // Free space below which the unparsed tail is moved to the buffer start before reading
+    constexpr size_t c_minReadSpace = c_maxPacketSize + 2 * PacketBuffer::head_size();
+
     class Connection : public IConnection
     {
         using socket_type = boost::asio::ip::tcp::socket;
@@ -35,36 +53,90 @@ namespace
         IConnection::strand_type& _strand;
 
         socket_type _socket;
+        const SocketBackend _backendKind;
+        std::unique_ptr<ISocketBackend> _io;
         resolver_type _host_resolver;
         resolve_results_type _resolve_result;
         std::string _hostName;
         uint16_t _port;
         std::atomic_bool _isConnected = false;
+        std::shared_ptr<IBufferPool> _bufferPool = MakeBufferPool();
         AliveInstance _inst;
-        std::atomic_uint _asyncReadRecursionCounter = { 0 };
         std::atomic_uint _asyncWriteRecursionCounter = { 0 };
         uint64_t _nextPacketId = 0;
 
-        struct queue_item
+        struct write_item
         {
-            buffer_ptr buf;
+            PacketBuffer::PacketHead head;
+            const_buffers_type segments;
+            buffer_ptr holder;
             CbT cb;
+            Priority prio = Priority::IQData;
+            std::chrono::steady_clock::time_point queued;
+            bool isFragment = false;
+            PacketBuffer::FragmentHead fragment;
+        };
+
+        // a packet being reassembled from fragments
+        struct reassembly
+        {
+            buffer_ptr buf;         // holds the received part
+            size_t totalSize = 0;
         };
 
-        std::queue<queue_item> _readQueue;
-        std::queue<queue_item> _writeQueue;
+        // a queue per write class, the lower index is written first
+        std::array<std::queue<write_item>, c_priorityClasses> _writeQueues;
+        WriteStats _writeStats;
+        SocketWriteStats _socketWriteStats;
+        std::chrono::steady_clock::time_point _writeStarted;
+        std::vector<write_item> _writeInFlight;
+        std::vector<write_item> _writeDone;
+        std::vector<boost::asio::const_buffer> _writeBuffers;
+        size_t _writeBatchLimit = c_defaultWriteBatchLimit;
+        size_t _zeroCopyThreshold = 0;
+        size_t _maxFrameSize = 0;
+        std::array<reassembly, c_priorityClasses> _reassembly;
+        Checksum::Kind _checksum = Checksum::Kind::Crc32;
+
+        // Received bytes are parsed in place, [_rcvBegin, _rcvEnd) is not parsed yet.
+        std::vector<uint8_t> _rcvBuf;
+        size_t _rcvBegin = 0;
+        size_t _rcvEnd = 0;
+        bool _readInProgress = false;
+        bool _parsingInProgress = false;
+        PacketCbT _packetHandler;
 
     public:
-        Connection(IConnection::strand_type& strand)
+        Connection(IConnection::strand_type& strand, SocketBackend backend)
             : _strand(strand)
             , _socket(_strand)
+            , _backendKind(backend)
+            , _io(MakeAsioSocketBackend(_socket))
             , _host_resolver(_strand)
+            , _rcvBuf(c_receiveBufferSize)
         {
             
         }
 
         ~Connection() 
         {
+            _io->Close();
+
+            auto stats = _bufferPool->GetStats();
+            LOG(trace) << "Connection buffer pool hits: " << stats.hits << "; misses: " << stats.misses;
+
+            for (size_t i = 0; i < c_priorityClasses; ++i)
+            {
+                auto& w = _writeStats[i];
+                if (!w.packets)
+                    continue;
+                LOG(trace) << "Connection write class " << i
+                    << " packets: " << w.packets
+                    << "; bytes: " << w.bytes
+                    << "; max queued: " << w.maxQueued
+                    << "; avg wait: " << (w.totalWait / w.packets).count() << "us"
+                    << "; max wait: " << w.maxWait.count() << "us";
+            }
         }
 
     private:
@@ -79,6 +151,13 @@ namespace
             return _nextPacketId++;
         }
 
+        // The backend closes the socket, the zero copy writes keep their buffers till then
+        void CloseSocket()
+        {
+            _io->Close();
+            _io = MakeAsioSocketBackend(_socket);
+        }
+
         // IConnection
     private:
         virtual void Connect(std::string_view host, uint16_t port, CbT&& cb) override
@@ -101,11 +180,16 @@ namespace
         {
             _isConnected = true;
 
+            // the backend operations refer to the socket being replaced
+            CloseSocket();
             _socket = { _strand,
                 boost::asio::ip::tcp::v4(),
                 socket.release() };
 
             SetupOptions();
+            ResetReceiveState();
+            _io = MakeSocketBackend(_strand, _socket, _backendKind);
+            SetupZeroCopy();
         }
 
         void Cancel() override
@@ -120,32 +204,21 @@ namespace
                 LOG(warning) << e.what();
             }
             _resolve_result = {};
-            _asyncReadRecursionCounter = 0;
-            _asyncWriteRecursionCounter = 0;
-            while(!_readQueue.empty())
-            {
-                auto cb = std::move(_readQueue.front());
-                _readQueue.pop();
-                cb.cb(std::make_error_code(std::errc::operation_canceled));
-
-            }
-            _writeQueue = {};
-            while (!_writeQueue.empty())
-            {
-                auto cb = std::move(_writeQueue.front());
-                _writeQueue.pop();
-                cb.cb(std::make_error_code(std::errc::operation_canceled));
-
-            }
+            ResetReceiveState();
+            if (auto h = std::move(_packetHandler))
+                h(std::make_error_code(std::errc::operation_canceled), {});
+            _writeQueues = {};
+            for (auto& w : _writeStats)
+                w.queued = 0;
 
             if (_socket.is_open())
                 _socket.cancel();
+            _io->Cancel();
         }
 
         void Close() override
         {
-            if (_socket.is_open())
-                _socket.close();
+            CloseSocket();
         }
 
         void AsyncDisconnect(CbT&& cb) override
@@ -166,12 +239,67 @@ namespace
                 [this, cb = std::move(cb), a = AliveFlag()]() mutable {
                     if (!a.IsAlive()) return;
                     _isConnected = false;
-                    if (_socket.is_open()) _socket.close();
+                    CloseSocket();
                     _resolve_result = {};
                     cb({});
                 });
         }
 
+        void SetWriteBatchLimit(size_t bytes) override
+        {
+            assert(_strand.running_in_this_thread());
+
+            _writeBatchLimit = bytes;
+        }
+
+        void SetZeroCopyThreshold(size_t bytes) override
+        {
+            assert(_strand.running_in_this_thread());
+
+            _zeroCopyThreshold = bytes;
+            SetupZeroCopy();
+        }
+
+        void SetMaxFrameSize(size_t bytes) override
+        {
+            assert(_strand.running_in_this_thread());
+
+            _maxFrameSize = bytes ? std::clamp(bytes, c_minFrameSize, c_maxPacketSize) : 0;
+            LOG(trace) << "Max frame size: " << _maxFrameSize;
+        }
+
+        void SetChecksum(Checksum::Kind kind) override
+        {
+            assert(_strand.running_in_this_thread());
+
+            LOG(trace) << "Packet checksum: " << Checksum::Name(kind);
+            _checksum = kind;
+        }
+
+        IBufferPool& GetBufferPool() override
+        {
+            return *_bufferPool;
+        }
+
+        IConnection::strand_type& GetStrand() override
+        {
+            return _strand;
+        }
+
+        WriteStats GetWriteStats() const override
+        {
+            assert(_strand.running_in_this_thread());
+
+            return _writeStats;
+        }
+
+        SocketWriteStats GetSocketWriteStats() const override
+        {
+            assert(_strand.running_in_this_thread());
+
+            return _socketWriteStats;
+        }
+
         bool IsConnected() const override
         {
             assert( _strand.running_in_this_thread() );
@@ -179,172 +307,507 @@ namespace
             return _isConnected;
         }
 
-        void AsyncWritePacket(const buffer_ptr& buf, CbT&& cb) override
+        boost::asio::ip::tcp::endpoint RemoteEndpoint() const override
+        {
+            boost::system::error_code ec;
+            return _socket.remote_endpoint(ec);
+        }
+
+        std::string CreateLocalChannel() override
+        {
+            return {};
+        }
+
+        bool OpenLocalChannel(const std::string& name) override
+        {
+            return false;
+        }
+
+        void AsyncWritePacket(const buffer_ptr& buf, Priority prio, CbT&& cb) override
         {
             assert(_strand.running_in_this_thread());
 
-            assert(buf->raw_size() < 1*1024*1024);
             assert(buf->packet_type() == PacketBuffer::PacketType::Message ||
                 buf->packet_type() == PacketBuffer::PacketType::RawData);
 
-            {
-                auto& pkt = const_cast<buffer_type&>(*buf);
+            //if (buf->size() > 50 * 1024) const_cast<buffer_type&>(*buf).fill(0xaa);
 
-                //if (pkt.size() > 50 * 1024) pkt.fill(0xaa);
+            QueuePacket(
+                buf->packet_type(),
+                { boost::asio::const_buffer(buf->data(), buf->size()) },
+                buf,
+                prio,
+                std::move(cb));
+        }
 
-                pkt.write_crc_to_head();
-                pkt.set_id(nextPackedId());
-            }
+        void AsyncWriteSegments(PacketBuffer::PacketType type, const_buffers_type&& segments, Priority prio, CbT&& cb) override
+        {
+            assert(_strand.running_in_this_thread());
 
-            if (_asyncWriteRecursionCounter)
+            assert(type == PacketBuffer::PacketType::Message ||
+                type == PacketBuffer::PacketType::RawData);
+
+            QueuePacket(type, std::move(segments), {}, prio, std::move(cb));
+        }
+
+        void QueuePacket(
+            PacketBuffer::PacketType type, const_buffers_type&& segments, const buffer_ptr& holder, Priority prio, CbT&& cb)
+        {
+            const size_t size = boost::asio::buffer_size(segments);
+            if ((_maxFrameSize ? c_maxReassembledSize : c_maxPacketSize) < size)
             {
-                _writeQueue.push({ buf , std::move(cb)});
-                //LOG(trace) << "Queued write operation, queue size: " << _writeQueue.size();
+                LOG(error) << "Packet of " << size << " bytes is too large to send.";
+                // the cb is called asynchronously as for the written packets
+                boost::asio::post(_strand, [cb = std::move(cb), a = AliveFlag()]() mutable {
+                    if (!a.IsAlive()) return;
+                    cb(std::make_error_code(std::errc::message_size));
+                });
                 return;
             }
 
-            ++_asyncWriteRecursionCounter;
+            if (_maxFrameSize && size > _maxFrameSize)
+                return QueueFragments(type, segments, holder, prio, std::move(cb));
 
-            boost::asio::async_write(_socket, boost::asio::const_buffer(buf->head_data(), buf->raw_size()),
-                [this, buf, cb = std::move(cb),a = AliveFlag()]
-                (const boost::system::error_code& ec, std::size_t bytes_transferred) mutable
-                {
-                    if (!a.IsAlive()) return;
-                    {
-                        AtScopeExit _([a = &_asyncWriteRecursionCounter]() { --(*a);  });
-                        if (ec.failed())
-                        {
-                            if (cb) cb(ec);
-                            return;
-                        }
+            QueueWrite(MakeWriteItem(type, std::move(segments), holder, prio, std::move(cb)));
+        }
 
-                        if (bytes_transferred != buf->raw_size())
-                        {
-                            if (cb) cb(std::make_error_code(std::errc::io_error));
-                            return;
-                        }
-                        /*
-                        LOG(trace) << "Packet sent, type: "
-                            << (int)buf->packet_type()
-                            << "; packet_size: " << buf->packet_size()
-                            << "; size: " << buf->size()
-                            << "; crc1: " << buf->calc_crc()
-                            << "; crc2: " << buf->get_crc()
-                            << "; id: " << buf->get_id();
-                            */
-                    }
+        // Splits the packet into Fragment packets of the max frame size, they refer
+        // to the packet memory. The last one carries the cb.
+        void QueueFragments(
+            PacketBuffer::PacketType type, const const_buffers_type& segments, const buffer_ptr& holder, Priority prio, CbT&& cb)
+        {
+            const size_t totalSize = boost::asio::buffer_size(segments);
+            const size_t chunkSize = _maxFrameSize - sizeof(PacketBuffer::FragmentHead);
+
+            auto segment = segments.begin();
+            size_t segmentOffset = 0;
+            size_t sent = 0;
 
-                    queue_item nextTask;
-                    
-                    if (!_writeQueue.empty())
+            while (sent < totalSize)
+            {
+                write_item item;
+                item.isFragment = true;
+                item.fragment.type = type;
+                item.fragment.stream = (uint8_t)prio;
+                item.fragment.totalSize = (uint32_t)totalSize;
+
+                size_t chunk = 0;
+                while (chunk < chunkSize && segment != segments.end())
+                {
+                    const size_t n = std::min(chunkSize - chunk, segment->size() - segmentOffset);
+                    if (n)
+                        item.segments.push_back(boost::asio::buffer(*segment + segmentOffset, n));
+                    chunk += n;
+                    segmentOffset += n;
+                    if (segmentOffset == segment->size())
                     {
-                        nextTask = std::move(_writeQueue.front());
-                        //LOG(trace) << "Dequeued write operation, queue size: " << _writeQueue.size();
-                        _writeQueue.pop();
+                        ++segment;
+                        segmentOffset = 0;
                     }
+                }
+                sent += chunk;
+                item.fragment.last = sent == totalSize;
+
+                const_buffers_type crcSegments = { boost::asio::buffer(&item.fragment, sizeof(item.fragment)) };
+                crcSegments.insert(crcSegments.end(), item.segments.begin(), item.segments.end());
+
+                item.head.type = PacketBuffer::PacketType::Fragment;
+                item.head.checksum = _checksum;
+                item.head.size = (uint32_t)(sizeof(item.fragment) + chunk);
+                item.head.crc = PacketBuffer::calc_crc(_checksum, crcSegments);
+                item.head.id = nextPackedId();
+                item.holder = holder;
+                item.prio = prio;
+                if (item.fragment.last)
+                    item.cb = std::move(cb);
+
+                QueueWrite(std::move(item));
+            }
+        }
+
+        write_item MakeWriteItem(
+            PacketBuffer::PacketType type, const_buffers_type&& segments, const buffer_ptr& holder, Priority prio, CbT&& cb)
+        {
+            write_item item;
+            item.head.type = type;
+            item.head.checksum = _checksum;
+            item.head.size = (uint32_t)boost::asio::buffer_size(segments);
+            item.head.crc = PacketBuffer::calc_crc(_checksum, segments);
+            item.head.id = nextPackedId();
+            item.segments = std::move(segments);
+            item.holder = holder;
+            item.cb = std::move(cb);
+            item.prio = prio;
+
+            return item;
+        }
 
-                    if (cb) cb(ec);
+        void SetupZeroCopy()
+        {
+            if (_zeroCopyThreshold && _io->EnableZeroCopy())
+                LOG(trace) << "Packets of " << _zeroCopyThreshold << " bytes and larger are sent with zero copy.";
+        }
 
-                    if (nextTask.buf)
-                        AsyncWritePacket(nextTask.buf, std::move(nextTask.cb));
-                });
+        // Large pooled packets only, the segments of AsyncWriteSegments
+        // are valid until the write completion only
+        bool IsZeroCopy(const write_item& item) const
+        {
+            return _zeroCopyThreshold && item.holder && !item.isFragment &&
+                item.head.size >= _zeroCopyThreshold && _io->IsZeroCopyEnabled();
         }
 
-        void AsyncReadPacket(const buffer_ptr& buf, CbT&& cb) override
+        void QueueWrite(write_item&& item)
         {
-            assert(_strand.running_in_this_thread());
+            auto& stats = _writeStats[(size_t)item.prio];
+            stats.maxQueued = std::max(stats.maxQueued, ++stats.queued);
 
-            if (_asyncReadRecursionCounter)
+            item.queued = std::chrono::steady_clock::now();
+            _writeQueues[(size_t)item.prio].push(std::move(item));
+
+            if (_asyncWriteRecursionCounter)
             {
-                _readQueue.push({buf, std::move(cb)});
+                //LOG(trace) << "Queued write operation, class queue size: " << stats.queued;
                 return;
             }
 
-            ++_asyncReadRecursionCounter;
+            StartWrite();
+        }
+
+        // The highest class queue having packets, nullptr if all are empty
+        std::queue<write_item>* NextWriteQueue()
+        {
+            for (auto& q : _writeQueues)
+                if (!q.empty())
+                    return &q;
+            return nullptr;
+        }
+
+        // Drains the write queues into one gathered write, the higher classes first.
+        // At least one packet is taken, further ones only while they fit into the
+        // batch limits, so a control packet queued behind a batch of IQ frames
+        // waits for that batch only. A zero copy packet is written alone.
+        void StartWrite()
+        {
+            assert(_writeInFlight.empty());
+            assert(NextWriteQueue());
+
+            ++_asyncWriteRecursionCounter;
+
+            _writeBuffers.clear();
+            size_t totalSize = 0;
+            size_t buffersTotal = 0;
+            const auto now = std::chrono::steady_clock::now();
+            _writeStarted = now;
+
+            bool zeroCopy = false;
+
+            while (auto* queue = NextWriteQueue())
+            {
+                auto& next = queue->front();
+                const size_t packetSize = PacketBuffer::head_size() + next.head.size;
+                const size_t buffersNumber = 1 + next.isFragment + next.segments.size();
+
+                if (!_writeInFlight.empty() && 
+                    (IsZeroCopy(next) ||
+                    totalSize + packetSize > _writeBatchLimit ||
+                    buffersTotal + buffersNumber > c_maxWriteBatchBuffers))
+                    break;
+
+                auto& stats = _writeStats[(size_t)next.prio];
+                const auto wait = std::chrono::duration_cast<std::chrono::microseconds>(now - next.queued);
+                --stats.queued;
+                ++stats.packets;
+                stats.bytes += packetSize;
+                stats.totalWait += wait;
+                stats.maxWait = std::max(stats.maxWait, wait);
+
+                zeroCopy = IsZeroCopy(next);
+                _writeInFlight.push_back(std::move(next));
+                queue->pop();
+                totalSize += packetSize;
+                buffersTotal += buffersNumber;
+
+                if (zeroCopy)
+                    break;
+            }
 
-            boost::asio::async_read(_socket, boost::asio::mutable_buffer(buf->head_data(), buf->head_size()),
-            [this, buf, cb = std::move(cb), a = AliveFlag()]
+            auto onWritten = [this, totalSize, a = AliveFlag()]
             (const boost::system::error_code& ec, std::size_t bytes_transferred) mutable
+            {
+                if (!a.IsAlive()) return;
+                OnWriteDone(ec, bytes_transferred, totalSize);
+            };
+
+            if (zeroCopy)
+            {
+                // the kernel reads the packet after the write completion,
+                // so the head goes to the head room of the buffer it keeps
+                auto& pkt = _writeInFlight.front();
+                std::memcpy(pkt.holder->head_data(), &pkt.head, PacketBuffer::head_size());
+                _writeBuffers.push_back(boost::asio::const_buffer(pkt.holder->head_data(), pkt.holder->raw_size()));
+                _io->AsyncWriteZeroCopy(std::span<const boost::asio::const_buffer>(_writeBuffers),
+                    pkt.holder, std::move(onWritten));
+                return;
+            }
+
+            // the heads are kept by the in-flight items, they do not move until the write is done
+            for (auto& pkt : _writeInFlight)
+            {
+                _writeBuffers.push_back(boost::asio::const_buffer(&pkt.head, PacketBuffer::head_size()));
+                if (pkt.isFragment)
+                    _writeBuffers.push_back(boost::asio::const_buffer(&pkt.fragment, sizeof(pkt.fragment)));
+                _writeBuffers.insert(_writeBuffers.end(), pkt.segments.begin(), pkt.segments.end());
+            }
+
+            //LOG(trace) << "Write batch of " << _writeInFlight.size() << " packets, " << totalSize << " bytes.";
+
+            _io->AsyncWrite(std::span<const boost::asio::const_buffer>(_writeBuffers), std::move(onWritten));
+        }
+
+        void OnWriteDone(const boost::system::error_code& ec, std::size_t bytes_transferred, size_t totalSize)
+        {
+            assert(_writeDone.empty());
+            _writeDone.swap(_writeInFlight);
+            AtScopeExit _([this]() { _writeDone.clear(); });
+
+            --_asyncWriteRecursionCounter;
+
+            _socketWriteStats.bytes += bytes_transferred;
+            _socketWriteStats.busy += std::chrono::steady_clock::now() - _writeStarted;
+
+            auto result = ec;
+            if (!result.failed() && bytes_transferred != totalSize)
+                result = std::make_error_code(std::errc::io_error);
+
+            // start the next batch before the callbacks, so packets
+            // written from within a callback keep the queue order;
+            // after a failure the queued packets go to the reconnected socket
+            if (NextWriteQueue())
+                StartWrite();
+
+            for (auto& item : _writeDone) if (item.cb) item.cb(result);
+        }
+
+        void AsyncReadPackets(PacketCbT&& cb) override
+        {
+            assert(_strand.running_in_this_thread());
+            assert(!_packetHandler);
+
+            _packetHandler = std::move(cb);
+
+            // a handler set from within a handler call is served by the running parse loop
+            if (_parsingInProgress)
+                return;
+
+            // already received packets are delivered asynchronously as the fresh ones are
+            boost::asio::post(_strand, [this, a = AliveFlag()]() {
+                if (!a.IsAlive()) return;
+                ParsePackets();
+            });
+        }
+
+    private:
+
+        void ResetReceiveBuffer()
+        {
+            _rcvBegin = 0;
+            _rcvEnd = 0;
+        }
+
+        // A new socket or a failed one, the packets being reassembled are dropped too
+        void ResetReceiveState()
+        {
+            ResetReceiveBuffer();
+            _reassembly = {};
+        }
+
+        void FailRead(const boost::system::error_code& ec)
+        {
+            ResetReceiveState();
+
+            if (auto h = std::move(_packetHandler))
+                h(ec, {});
+            else
+                LOG(trace) << "Read failed without a handler: " << ec.message();
+        }
+
+        // Delivers every complete packet of the receive buffer
+        // while the handler asks for more, then reads further.
+        void ParsePackets()
+        {
+            if (_parsingInProgress)
+                return;
+
+            {
+                _parsingInProgress = true;
+                AtScopeExit _([this]() { _parsingInProgress = false; });
+
+                while (_packetHandler)
                 {
-                    if (!a.IsAlive()) return;
-                    if (ec.failed())
+                    const size_t avail = _rcvEnd - _rcvBegin;
+                    if (avail < PacketBuffer::head_size())
+                        break;
+
+                    PacketView view;
+                    std::memcpy(&view.head, _rcvBuf.data() + _rcvBegin, PacketBuffer::head_size());
+
+                    if ((view.head.type != PacketBuffer::PacketType::RawData &&
+                        view.head.type != PacketBuffer::PacketType::Message &&
+                        view.head.type != PacketBuffer::PacketType::Fragment) ||
+                        !Checksum::IsValid((uint8_t)view.head.checksum) ||
+                        view.head.size > c_maxPacketSize)
                     {
-                        if (cb) cb(ec);
-                        return;
+                        FailRead(std::make_error_code(std::errc::bad_message));
+                        continue;
                     }
 
-                    if (bytes_transferred != buf->head_size())
+                    if (avail < PacketBuffer::head_size() + view.head.size)
+                        break;
+
+                    view.data = _rcvBuf.data() + _rcvBegin + PacketBuffer::head_size();
+                    view.size = view.head.size;
+
+                    const auto crc = Checksum::Calc(view.head.checksum, view.data, view.size);
+                    if (crc != view.head.crc)
                     {
-                        if (cb) cb(std::make_error_code(std::errc::protocol_error));
-                        return;
+                        LOG(trace) << "Packet read crc error, type: "
+                            << (int)view.head.type
+                            << "; size: " << view.size
+                            << "; checksum: " << Checksum::Name(view.head.checksum)
+                            << "; crc1: " << crc
+                            << "; crc2: " << view.head.crc
+                            << "; id: " << view.head.id;
+
+                        FailRead(std::make_error_code(std::errc::io_error));
+                        continue;
                     }
 
-                    if (buf->packet_type() != PacketBuffer::PacketType::RawData &&
-                        buf->packet_type() != PacketBuffer::PacketType::Message)
+                    // the buffer is not moved until the next read, the view stays valid during the call
+                    _rcvBegin += PacketBuffer::head_size() + view.size;
+
+                    // the reassembled packet is kept until the handler returns
+                    buffer_ptr whole;
+                    if (view.head.type == PacketBuffer::PacketType::Fragment)
                     {
-                        if (cb) cb(std::make_error_code(std::errc::bad_message));
-                        return;
+                        boost::system::error_code ec;
+                        whole = Reassemble(view, ec);
+                        if (ec.failed())
+                        {
+                            FailRead(ec);
+                            continue;
+                        }
+                        if (!whole)
+                            continue;
                     }
 
-                    if (buf->size() > 1*1024*1024)
+                    //LOG(trace) << "Packet read, type: " << (int)view.head.type << "; id: " << view.head.id;
+
+                    auto h = std::move(_packetHandler);
+                    const bool more = h({}, view);
+                    if (more && !_packetHandler)
+                        _packetHandler = std::move(h);
+                }
+            }
+
+            if (_packetHandler)
+                AsyncReadSome();
+        }
+
+        // Appends the fragment to the packet of its stream, returns the packet
+        // and points the view to it when the last fragment is received
+        buffer_ptr Reassemble(PacketView& view, boost::system::error_code& ec)
+        {
+            PacketBuffer::FragmentHead fragment;
+            if (view.size < sizeof(fragment))
+            {
+                ec = std::make_error_code(std::errc::bad_message);
+                return {};
+            }
+            std::memcpy(&fragment, view.data, sizeof(fragment));
+
+            const auto* data = (const uint8_t*)view.data + sizeof(fragment);
+            const size_t size = view.size - sizeof(fragment);
+
+            if (fragment.stream >= c_priorityClasses ||
+                fragment.totalSize > c_maxReassembledSize ||
+                (fragment.type != PacketBuffer::PacketType::RawData &&
+                fragment.type != PacketBuffer::PacketType::Message))
+            {
+                ec = std::make_error_code(std::errc::bad_message);
+                return {};
+            }
+
+            // the buffer grows as the fragments arrive, a peer announcing a large
+            // total size does not get the memory before it sends the data
+            auto& r = _reassembly[fragment.stream];
+            if (!r.buf)
+            {
+                r.buf = _bufferPool->Acquire(std::min<size_t>(fragment.totalSize, c_maxPacketSize));
+                r.buf->resize(0);
+                r.totalSize = fragment.totalSize;
+            }
+
+            if (r.totalSize != fragment.totalSize || r.buf->size() + size > fragment.totalSize ||
+                (fragment.last && r.buf->size() + size != fragment.totalSize))
+            {
+                r = {};
+                ec = std::make_error_code(std::errc::bad_message);
+                return {};
+            }
+
+            const size_t received = r.buf->size();
+            r.buf->resize(received + size);
+            std::memcpy((uint8_t*)r.buf->data() + received, data, size);
+
+            if (!fragment.last)
+                return {};
+
+            view.head.type = fragment.type;
+            view.head.size = fragment.totalSize;
+            view.head.crc = 0;
+            view.data = r.buf->data();
+            view.size = fragment.totalSize;
+
+            auto whole = std::move(r.buf);
+            r = {};
+            return whole;
+        }
+
+        void AsyncReadSome()
+        {
+            if (_readInProgress)
+                return;
+
+            if (_rcvBegin == _rcvEnd)
+                ResetReceiveBuffer();
+            else if (_rcvBuf.size() - _rcvEnd < c_minReadSpace)
+            {
+                // move the incomplete packet to the buffer start
+                std::memmove(_rcvBuf.data(), _rcvBuf.data() + _rcvBegin, _rcvEnd - _rcvBegin);
+                _rcvEnd -= _rcvBegin;
+                _rcvBegin = 0;
+            }
+
+            _readInProgress = true;
+
+            _io->AsyncReadSome(
+                boost::asio::mutable_buffer(_rcvBuf.data() + _rcvEnd, _rcvBuf.size() - _rcvEnd),
+                [this, a = AliveFlag()]
+                (const boost::system::error_code& ec, std::size_t bytes_transferred)
+                {
+                    if (!a.IsAlive()) return;
+
+                    _readInProgress = false;
+
+                    if (ec.failed())
                     {
-                        if (cb) cb(std::make_error_code(std::errc::bad_message));
+                        FailRead(ec);
                         return;
                     }
 
-                    buf->resize(buf->size());
+                    _rcvEnd += bytes_transferred;
 
-                    boost::asio::async_read(
-                        _socket, boost::asio::mutable_buffer(buf->data(), buf->size()),
-                        boost::asio::transfer_exactly(buf->size()),
-                    [this, buf, cb = std::move(cb), a = AliveFlag()]
-                    (const boost::system::error_code& ec, std::size_t bytes_transferred) mutable
-                        {
-                            if (!a.IsAlive()) return;
-                            if (ec.failed())
-                            {
-                                if (cb) cb(ec);
-                                return;
-                            }
-
-                            if (bytes_transferred != buf->size())
-                            {
-                                if (cb) cb(std::make_error_code(std::errc::protocol_error));
-                                return;
-                            }
-
-                            if (buf->calc_crc() != buf->get_crc())
-                            {
-                                LOG(trace) << "Packet read crc error, type: " 
-                                    << (int)buf->packet_type() 
-                                    << "; packet_size: " << buf->packet_size()
-                                    << "; size: " << buf->size()
-                                    << "; crc1: " << buf->calc_crc()
-                                    << "; crc2: " << buf->get_crc()
-                                    << "; id: " << buf->get_id();
-
-                                if (cb) cb(std::make_error_code(std::errc::io_error));
-                                return;
-                            }
-
-                            --_asyncReadRecursionCounter;
-
-                            //LOG(trace) << "Packet read, type: " << (int)buf->packet_type() << "; id: " << buf->get_id();
-
-                            queue_item nextTask;
-
-                            if (!_readQueue.empty())
-                            {
-                                nextTask = std::move(_readQueue.front());
-                                //LOG(trace) << "Dequeued read operation, queue size: " << _readQueue.size();
-                                _readQueue.pop();
-                            }
-
-                            if (cb) cb(ec);
-
-                            if (nextTask.buf)
-                                AsyncReadPacket(nextTask.buf, std::move(nextTask.cb));
-                        });
+                    ParsePackets();
                 });
         }
 
@@ -438,14 +901,23 @@ namespace
 
             _isConnected = true;
 
+            ResetReceiveState();
             SetupOptions();
+            _io = MakeSocketBackend(_strand, _socket, _backendKind);
+            SetupZeroCopy();
 
             cb(error);
         }
     };
 }
 
-std::unique_ptr<IConnection> MakeConnection(IConnection::strand_type& strand)
+std::unique_ptr<IConnection> MakeConnection(
+    IConnection::strand_type& strand,
+    ConnectionType type/* = ConnectionType::Tcp*/,
+    SocketBackend backend/* = SocketBackend::Asio*/)
 {
-    return std::make_unique<Connection>(strand);
+    auto connection = std::make_unique<Connection>(strand, backend);
+    if (type == ConnectionType::TcpWithLocalChannel)
+        return MakeLocalChannelConnection(strand, std::move(connection));
+    return connection;
 }
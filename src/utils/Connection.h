@@ -21,6 +21,9 @@
 
 #include <boost/function.hpp>
 #include <boost/crc.hpp>
+#include <boost/container/small_vector.hpp>
+
+#include "Checksum.h"
 
 class PacketBuffer
 {
@@ -31,15 +34,27 @@ public:
     enum class PacketType : char {
         RawData = 0,
         Message = 1,
+        Fragment = 2,   // a part of a packet larger than the peer max frame size
     };
 
     struct PacketHead
     {
         PacketType type = PacketType::RawData;
+        Checksum::Kind checksum = Checksum::Kind::Crc32;
         uint32_t size = 0;
         uint32_t crc = 0;
         uint64_t id = 0;
     };
+
+    // Leads the payload of a Fragment packet. The fragments of a stream come
+    // in order, the ones of different streams may interleave.
+    struct FragmentHead
+    {
+        PacketType type = PacketType::RawData;  // of the whole packet
+        uint8_t stream = 0;
+        uint8_t last = 0;
+        uint32_t totalSize = 0;                 // payload size of the whole packet
+    };
 #pragma pack(pop)
 
     PacketBuffer() {
@@ -53,6 +68,18 @@ public:
         _data.reserve(s + headSize);
     }
 
+    // payload bytes the buffer can hold without reallocation
+    size_t capacity() const {
+        return _data.capacity() - headSize;
+    }
+
+    // makes an empty Message packet, the capacity is kept
+    void reset() {
+        _data.resize(headSize);
+        head() = {};
+        set_packet_type(PacketType::Message);
+    }
+
     size_t size() const {
         return head().size;
     }
@@ -99,11 +126,27 @@ public:
     }
 
     uint32_t calc_crc() const {
-        boost::crc_32_type result;
-        result.process_bytes(data(), size());
+        return Checksum::Calc(checksum_kind(), data(), size());
+    }
+
+    // Incremental crc over the payload split into several segments,
+    // gives the same result as calc_crc() over the joined payload.
+    template<typename ConstBufferSequence>
+    static uint32_t calc_crc(Checksum::Kind kind, const ConstBufferSequence& segments) {
+        Checksum::Calculator result(kind);
+        for (const auto& s : segments)
+            result.process_bytes(s.data(), s.size());
         return result.checksum();
     }
 
+    Checksum::Kind checksum_kind() const {
+        return head().checksum;
+    }
+
+    void set_checksum_kind(Checksum::Kind k) {
+        head().checksum = k;
+    }
+
     uint32_t get_crc() const {
         return head().crc;
     }
@@ -144,14 +187,63 @@ private:
     static constexpr size_t headSize = sizeof(PacketHead);
 };
 
+// Received packet parsed in place of the connection receive buffer,
+// the data is valid during the handler call only.
+struct PacketView
+{
+    PacketBuffer::PacketHead head;
+    const void* data = nullptr;
+    size_t size = 0;
+};
+
+class IBufferPool;
+
 class IConnection
 {
 public:
 
+    // Queued packets are sent with one gathered write up to this number of bytes
+    static constexpr size_t c_defaultWriteBatchLimit = 256 * 1024;
+    // The largest packet payload a connection reads
+    static constexpr size_t c_maxFrameSize = 1 * 1024 * 1024;
+
     using buffer_type = PacketBuffer;
     using buffer_ptr = std::shared_ptr<buffer_type>;
     using strand_type = boost::asio::strand<boost::asio::io_context::executor_type>;
     using CbT = std::move_only_function<void(const boost::system::error_code&)>;
+    using const_buffers_type = boost::container::small_vector<boost::asio::const_buffer, 4>;
+    // Returns true to get the next packet
+    using PacketCbT = std::move_only_function<bool(const boost::system::error_code&, const PacketView&)>;
+
+    // Write classes, a queued packet of a higher class is written first,
+    // the packets of the same class keep their order.
+    enum class Priority
+    {
+        ControlResponce,
+        ControlRequest,
+        IQData,
+        Telemetry,
+    };
+    static constexpr size_t c_priorityClasses = 4;
+
+    struct WriteClassStats
+    {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        size_t queued = 0;          // packets waiting for the socket now
+        size_t maxQueued = 0;
+        std::chrono::microseconds totalWait{};  // from the queueing to the write start
+        std::chrono::microseconds maxWait{};
+    };
+    using WriteStats = std::array<WriteClassStats, c_priorityClasses>;
+
+    // Socket writes since the connection was made, a write is busy
+    // from its start to its completion
+    struct SocketWriteStats
+    {
+        uint64_t bytes = 0;
+        std::chrono::nanoseconds busy{};
+    };
 
     virtual ~IConnection() = default;
 
@@ -160,9 +252,49 @@ public:
     virtual void Cancel() = 0;
     virtual void Close() = 0;
     virtual bool IsConnected() const = 0;
+    virtual boost::asio::ip::tcp::endpoint RemoteEndpoint() const = 0;
+    virtual void SetWriteBatchLimit(size_t bytes) = 0;
+    // Packets of at least this payload size are sent with MSG_ZEROCOPY where
+    // the socket supports it, 0 turns it off
+    virtual void SetZeroCopyThreshold(size_t bytes) = 0;
+    // The largest packet payload the peer reads, the larger packets are sent as
+    // Fragment packets the peer reassembles. 0 is a peer without fragments support.
+    virtual void SetMaxFrameSize(size_t bytes) = 0;
+    // Checksum of the packets written from now on, received ones are checked by their head
+    virtual void SetChecksum(Checksum::Kind kind) = 0;
+    virtual IBufferPool& GetBufferPool() = 0;
+    // The strand all the calls and handlers of the connection run within
+    virtual strand_type& GetStrand() = 0;
+    virtual WriteStats GetWriteStats() const = 0;
+    virtual SocketWriteStats GetSocketWriteStats() const = 0;
     virtual void AsyncDisconnect(CbT&& cb) = 0;
-    virtual void AsyncWritePacket(const buffer_ptr& buf, CbT&& cb) = 0;
-    virtual void AsyncReadPacket(const buffer_ptr& buf, CbT&& cb) = 0;
+    virtual void AsyncWritePacket(const buffer_ptr& buf, Priority prio, CbT&& cb) = 0;
+    // Sends one packet whose payload is the concatenation of the segments.
+    // The segments memory must stay valid until the cb is called.
+    virtual void AsyncWriteSegments(PacketBuffer::PacketType type, const_buffers_type&& segments, Priority prio, CbT&& cb) = 0;
+    // Reads the stream with as few reads as possible and calls cb for every
+    // complete packet until it returns false or an error is reported.
+    virtual void AsyncReadPackets(PacketCbT&& cb) = 0;
+    // Same host channel for RawData packets written by this side,
+    // returns the name for the peer or an empty string if not supported.
+    virtual std::string CreateLocalChannel() = 0;
+    // Opens the channel created by the peer to read its RawData packets
+    virtual bool OpenLocalChannel(const std::string& name) = 0;
+};
+
+enum class ConnectionType
+{
+    Tcp,
+    TcpWithLocalChannel,    // RawData packets may go through shared memory
+};
+
+enum class SocketBackend
+{
+    Asio,
+    IoUring,    // Linux only, falls back to Asio where not available
 };
 
-std::unique_ptr<IConnection> MakeConnection(IConnection::strand_type& strand);
+std::unique_ptr<IConnection> MakeConnection(
+    IConnection::strand_type& strand,
+    ConnectionType type = ConnectionType::Tcp,
+    SocketBackend backend = SocketBackend::Asio);
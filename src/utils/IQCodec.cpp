@@ -0,0 +1,608 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "IQCodec.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+
+namespace
+{
+    using namespace IQCodec;
+
+    // The first byte of a coded block tells how it is coded
+    constexpr uint8_t c_stored = 0;         // the samples as they are
+    constexpr uint8_t c_rice = 1;           // value size byte and the bit stream
+    constexpr uint8_t c_packed = 2;         // value size and pack bits bytes, the packed groups
+
+    constexpr size_t c_riceHeadSize = 2;
+    constexpr size_t c_partition = 32;      // values sharing the Rice parameter
+    constexpr int c_escapeZeros = 24;       // the unary prefix of a value written in full
+    constexpr int c_maxOrder = 2;
+    // a partition with every value escaped, the bits the writer holds back,
+    // the head of the next channel and the flush
+    constexpr size_t c_maxPartitionBytes = (5 + c_partition * (c_escapeZeros + 32)) / 8 + 16;
+
+    // MSB first bit stream writer, the caller keeps the output within its capacity
+    class BitWriter
+    {
+    public:
+
+        BitWriter(uint8_t* out, size_t capacity)
+            : _begin(out), _p(out), _end(out + capacity)
+        {
+        }
+
+        // n <= 32, value < 2^n
+        void Put(uint32_t value, int n)
+        {
+            _acc = (_acc << n) | value;
+            _bits += n;
+            if (_bits >= 32)
+            {
+                _bits -= 32;
+                const uint32_t word = std::byteswap(uint32_t(_acc >> _bits));
+                std::memcpy(_p, &word, 4);
+                _p += 4;
+            }
+        }
+
+        void PutRice(uint32_t value, int k)
+        {
+            const uint32_t q = value >> k;
+            if (q >= c_escapeZeros)
+            {
+                Put(0, c_escapeZeros);
+                Put(value, 32);
+            }
+            else if (q + 1 + k <= 32)
+            {
+                Put((1u << k) | (value & ((1u << k) - 1)), q + 1 + k);
+            }
+            else
+            {
+                Put(1, q + 1);
+                Put(value & ((1u << k) - 1), k);
+            }
+        }
+
+        // Returns the stream size
+        size_t Flush()
+        {
+            for (; _bits > 0; _bits -= std::min(_bits, 8))
+                *_p++ = uint8_t(_bits >= 8 ? _acc >> (_bits - 8) : _acc << (8 - _bits));
+            return _p - _begin;
+        }
+
+        size_t Remaining() const
+        {
+            return _end - _p;
+        }
+
+    private:
+
+        uint8_t* _begin;
+        uint8_t* _p;
+        uint8_t* _end;
+        uint64_t _acc = 0;
+        int _bits = 0;
+    };
+
+    // Reads past the end as zeros, Overrun() tells if they were consumed
+    class BitReader
+    {
+    public:
+
+        BitReader(const uint8_t* data, size_t size)
+            : _p(data), _end(data + size)
+        {
+        }
+
+        // Makes at least 56 bits available
+        void Refill()
+        {
+            if (_end - _p >= 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, _p, 8);
+                _acc |= std::byteswap(word) >> _bits;
+                _p += (63 - _bits) >> 3;
+                _bits |= 56;
+                return;
+            }
+            for (; _bits <= 56; _bits += 8)
+            {
+                uint64_t byte = 0;
+                if (_p < _end)
+                    byte = *_p++;
+                else
+                    ++_padBytes;
+                _acc |= byte << (56 - _bits);
+            }
+        }
+
+        // n <= 32, the bits must be available
+        uint32_t Get(int n)
+        {
+            if (!n)
+                return 0;
+            const auto value = uint32_t(_acc >> (64 - n));
+            _acc <<= n;
+            _bits -= n;
+            return value;
+        }
+
+        // 56 bits must be available
+        uint32_t GetRice(int k)
+        {
+            const int zeros = std::countl_zero(_acc);
+            if (zeros >= c_escapeZeros)
+            {
+                Get(c_escapeZeros);
+                return Get(32);
+            }
+            _acc <<= zeros + 1;
+            _bits -= zeros + 1;
+            return (uint32_t(zeros) << k) | Get(k);
+        }
+
+        bool Overrun() const
+        {
+            return _padBytes * 8 > (size_t)_bits;
+        }
+
+    private:
+
+        const uint8_t* _p;
+        const uint8_t* _end;
+        uint64_t _acc = 0;
+        int _bits = 0;
+        size_t _padBytes = 0;
+    };
+
+    inline uint32_t ZigZag(uint32_t r)
+    {
+        return (r << 1) ^ uint32_t(int32_t(r) >> 31);
+    }
+
+    inline uint32_t UnZigZag(uint32_t z)
+    {
+        return (z >> 1) ^ (0u - (z & 1));
+    }
+
+    // The residual of the prediction of the given order, modulo 2^32
+    inline uint32_t Residual(int order, uint32_t x, uint32_t x1, uint32_t x2)
+    {
+        switch (order)
+        {
+        case 0: return x;
+        case 1: return x - x1;
+        default: return x - 2 * x1 + x2;
+        }
+    }
+
+    template<size_t N>
+    int32_t LoadValue(const uint8_t* p)
+    {
+        if constexpr (N == 1)
+            return int8_t(p[0]);
+        else if constexpr (N == 2)
+        {
+            int16_t v;
+            std::memcpy(&v, p, 2);
+            return v;
+        }
+        else if constexpr (N == 3)
+            return int32_t(uint32_t(p[0] | p[1] << 8 | p[2] << 16) << 8) >> 8;
+        else
+        {
+            int32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+    }
+
+    template<size_t N>
+    void StoreValue(uint8_t* p, uint32_t v)
+    {
+        if constexpr (N == 2 || N == 4)
+        {
+            std::memcpy(p, &v, N);
+        }
+        else
+        {
+            for (size_t i = 0; i < N; ++i)
+                p[i] = uint8_t(v >> (8 * i));
+        }
+    }
+
+    // ========================================================================
+    // Encoder
+
+    // Codes the values of one channel, false if the output capacity is short
+    bool EncodeChannel(BitWriter& writer, std::span<const int32_t> values)
+    {
+        // the predictor order of the least residuals and the low bits
+        // a left aligned ADC never sets, the shift does not change the order
+        uint32_t used = 0;
+        uint64_t sum[c_maxOrder + 1] = {};
+        uint32_t x1 = 0, x2 = 0;
+        for (auto v : values)
+        {
+            const auto x = uint32_t(v);
+            used |= x;
+            sum[0] += ZigZag(x);
+            sum[1] += ZigZag(x - x1);
+            sum[2] += ZigZag(x - 2 * x1 + x2);
+            x2 = x1;
+            x1 = x;
+        }
+        const int shift = used ? std::countr_zero(used) : 0;
+        const int order = int(std::min_element(std::begin(sum), std::end(sum)) - std::begin(sum));
+
+        // a local writer stays in registers, the output bytes may alias the referenced one
+        BitWriter w = writer;
+        w.Put(shift, 5);
+        w.Put(order, 2);
+
+        uint32_t residuals[c_partition];
+        x1 = x2 = 0;
+        for (size_t i = 0; i < values.size(); i += c_partition)
+        {
+            if (w.Remaining() < c_maxPartitionBytes)
+                return false;
+
+            const size_t n = std::min(c_partition, values.size() - i);
+            uint64_t total = 0;
+            for (size_t j = 0; j < n; ++j)
+            {
+                const auto x = uint32_t(values[i + j] >> shift);
+                residuals[j] = ZigZag(Residual(order, x, x1, x2));
+                total += residuals[j];
+                x2 = x1;
+                x1 = x;
+            }
+            const auto mean = total / n;
+            const int k = mean ? std::min(int(std::bit_width(mean)) - 1, 31) : 0;
+
+            w.Put(k, 5);
+            for (size_t j = 0; j < n; ++j)
+                w.PutRice(residuals[j], k);
+        }
+
+        writer = w;
+        return true;
+    }
+
+    template<size_t N>
+    size_t EncodeRice(const uint8_t* samples, size_t cnt, uint8_t* out, size_t capacity)
+    {
+        thread_local std::vector<int32_t> values;
+        values.resize(2 * cnt);
+        for (size_t i = 0; i < cnt; ++i)
+        {
+            values[i] = LoadValue<N>(samples + 2 * N * i);
+            values[cnt + i] = LoadValue<N>(samples + 2 * N * i + N);
+        }
+
+        out[0] = c_rice;
+        out[1] = uint8_t(N);
+        BitWriter w(out + c_riceHeadSize, capacity - c_riceHeadSize);
+        if (!EncodeChannel(w, std::span(values).first(cnt)) ||
+            !EncodeChannel(w, std::span(values).subspan(cnt)))
+            return 0;
+        return c_riceHeadSize + w.Flush();
+    }
+
+    // ========================================================================
+    // Packer
+
+    constexpr size_t c_packedHeadSize = 3;
+    constexpr size_t c_packGroup = 64;      // samples sharing the exponent
+
+    // Groups of an exponent byte and the I/Q values of bits each, LSB first.
+    // Every group but the last is a whole number of bytes.
+    size_t PackedSize(size_t cnt, int bits)
+    {
+        const size_t groups = (cnt + c_packGroup - 1) / c_packGroup;
+        return c_packedHeadSize + groups + (2 * cnt * bits + 7) / 8;
+    }
+
+    template<size_t N, int Bits>
+    uint8_t* PackGroup(const uint8_t* samples, size_t n, uint8_t* out)
+    {
+        constexpr int32_t c_max = (1 << (Bits - 1)) - 1;
+        constexpr int32_t c_min = -c_max - 1;
+
+        // the exponent makes the largest magnitude fit
+        uint32_t magnitude = 0;
+        for (size_t i = 0; i < 2 * n; ++i)
+        {
+            const auto v = LoadValue<N>(samples + N * i);
+            magnitude |= uint32_t(v ^ (v >> 31));
+        }
+        const int exponent = std::max(int(std::bit_width(magnitude)) + 1 - Bits, 0);
+        *out++ = uint8_t(exponent);
+
+        const int32_t half = exponent ? 1 << (exponent - 1) : 0;
+        uint64_t acc = 0;
+        int bits = 0;
+        for (size_t i = 0; i < 2 * n; ++i)
+        {
+            const auto v = int64_t(LoadValue<N>(samples + N * i));
+            const auto r = int32_t(std::clamp<int64_t>((v + half) >> exponent, c_min, c_max));
+            acc |= uint64_t(uint32_t(r) & ((1u << Bits) - 1)) << bits;
+            bits += Bits;
+            if (bits >= 32)
+            {
+                const auto word = uint32_t(acc);
+                std::memcpy(out, &word, 4);
+                out += 4;
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+        for (; bits > 0; bits -= 8)
+        {
+            *out++ = uint8_t(acc);
+            acc >>= 8;
+        }
+        return out;
+    }
+
+    template<size_t N, int Bits>
+    const uint8_t* UnpackGroup(const uint8_t* in, size_t n, uint8_t* out)
+    {
+        const int exponent = std::min<int>(*in++, 32 - Bits);
+
+        uint64_t acc = 0;
+        int bits = 0;
+        for (size_t i = 0; i < 2 * n; ++i)
+        {
+            if (bits < Bits)
+            {
+                uint32_t word;
+                std::memcpy(&word, in, 4);
+                in += 4;
+                acc |= uint64_t(word) << bits;
+                bits += 32;
+            }
+            const auto r = int32_t(uint32_t(acc) << (32 - Bits)) >> (32 - Bits);
+            acc >>= Bits;
+            bits -= Bits;
+            StoreValue<N>(out + N * i, uint32_t(r) << exponent);
+        }
+        // the bytes read ahead of the group end
+        return in - bits / 8;
+    }
+
+    template<size_t N, int Bits>
+    size_t Pack(const uint8_t* samples, size_t cnt, uint8_t* out)
+    {
+        auto* p = out + c_packedHeadSize;
+        for (size_t i = 0; i < cnt; i += c_packGroup)
+            p = PackGroup<N, Bits>(samples + 2 * N * i, std::min(c_packGroup, cnt - i), p);
+        out[0] = c_packed;
+        out[1] = uint8_t(N);
+        out[2] = uint8_t(Bits);
+        return p - out;
+    }
+
+    // The unpacker reads words, the coded data is copied to a padded buffer
+    template<size_t N, int Bits>
+    void Unpack(const uint8_t* coded, size_t cnt, uint8_t* out)
+    {
+        for (size_t i = 0; i < cnt; i += c_packGroup)
+            coded = UnpackGroup<N, Bits>(coded, std::min(c_packGroup, cnt - i), out + 2 * N * i);
+    }
+
+    // Instantiates f<N, Bits> for the run time value size and pack bits
+    template<size_t N, int Bits = c_minPackBits, typename F>
+    auto DispatchBits(int bits, F&& f)
+    {
+        if constexpr (Bits < c_maxPackBits)
+        {
+            if (bits != Bits)
+                return DispatchBits<N, Bits + 1>(bits, std::forward<F>(f));
+        }
+        return f.template operator()<N, Bits>();
+    }
+
+    template<typename F>
+    auto DispatchPacked(size_t valueSize, int bits, F&& f)
+    {
+        switch (valueSize)
+        {
+        case 1: return DispatchBits<1>(bits, std::forward<F>(f));
+        case 2: return DispatchBits<2>(bits, std::forward<F>(f));
+        case 3: return DispatchBits<3>(bits, std::forward<F>(f));
+        default: return DispatchBits<4>(bits, std::forward<F>(f));
+        }
+    }
+
+    // ========================================================================
+    // Decoder
+
+    template<size_t N>
+    void DecodeChannel(BitReader& r, size_t cnt, uint8_t* out)
+    {
+        r.Refill();
+        const int shift = r.Get(5);
+        const int order = std::min<int>(r.Get(2), c_maxOrder);
+
+        uint32_t x1 = 0, x2 = 0;
+        for (size_t i = 0; i < cnt; i += c_partition)
+        {
+            const size_t end = std::min(i + c_partition, cnt);
+            r.Refill();
+            const int k = r.Get(5);
+            for (size_t j = i; j < end; ++j)
+            {
+                r.Refill();
+                const auto res = UnZigZag(r.GetRice(k));
+                uint32_t x;
+                switch (order)
+                {
+                case 0: x = res; break;
+                case 1: x = x1 + res; break;
+                default: x = 2 * x1 - x2 + res; break;
+                }
+                x2 = x1;
+                x1 = x;
+                StoreValue<N>(out + 2 * N * j, x << shift);
+            }
+        }
+    }
+
+    template<size_t N>
+    bool DecodeRice(const uint8_t* coded, size_t codedSize, size_t cnt, uint8_t* out)
+    {
+        BitReader r(coded, codedSize);
+        DecodeChannel<N>(r, cnt, out);
+        DecodeChannel<N>(r, cnt, out + N);
+        return !r.Overrun();
+    }
+}
+
+namespace IQCodec
+{
+    bool IsValid(uint8_t kind)
+    {
+        return kind <= (uint8_t)Kind::Packed;
+    }
+
+    const char* Name(Kind kind)
+    {
+        switch (kind)
+        {
+        case Kind::None: return "none";
+        case Kind::Rice: return "rice";
+        case Kind::Packed: return "packed";
+        }
+        return "unknown";
+    }
+
+    size_t MaxCodedSize(size_t rawSize)
+    {
+        return rawSize + 1;
+    }
+
+    size_t Encode(const Config& config, const void* samples, size_t cnt, size_t sampleSize, size_t valueSize, uint8_t* out)
+    {
+        const size_t rawSize = cnt * sampleSize;
+        if (config.kind == Kind::None)
+        {
+            std::memcpy(out, samples, rawSize);
+            return rawSize;
+        }
+
+        const auto* p = static_cast<const uint8_t*>(samples);
+        const bool integers = cnt && valueSize >= 1 && valueSize <= 4 && sampleSize == 2 * valueSize;
+
+        // packing to the bits the values have is no use
+        if (config.kind == Kind::Packed && integers &&
+            config.packBits >= c_minPackBits && config.packBits < int(8 * valueSize) &&
+            PackedSize(cnt, config.packBits) <= rawSize)
+        {
+            return DispatchPacked(valueSize, config.packBits, [&]<size_t N, int Bits>() {
+                return Pack<N, Bits>(p, cnt, out);
+            });
+        }
+
+        // a block coded larger than it is gets stored
+        if (config.kind == Kind::Rice && integers)
+        {
+            const size_t capacity = MaxCodedSize(rawSize);
+            size_t size = 0;
+            switch (valueSize)
+            {
+            case 1: size = EncodeRice<1>(p, cnt, out, capacity); break;
+            case 2: size = EncodeRice<2>(p, cnt, out, capacity); break;
+            case 3: size = EncodeRice<3>(p, cnt, out, capacity); break;
+            case 4: size = EncodeRice<4>(p, cnt, out, capacity); break;
+            }
+            if (size && size <= rawSize)
+                return size;
+        }
+
+        out[0] = c_stored;
+        std::memcpy(out + 1, samples, rawSize);
+        return rawSize + 1;
+    }
+
+    bool Decode(Kind kind, const uint8_t* coded, size_t codedSize, size_t cnt, std::vector<uint8_t>& out)
+    {
+        if (kind == Kind::None)
+        {
+            out.assign(coded, coded + codedSize);
+            return true;
+        }
+
+        if (!codedSize)
+            return false;
+        if (coded[0] == c_stored)
+        {
+            out.assign(coded + 1, coded + codedSize);
+            return true;
+        }
+
+        if (coded[0] == c_packed)
+        {
+            if (codedSize < c_packedHeadSize)
+                return false;
+            const size_t valueSize = coded[1];
+            const int bits = coded[2];
+            if (valueSize < 1 || valueSize > 4 || bits < c_minPackBits || bits > c_maxPackBits ||
+                PackedSize(cnt, bits) != codedSize)
+                return false;
+
+            // the word reads of the last group stay within the padding
+            thread_local std::vector<uint8_t> padded;
+            padded.assign(coded + c_packedHeadSize, coded + codedSize);
+            padded.resize(padded.size() + 8);
+
+            out.resize(cnt * 2 * valueSize);
+            DispatchPacked(valueSize, bits, [&]<size_t N, int Bits>() {
+                Unpack<N, Bits>(padded.data(), cnt, out.data());
+            });
+            return true;
+        }
+
+        // every value takes a bit at least
+        if (coded[0] != c_rice || codedSize < c_riceHeadSize || cnt > codedSize * 4)
+            return false;
+
+        const size_t valueSize = coded[1];
+        if (valueSize < 1 || valueSize > 4)
+            return false;
+        out.resize(cnt * 2 * valueSize);
+        coded += c_riceHeadSize;
+        codedSize -= c_riceHeadSize;
+        switch (valueSize)
+        {
+        case 1: return DecodeRice<1>(coded, codedSize, cnt, out.data());
+        case 2: return DecodeRice<2>(coded, codedSize, cnt, out.data());
+        case 3: return DecodeRice<3>(coded, codedSize, cnt, out.data());
+        case 4: return DecodeRice<4>(coded, codedSize, cnt, out.data());
+        }
+        return false;
+    }
+}
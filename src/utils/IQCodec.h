@@ -0,0 +1,72 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace IQCodec
+{
+    // Codec of the raw IQ packet samples, negotiated by the Hello
+    // handshake. Values match ExtIO_TCP_Proto::IQCodecType.
+    enum class Kind : uint8_t
+    {
+        None = 0,       // the samples follow the RawIQHead as they are
+        Rice = 1,       // per channel linear prediction, Rice coded residuals
+        Packed = 2,     // values of packBits bits sharing an exponent per 64 samples,
+                        // lossless for the values having that many significant bits
+    };
+
+    constexpr int c_minPackBits = 4;
+    constexpr int c_maxPackBits = 24;
+
+    struct Config
+    {
+        Kind kind = Kind::None;
+        int packBits = 16;      // of the Packed codec
+    };
+
+    bool IsValid(uint8_t kind);
+    const char* Name(Kind kind);
+
+    struct Stats
+    {
+        uint64_t blocks = 0;
+        uint64_t rawBytes = 0;
+        uint64_t codedBytes = 0;
+        std::chrono::nanoseconds cpuTime{};
+
+        double Ratio() const { return codedBytes ? double(rawBytes) / codedBytes : 1.; }
+    };
+
+    // Size of the out buffer Encode requires for rawSize bytes of samples
+    size_t MaxCodedSize(size_t rawSize);
+
+    // Codes cnt samples of sampleSize bytes made of the I and Q little endian
+    // signed integers of valueSize bytes. A valueSize of 0 or the one not
+    // matching the sampleSize stores the samples as they are.
+    // Returns the coded size written to out.
+    size_t Encode(const Config& config, const void* samples, size_t cnt, size_t sampleSize, size_t valueSize, uint8_t* out);
+
+    // Restores cnt samples into out, false if the coded data is malformed
+    bool Decode(Kind kind, const uint8_t* coded, size_t codedSize, size_t cnt, std::vector<uint8_t>& out);
+}
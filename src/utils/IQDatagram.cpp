@@ -0,0 +1,466 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "stdafx.h"
+
+#include <random>
+
+#include "IQDatagram.h"
+#include "IsAlive.h"
+#include "log.h"
+
+namespace
+{
+    using namespace Protocol;
+    using udp = boost::asio::ip::udp;
+
+    constexpr uint32_t c_datagramMagic = 0x51494f4e; // "NOIQ"
+    // fits the 1500 bytes ethernet MTU with some room for VPN/PPPoE headers
+    constexpr size_t c_maxDatagramSize = 1400;
+    constexpr size_t c_maxDatagramPayload = c_maxDatagramSize - sizeof(IQDatagramHead);
+    constexpr size_t c_socketBufferSize = 4 * 1024 * 1024;
+    // longer gaps are skipped instead of being filled with zero blocks
+    constexpr size_t c_maxConcealedBlocks = 16;
+    // the receiver reassembles blocks up to the TCP frame size only
+    constexpr size_t c_maxBlockBytes = IConnection::c_maxFrameSize;
+
+    class IQDatagramSender : public IIQDatagramSender
+    {
+        IConnection::strand_type& _strand;
+        udp::socket _socket;
+        const udp::endpoint _remote;
+        const double _lossRate;
+        std::minstd_rand _random;
+        std::uniform_real_distribution<double> _uniform{ 0., 1. };
+        uint32_t _seq = 0;
+        uint64_t _sampleOffset = 0;
+        Stats _stats;
+        AliveInstance _inst;
+
+    public:
+
+        IQDatagramSender(IConnection::strand_type& strand, const udp::endpoint& remote, double lossPercent, int multicastTtl)
+            : _strand(strand)
+            , _socket(strand, udp::endpoint(remote.protocol(), 0))
+            , _remote(remote)
+            , _lossRate(lossPercent / 100.)
+            , _random(std::random_device{}())
+        {
+            _socket.non_blocking(true);
+            boost::system::error_code ec;
+            _socket.set_option(udp::socket::send_buffer_size(c_socketBufferSize), ec);
+            if (remote.address().is_multicast())
+                _socket.set_option(boost::asio::ip::multicast::hops(multicastTtl));
+
+            LOG(trace) << "IQ datagrams are sent from port " << LocalPort() << " to <" << _remote << ">.";
+        }
+
+        ~IQDatagramSender()
+        {
+            LOG(info) << "IQ datagram sender stats, blocks: " << _stats.blocks
+                << "; datagrams: " << _stats.datagrams
+                << "; injected losses: " << _stats.injectedLosses
+                << "; send errors: " << _stats.sendErrors;
+        }
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+        // IIQDatagramSender
+    private:
+
+        uint16_t LocalPort() const override
+        {
+            boost::system::error_code ec;
+            return _socket.local_endpoint(ec).port();
+        }
+
+        void AsyncSend(const IConnection::buffer_ptr& rawPacket, IConnection::CbT&& cb) override
+        {
+            Send(*rawPacket);
+
+            boost::asio::post(_strand, [cb = std::move(cb), a = AliveFlag()]() mutable {
+                if (!a.IsAlive()) return;
+                cb({});
+            });
+        }
+
+        Stats GetStats() const override
+        {
+            return _stats;
+        }
+
+    private:
+
+        void Send(const IConnection::buffer_type& rawPacket)
+        {
+            if (rawPacket.size() < sizeof(RawIQHead))
+                return;
+
+            auto& raw = *reinterpret_cast<const RawIQHead*>(rawPacket.data());
+            auto* samples = reinterpret_cast<const uint8_t*>(rawPacket.data()) + sizeof(RawIQHead);
+            const size_t bytes = rawPacket.size() - sizeof(RawIQHead);
+
+            if (raw.cnt <= 0 || bytes % raw.cnt)
+                return;
+
+            if (bytes > c_maxBlockBytes)
+            {
+                if (!_stats.sendErrors++)
+                    LOG(warning) << "IQ block of " << bytes << " bytes is too large for the datagrams, dropped.";
+                return;
+            }
+
+            IQDatagramHead head;
+            head.magic = c_datagramMagic;
+            head.sampleOffset = _sampleOffset + raw.droppedSamples;
+            head.cnt = raw.cnt;
+            head.status = raw.status;
+            head.IQoffs = raw.IQoffs;
+            head.sampleFormat = raw.sampleFormat;
+            head.sampleSize = (uint16_t)(bytes / raw.cnt);
+
+            _sampleOffset = head.sampleOffset + raw.cnt;
+            ++_stats.blocks;
+
+            // whole samples per datagram
+            const size_t step = c_maxDatagramPayload - c_maxDatagramPayload % head.sampleSize;
+
+            for (size_t offset = 0; offset < bytes; offset += step)
+            {
+                head.seq = _seq++;
+                head.byteOffset = (uint32_t)offset;
+
+                if (_lossRate > 0 && _uniform(_random) < _lossRate)
+                {
+                    ++_stats.injectedLosses;
+                    continue;
+                }
+
+                const std::array<boost::asio::const_buffer, 2> buffers = {
+                    boost::asio::buffer(&head, sizeof(head)),
+                    boost::asio::buffer(samples + offset, std::min(step, bytes - offset))
+                };
+
+                // the socket is non blocking, a full send buffer is a datagram loss
+                boost::system::error_code ec;
+                _socket.send_to(buffers, _remote, 0, ec);
+                if (ec.failed())
+                {
+                    if (!_stats.sendErrors++)
+                        LOG(trace) << "IQ datagram send failed: " << ec.message();
+                    continue;
+                }
+
+                ++_stats.datagrams;
+            }
+        }
+    };
+
+    class IQDatagramReceiver : public IIQDatagramReceiver
+    {
+        udp::socket _socket;
+        const std::optional<boost::asio::ip::address> _server;
+        udp::endpoint _sender;
+        std::vector<uint8_t> _rcvBuf;
+        BlockCbT _cb;
+
+        // the block being reassembled
+        std::vector<uint8_t> _block;
+        std::vector<uint64_t> _blockSamples;    // bitmap of the received samples
+        IQDatagramHead _blockHead;
+        size_t _blockReceived = 0;
+        bool _hasBlock = false;
+
+        bool _started = false;
+        uint32_t _nextSeq = 0;
+        uint64_t _nextSampleOffset = 0;
+        Stats _stats;
+        AliveInstance _inst;
+
+    public:
+
+        IQDatagramReceiver(IConnection::strand_type& strand, const boost::asio::ip::address& server)
+            : _socket(strand, udp::endpoint(server.is_v6() ? udp::v6() : udp::v4(), 0))
+            , _server(server)
+            , _rcvBuf(64 * 1024)
+        {
+            boost::system::error_code ec;
+            _socket.set_option(udp::socket::receive_buffer_size(c_socketBufferSize), ec);
+        }
+
+        IQDatagramReceiver(IConnection::strand_type& strand, const udp::endpoint& group, const boost::asio::ip::address& server)
+            : _socket(strand, group.protocol())
+            , _server(server)
+            , _rcvBuf(64 * 1024)
+        {
+            boost::system::error_code ec;
+            _socket.set_option(udp::socket::receive_buffer_size(c_socketBufferSize), ec);
+            _socket.set_option(udp::socket::reuse_address(true));
+            _socket.bind(udp::endpoint(group.protocol(), group.port()));
+            _socket.set_option(boost::asio::ip::multicast::join_group(group.address()));
+
+            LOG(trace) << "Joined IQ multicast group <" << group << ">.";
+        }
+
+        ~IQDatagramReceiver()
+        {
+            LOG(info) << "IQ datagram receiver stats, datagrams: " << _stats.datagrams
+                << "; lost: " << _stats.lostDatagrams
+                << "; late: " << _stats.lateDatagrams
+                << "; blocks: " << _stats.blocks
+                << "; concealed samples: " << _stats.concealedSamples
+                << "; skipped samples: " << _stats.skippedSamples;
+        }
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+        // IIQDatagramReceiver
+    private:
+
+        uint16_t LocalPort() const override
+        {
+            boost::system::error_code ec;
+            return _socket.local_endpoint(ec).port();
+        }
+
+        void Start(BlockCbT&& cb) override
+        {
+            _cb = std::move(cb);
+            AsyncReceive();
+        }
+
+        void Cancel() override
+        {
+            boost::system::error_code ec;
+            _socket.cancel(ec);
+            _cb = {};
+        }
+
+        Stats GetStats() const override
+        {
+            return _stats;
+        }
+
+    private:
+
+        void AsyncReceive()
+        {
+            _socket.async_receive_from(
+                boost::asio::buffer(_rcvBuf),
+                _sender,
+                [this, a = AliveFlag()](const boost::system::error_code& ec, std::size_t bytes_transferred)
+                {
+                    if (!a.IsAlive() || !_cb)
+                        return;
+
+                    if (ec.failed())
+                    {
+                        if (ec == boost::asio::error::operation_aborted)
+                            return;
+                        // ICMP port unreachable and alike are reported here on some systems
+                        LOG(trace) << "IQ datagram receive failed: " << ec.message();
+                    }
+                    else if (!_server || _sender.address() == *_server)
+                        OnDatagram(_rcvBuf.data(), bytes_transferred);
+
+                    AsyncReceive();
+                });
+        }
+
+        void OnDatagram(const uint8_t* data, size_t size)
+        {
+            if (size < sizeof(IQDatagramHead))
+                return;
+
+            IQDatagramHead head;
+            std::memcpy(&head, data, sizeof(head));
+            const size_t payload = size - sizeof(head);
+            const size_t blockBytes = (size_t)head.cnt * head.sampleSize;
+
+            // the sender splits blocks into whole samples, the host reads
+            // the block as cnt samples of its format
+            if (head.magic != c_datagramMagic || head.cnt <= 0 || head.sampleSize != SampleSize(head.sampleFormat) ||
+                blockBytes > c_maxBlockBytes || (size_t)head.byteOffset + payload > blockBytes ||
+                head.byteOffset % head.sampleSize || payload % head.sampleSize)
+                return;
+
+            ++_stats.datagrams;
+
+            if (!_started)
+            {
+                _started = true;
+                _nextSeq = head.seq;
+                _nextSampleOffset = head.sampleOffset;
+            }
+
+            const int32_t seqDiff = (int32_t)(head.seq - _nextSeq);
+            if (seqDiff < 0)
+            {
+                // the losses were counted already
+                ++_stats.lateDatagrams;
+                if (_stats.lostDatagrams)
+                    --_stats.lostDatagrams;
+            }
+            else
+            {
+                _stats.lostDatagrams += seqDiff;
+                _nextSeq = head.seq + 1;
+            }
+
+            if (_hasBlock && head.sampleOffset < _blockHead.sampleOffset)
+                return; // belongs to a delivered block
+
+            if (_hasBlock && head.sampleOffset != _blockHead.sampleOffset)
+                DeliverBlock();
+
+            // a datagram disagreeing with the open block is not of this stream
+            if (_hasBlock && (head.cnt != _blockHead.cnt || head.sampleSize != _blockHead.sampleSize ||
+                head.sampleFormat != _blockHead.sampleFormat))
+                return;
+
+            if (!_hasBlock)
+            {
+                if (head.sampleOffset < _nextSampleOffset)
+                    return; // belongs to a delivered block
+
+                ConcealGap(head);
+
+                _blockHead = head;
+                _block.assign(blockBytes, 0);
+                _blockSamples.assign((head.cnt + 63) / 64, 0);
+                _blockReceived = 0;
+                _hasBlock = true;
+            }
+
+            if ((size_t)head.byteOffset + payload > _block.size())
+                return;
+
+            std::memcpy(_block.data() + head.byteOffset, data + sizeof(head), payload);
+
+            // a duplicated datagram does not complete the block
+            const size_t first = head.byteOffset / head.sampleSize;
+            for (size_t i = first; i < first + payload / head.sampleSize; ++i)
+            {
+                const uint64_t bit = 1ull << (i % 64);
+                if (_blockSamples[i / 64] & bit)
+                    continue;
+                _blockSamples[i / 64] |= bit;
+                _blockReceived += head.sampleSize;
+            }
+
+            if (_blockReceived >= _block.size())
+                DeliverBlock();
+        }
+
+        // Fills the samples lost before the head block with zero blocks
+        void ConcealGap(const IQDatagramHead& head)
+        {
+            uint64_t gap = head.sampleOffset - _nextSampleOffset;
+            if (!gap)
+                return;
+
+            if (gap > c_maxConcealedBlocks * (uint64_t)head.cnt)
+            {
+                _stats.skippedSamples += gap;
+                _nextSampleOffset = head.sampleOffset;
+                return;
+            }
+
+            _block.assign((size_t)head.cnt * head.sampleSize, 0);
+
+            while (gap)
+            {
+                const int cnt = (int)std::min<uint64_t>(gap, head.cnt);
+                RawIQHead raw;
+                raw.cnt = cnt;
+                raw.status = head.status;
+                raw.IQoffs = head.IQoffs;
+                raw.sampleFormat = head.sampleFormat;
+
+                _stats.concealedSamples += cnt;
+                gap -= cnt;
+                _cb(raw, _block.data());
+            }
+
+            _nextSampleOffset = head.sampleOffset;
+        }
+
+        void DeliverBlock()
+        {
+            _hasBlock = false;
+
+            if (_blockReceived < _block.size())
+                _stats.concealedSamples += (_block.size() - _blockReceived) / _blockHead.sampleSize;
+
+            RawIQHead raw;
+            raw.cnt = _blockHead.cnt;
+            raw.status = _blockHead.status;
+            raw.IQoffs = _blockHead.IQoffs;
+            raw.sampleFormat = _blockHead.sampleFormat;
+
+            ++_stats.blocks;
+            _nextSampleOffset = _blockHead.sampleOffset + _blockHead.cnt;
+            _cb(raw, _block.data());
+        }
+    };
+}
+
+std::unique_ptr<IIQDatagramSender> MakeIQDatagramSender(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& remote,
+    double lossPercent/* = 0*/,
+    int multicastTtl/* = 1*/)
+{
+    return std::make_unique<IQDatagramSender>(strand, remote, lossPercent, multicastTtl);
+}
+
+std::unique_ptr<IIQDatagramReceiver> MakeIQDatagramReceiver(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::address& server)
+{
+    return std::make_unique<IQDatagramReceiver>(strand, server);
+}
+
+boost::asio::ip::address MulticastSourceAddress(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& group)
+{
+    // connecting a datagram socket selects the route without sending anything
+    boost::system::error_code ec;
+    boost::asio::ip::udp::socket socket(strand, group.protocol());
+    socket.connect(group, ec);
+    if (ec)
+        return {};
+    auto local = socket.local_endpoint(ec);
+    return ec ? boost::asio::ip::address{} : local.address();
+}
+
+std::unique_ptr<IIQDatagramReceiver> MakeIQMulticastReceiver(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& group,
+    const boost::asio::ip::address& server)
+{
+    return std::make_unique<IQDatagramReceiver>(strand, group, server);
+}
@@ -0,0 +1,117 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include "Connection.h"
+#include "Messages.h"
+
+// UDP data plane of the raw IQ stream. The TCP connection keeps carrying
+// requests and status blocks, data blocks are split into datagrams small
+// enough to pass the path MTU unfragmented. Every datagram carries its own
+// sequence number and the stream offset of its block, so the receiver
+// reassembles blocks, detects lost datagrams and conceals the gaps with zeros.
+
+#pragma pack(push)
+#pragma pack(1)
+struct IQDatagramHead
+{
+    uint32_t magic = 0;
+    uint32_t seq = 0;               // datagram sequence number
+    uint64_t sampleOffset = 0;      // stream offset of the first sample of the block
+    int32_t cnt = 0;                // samples in the block
+    int32_t status = 0;
+    float IQoffs = 0;
+    int32_t sampleFormat = 0;
+    uint16_t sampleSize = 0;
+    uint16_t reserved = 0;
+    uint32_t byteOffset = 0;        // offset of the datagram payload within the block samples
+};
+#pragma pack(pop)
+
+class IIQDatagramSender
+{
+public:
+
+    struct Stats
+    {
+        uint64_t blocks = 0;
+        uint64_t datagrams = 0;
+        uint64_t injectedLosses = 0;
+        uint64_t sendErrors = 0;
+    };
+
+    virtual ~IIQDatagramSender() = default;
+
+    virtual uint16_t LocalPort() const = 0;
+    // Sends the raw IQ packet made by Make_ExtIOCallback_RawPacket, cb is posted to the strand.
+    virtual void AsyncSend(const IConnection::buffer_ptr& rawPacket, IConnection::CbT&& cb) = 0;
+    virtual Stats GetStats() const = 0;
+};
+
+// lossPercent of the datagrams are dropped on purpose to test the receiver,
+// multicastTtl is used when the remote is a multicast group
+std::unique_ptr<IIQDatagramSender> MakeIQDatagramSender(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& remote,
+    double lossPercent = 0,
+    int multicastTtl = 1);
+
+class IIQDatagramReceiver
+{
+public:
+
+    struct Stats
+    {
+        uint64_t datagrams = 0;
+        uint64_t lostDatagrams = 0;
+        uint64_t lateDatagrams = 0;
+        uint64_t blocks = 0;
+        uint64_t concealedSamples = 0;
+        uint64_t skippedSamples = 0;    // gaps too long to be concealed
+    };
+
+    // Called with every reassembled block, IQdata is valid during the call only
+    using BlockCbT = std::move_only_function<void(const Protocol::RawIQHead& head, void* IQdata)>;
+
+    virtual ~IIQDatagramReceiver() = default;
+
+    virtual uint16_t LocalPort() const = 0;
+    virtual void Start(BlockCbT&& cb) = 0;
+    virtual void Cancel() = 0;
+    virtual Stats GetStats() const = 0;
+};
+
+// Only datagrams coming from the server address are accepted
+std::unique_ptr<IIQDatagramReceiver> MakeIQDatagramReceiver(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::address& server);
+
+// The address the datagrams to the group leave the host from, it is the one
+// of the multicast interface and not necessarily the one the clients connect to
+boost::asio::ip::address MulticastSourceAddress(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& group);
+
+// Joins the group, several receivers of the host may share the group port.
+// Only datagrams coming from the server address are accepted.
+std::unique_ptr<IIQDatagramReceiver> MakeIQMulticastReceiver(
+    IConnection::strand_type& strand,
+    const boost::asio::ip::udp::endpoint& group,
+    const boost::asio::ip::address& server);
@@ -0,0 +1,661 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "stdafx.h"
+
+#include <format>
+#include <random>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/named_semaphore.hpp>
+#ifdef _WIN32
+#include <boost/interprocess/windows_shared_memory.hpp>
+#else
+#include <boost/interprocess/shared_memory_object.hpp>
+#endif
+
+#include "LocalChannel.h"
+#include "IsAlive.h"
+#include "log.h"
+
+namespace
+{
+    namespace bip = boost::interprocess;
+
+    constexpr uint32_t c_ringMagic = 0x474e4952; // "RING"
+    constexpr size_t c_ringCapacity = 8 * 1024 * 1024;
+    constexpr uint32_t c_wrapMarker = UINT32_MAX;
+    // a full ring is retried after this period
+    constexpr auto c_ringFullRetry = std::chrono::milliseconds(1);
+    // the consumer thread checks for the stop request this often
+    constexpr auto c_waitTimeout = std::chrono::milliseconds(100);
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+    // Single producer single consumer ring of records placed in the shared memory.
+    // The positions grow monotonically, the record offset is position % capacity.
+    struct RingHead
+    {
+        uint32_t magic = 0;
+        uint32_t capacity = 0;
+        alignas(64) std::atomic<uint64_t> head = 0;             // written by the producer
+        alignas(64) std::atomic<uint64_t> tail = 0;             // written by the consumer
+        alignas(64) std::atomic<uint32_t> consumerWaiting = 0;  // the producer posts the semaphore if set
+    };
+
+    struct RecordHead
+    {
+        uint32_t size = 0;
+        uint32_t reserved = 0;
+    };
+
+    constexpr size_t RecordSize(size_t payload)
+    {
+        return (sizeof(RecordHead) + payload + 7) & ~size_t(7);
+    }
+
+    class Ring
+    {
+#ifdef _WIN32
+        bip::windows_shared_memory _shm;
+#else
+        bip::shared_memory_object _shm;
+#endif
+        bip::mapped_region _region;
+        std::unique_ptr<bip::named_semaphore> _wake;
+        const std::string _name;
+        const bool _owner;
+        RingHead* _head = nullptr;
+        uint8_t* _data = nullptr;
+
+    public:
+
+        // creates the ring
+        explicit Ring(const std::string& name)
+            : _name(name)
+            , _owner(true)
+        {
+            const size_t size = sizeof(RingHead) + c_ringCapacity;
+            // other users of the host must not read or corrupt the stream,
+            // the Windows default is the DACL of the process token already
+            bip::permissions perm;
+#ifdef _WIN32
+            _shm = bip::windows_shared_memory(bip::create_only, name.c_str(), bip::read_write, size, perm);
+#else
+            perm.set_permissions(0600);
+            _shm = bip::shared_memory_object(bip::create_only, name.c_str(), bip::read_write, perm);
+            _shm.truncate(size);
+#endif
+            _region = bip::mapped_region(_shm, bip::read_write);
+            _head = new (_region.get_address()) RingHead;
+            _head->capacity = c_ringCapacity;
+            _data = reinterpret_cast<uint8_t*>(_head + 1);
+            _wake = std::make_unique<bip::named_semaphore>(bip::create_only, WakeName().c_str(), 0, perm);
+            _head->magic = c_ringMagic;
+        }
+
+        // opens the ring created by the peer
+        Ring(const std::string& name, bip::open_only_t)
+            : _name(name)
+            , _owner(false)
+        {
+            _shm = decltype(_shm)(bip::open_only, name.c_str(), bip::read_write);
+            _region = bip::mapped_region(_shm, bip::read_write);
+            if (_region.get_size() < sizeof(RingHead))
+                throw std::runtime_error("Local channel is too small.");
+            _head = reinterpret_cast<RingHead*>(_region.get_address());
+            if (_head->magic != c_ringMagic || _head->capacity != c_ringCapacity ||
+                _region.get_size() < sizeof(RingHead) + _head->capacity)
+                throw std::runtime_error("Local channel is malformed.");
+            _data = reinterpret_cast<uint8_t*>(_head + 1);
+            _wake = std::make_unique<bip::named_semaphore>(bip::open_only, WakeName().c_str());
+        }
+
+        ~Ring()
+        {
+            _wake.reset();
+            if (_owner)
+            {
+                bip::named_semaphore::remove(WakeName().c_str());
+#ifndef _WIN32
+                bip::shared_memory_object::remove(_name.c_str());
+#endif
+            }
+        }
+
+        static size_t MaxPayload()
+        {
+            return c_ringCapacity / 4;
+        }
+
+        // Producer. Returns false if the ring is full.
+        bool Write(const IConnection::const_buffers_type& segments, size_t size)
+        {
+            const uint64_t tail = _head->tail.load(std::memory_order_acquire);
+            uint64_t pos = _head->head.load(std::memory_order_relaxed);
+            size_t off = pos % c_ringCapacity;
+            const size_t need = RecordSize(size);
+            const size_t pad = off + need > c_ringCapacity ? c_ringCapacity - off : 0;
+
+            if (pos + pad + need - tail > c_ringCapacity)
+                return false;
+
+            if (pad)
+            {
+                reinterpret_cast<RecordHead*>(_data + off)->size = c_wrapMarker;
+                pos += pad;
+                off = 0;
+            }
+
+            reinterpret_cast<RecordHead*>(_data + off)->size = (uint32_t)size;
+            uint8_t* p = _data + off + sizeof(RecordHead);
+            for (auto& s : segments)
+            {
+                std::memcpy(p, s.data(), s.size());
+                p += s.size();
+            }
+
+            _head->head.store(pos + need, std::memory_order_seq_cst);
+
+            if (_head->consumerWaiting.load(std::memory_order_seq_cst))
+                _wake->post();
+
+            return true;
+        }
+
+        // Consumer. Returns the payload of the oldest record, it stays valid until Pop().
+        // Throws if the producer wrote a record which does not fit the ring.
+        bool Peek(const void*& data, size_t& size)
+        {
+            for (;;)
+            {
+                const uint64_t pos = _head->tail.load(std::memory_order_relaxed);
+                const uint64_t head = _head->head.load(std::memory_order_acquire);
+                if (pos == head)
+                    return false;
+
+                const size_t off = pos % c_ringCapacity;
+                const auto rec = *reinterpret_cast<const RecordHead*>(_data + off);
+                if (rec.size == c_wrapMarker)
+                {
+                    _head->tail.store(pos + c_ringCapacity - off, std::memory_order_release);
+                    continue;
+                }
+
+                if (rec.size > c_ringCapacity - off - sizeof(RecordHead) || RecordSize(rec.size) > head - pos)
+                    throw std::runtime_error("Local channel record is malformed.");
+
+                data = _data + off + sizeof(RecordHead);
+                size = rec.size;
+                return true;
+            }
+        }
+
+        void Pop(size_t size)
+        {
+            const uint64_t pos = _head->tail.load(std::memory_order_relaxed);
+            _head->tail.store(pos + RecordSize(size), std::memory_order_release);
+        }
+
+        bool IsEmpty() const
+        {
+            return _head->tail.load(std::memory_order_relaxed) == _head->head.load(std::memory_order_seq_cst);
+        }
+
+        // Consumer. Blocks until a record is written or the timeout expires.
+        void Wait(std::chrono::milliseconds timeout)
+        {
+            _head->consumerWaiting.store(1, std::memory_order_seq_cst);
+            if (IsEmpty())
+                _wake->timed_wait(boost::posix_time::microsec_clock::universal_time() +
+                    boost::posix_time::milliseconds(timeout.count()));
+            _head->consumerWaiting.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+
+        std::string WakeName() const
+        {
+            return _name + "-wake";
+        }
+    };
+
+    class LocalChannelConnection : public IConnection
+    {
+        struct pending_write
+        {
+            const_buffers_type segments;
+            size_t size = 0;
+            buffer_ptr holder;
+            CbT cb;
+        };
+
+        // a packet which came from the connection while no handler was set
+        struct stashed_packet
+        {
+            boost::system::error_code ec;
+            PacketBuffer::PacketHead head;
+            std::vector<uint8_t> data;
+        };
+
+        IConnection::strand_type& _strand;
+        std::unique_ptr<IConnection> _tcp;
+        PacketCbT _handler;
+        bool _tcpReading = false;
+        std::deque<stashed_packet> _stashed;
+
+        // producer side
+        std::unique_ptr<Ring> _txRing;
+        std::deque<pending_write> _pendingWrites;
+        boost::asio::steady_timer _retryTimer;
+
+        // consumer side
+        std::unique_ptr<Ring> _rxRing;
+        std::thread _rxThread;
+        std::mutex _rxMx;
+        std::condition_variable _rxCv;
+        bool _rxDrainPosted = false;
+        bool _rxStop = false;
+
+        AliveInstance _inst;
+
+    public:
+
+        LocalChannelConnection(IConnection::strand_type& strand, std::unique_ptr<IConnection>&& tcp)
+            : _strand(strand)
+            , _tcp(std::move(tcp))
+            , _retryTimer(strand)
+        {}
+
+        ~LocalChannelConnection()
+        {
+            StopReceiving();
+        }
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+        // IConnection
+    private:
+
+        void Connect(std::string_view host, uint16_t port, CbT&& cb) override
+        {
+            _tcp->Connect(host, port, std::move(cb));
+        }
+
+        void Attach(boost::asio::ip::tcp::socket&& socket) override
+        {
+            _tcp->Attach(std::move(socket));
+        }
+
+        void Cancel() override
+        {
+            _retryTimer.cancel();
+            CloseLocalChannel();
+            _tcp->Cancel();
+        }
+
+        void Close() override
+        {
+            CloseLocalChannel();
+            _tcp->Close();
+        }
+
+        bool IsConnected() const override
+        {
+            return _tcp->IsConnected();
+        }
+
+        boost::asio::ip::tcp::endpoint RemoteEndpoint() const override
+        {
+            return _tcp->RemoteEndpoint();
+        }
+
+        void SetWriteBatchLimit(size_t bytes) override
+        {
+            _tcp->SetWriteBatchLimit(bytes);
+        }
+
+        void SetZeroCopyThreshold(size_t bytes) override
+        {
+            _tcp->SetZeroCopyThreshold(bytes);
+        }
+
+        void SetMaxFrameSize(size_t bytes) override
+        {
+            _tcp->SetMaxFrameSize(bytes);
+        }
+
+        void SetChecksum(Checksum::Kind kind) override
+        {
+            _tcp->SetChecksum(kind);
+        }
+
+        IBufferPool& GetBufferPool() override
+        {
+            return _tcp->GetBufferPool();
+        }
+
+        IConnection::strand_type& GetStrand() override
+        {
+            return _strand;
+        }
+
+        void AsyncDisconnect(CbT&& cb) override
+        {
+            CloseLocalChannel();
+            _tcp->AsyncDisconnect(std::move(cb));
+        }
+
+        IConnection::WriteStats GetWriteStats() const override
+        {
+            return _tcp->GetWriteStats();
+        }
+
+        IConnection::SocketWriteStats GetSocketWriteStats() const override
+        {
+            return _tcp->GetSocketWriteStats();
+        }
+
+        void AsyncWritePacket(const buffer_ptr& buf, Priority prio, CbT&& cb) override
+        {
+            if (!UseRing(buf->packet_type(), buf->size()))
+                return _tcp->AsyncWritePacket(buf, prio, std::move(cb));
+
+            QueueRingWrite({ { boost::asio::const_buffer(buf->data(), buf->size()) }, buf->size(), buf, std::move(cb) });
+        }
+
+        void AsyncWriteSegments(PacketBuffer::PacketType type, const_buffers_type&& segments, Priority prio, CbT&& cb) override
+        {
+            const size_t size = boost::asio::buffer_size(segments);
+            if (!UseRing(type, size))
+                return _tcp->AsyncWriteSegments(type, std::move(segments), prio, std::move(cb));
+
+            QueueRingWrite({ std::move(segments), size, {}, std::move(cb) });
+        }
+
+        void AsyncReadPackets(PacketCbT&& cb) override
+        {
+            assert(!_handler);
+            _handler = std::move(cb);
+
+            if (_stashed.empty())
+                StartTcpRead();
+            else
+            {
+                boost::asio::post(_strand, [this, a = AliveFlag()]() {
+                    if (!a.IsAlive()) return;
+                    DeliverStashed();
+                });
+            }
+
+            if (_rxRing)
+                ResumeReceiving();
+        }
+
+        std::string CreateLocalChannel() override
+        {
+            if (_txRing)
+                return {};
+
+            std::random_device rd;
+            const auto name = std::format("ExtIoOverNet-{:08x}{:08x}", rd(), rd());
+            try
+            {
+                _txRing = std::make_unique<Ring>(name);
+            }
+            catch (const std::exception& e)
+            {
+                LOG(warning) << "Cannot create local channel <" << name << ">: " << e.what();
+                return {};
+            }
+
+            LOG(trace) << "Local channel <" << name << "> is created.";
+            return name;
+        }
+
+        bool OpenLocalChannel(const std::string& name) override
+        {
+            if (_rxRing)
+                return false;
+
+            try
+            {
+                _rxRing = std::make_unique<Ring>(name, bip::open_only);
+            }
+            catch (const std::exception& e)
+            {
+                LOG(warning) << "Cannot open local channel <" << name << ">: " << e.what();
+                return false;
+            }
+
+            LOG(trace) << "Local channel <" << name << "> is opened.";
+
+            _rxStop = false;
+            _rxThread = std::thread([this]() { ReceiveThread(); });
+            return true;
+        }
+
+    private:
+
+        bool UseRing(PacketBuffer::PacketType type, size_t size) const
+        {
+            return _txRing && type == PacketBuffer::PacketType::RawData && size <= Ring::MaxPayload();
+        }
+
+        void StartTcpRead()
+        {
+            if (_tcpReading)
+                return;
+
+            _tcpReading = true;
+            _tcp->AsyncReadPackets([this, a = AliveFlag()](const boost::system::error_code& ec, const PacketView& packet) {
+                if (!a.IsAlive())
+                    return false;
+
+                if (!_handler)
+                {
+                    // the ring delivery took the handler, keep the packet for the next one
+                    auto& p = _stashed.emplace_back(ec, packet.head);
+                    p.data.assign((const uint8_t*)packet.data, (const uint8_t*)packet.data + packet.size);
+                    _tcpReading = false;
+                    return false;
+                }
+
+                _tcpReading = Deliver(ec, packet);
+                return _tcpReading;
+            });
+        }
+
+        void DeliverStashed()
+        {
+            while (_handler && !_stashed.empty())
+            {
+                auto p = std::move(_stashed.front());
+                _stashed.pop_front();
+                Deliver(p.ec, { p.head, p.data.data(), p.data.size() });
+            }
+
+            if (_handler)
+                StartTcpRead();
+        }
+
+        // Returns true while the handler wants the next packet
+        bool Deliver(const boost::system::error_code& ec, const PacketView& packet)
+        {
+            auto h = std::move(_handler);
+            if (!h)
+                return false;
+            const bool more = h(ec, packet);
+            if (more && !_handler)
+                _handler = std::move(h);
+            return (bool)_handler;
+        }
+
+        void CloseLocalChannel()
+        {
+            StopReceiving();
+            _rxRing.reset();
+
+            _txRing.reset();
+            auto pending = std::move(_pendingWrites);
+            for (auto& w : pending)
+                w.cb(boost::asio::error::operation_aborted);
+        }
+
+        // producer
+
+        void QueueRingWrite(pending_write&& w)
+        {
+            _pendingWrites.push_back(std::move(w));
+            if (_pendingWrites.size() == 1)
+                FlushRingWrites();
+        }
+
+        void FlushRingWrites()
+        {
+            while (!_pendingWrites.empty() && _txRing)
+            {
+                auto& w = _pendingWrites.front();
+                if (!_txRing->Write(w.segments, w.size))
+                {
+                    // the consumer is behind, the IQ queue limits apply meanwhile
+                    _retryTimer.expires_after(c_ringFullRetry);
+                    _retryTimer.async_wait([this, a = AliveFlag()](const boost::system::error_code& ec) {
+                        if (!a.IsAlive() || ec.failed())
+                            return;
+                        FlushRingWrites();
+                    });
+                    return;
+                }
+
+                boost::asio::post(_strand, [cb = std::move(w.cb), a = AliveFlag()]() mutable {
+                    if (!a.IsAlive()) return;
+                    cb({});
+                });
+                _pendingWrites.pop_front();
+            }
+        }
+
+        // consumer
+
+        // The thread sleeps on the ring semaphore, the records are delivered within the strand
+        void ReceiveThread()
+        {
+            std::unique_lock lock(_rxMx);
+            while (!_rxStop)
+            {
+                if (_rxDrainPosted)
+                {
+                    _rxCv.wait_for(lock, c_waitTimeout);
+                    continue;
+                }
+
+                if (_rxRing->IsEmpty())
+                {
+                    lock.unlock();
+                    _rxRing->Wait(c_waitTimeout);
+                    lock.lock();
+                    continue;
+                }
+
+                _rxDrainPosted = true;
+                boost::asio::post(_strand, [this, a = AliveFlag()]() {
+                    if (!a.IsAlive()) return;
+                    DrainRing();
+                });
+            }
+        }
+
+        void DrainRing()
+        {
+            const void* data = nullptr;
+            size_t size = 0;
+
+            for (;;)
+            {
+                try
+                {
+                    if (!_rxRing || !_handler || !_rxRing->Peek(data, size))
+                        break;
+                }
+                catch (const std::exception& e)
+                {
+                    // the stream can not be resynchronized, the session reconnects
+                    LOG(error) << e.what();
+                    CloseLocalChannel();
+                    Deliver(std::make_error_code(std::errc::bad_message), {});
+                    return;
+                }
+
+                PacketView view;
+                view.head.type = PacketBuffer::PacketType::RawData;
+                view.head.checksum = Checksum::Kind::None;
+                view.head.size = (uint32_t)size;
+                view.data = data;
+                view.size = size;
+
+                // the record is released after the handler returns
+                Deliver({}, view);
+                if (_rxRing)
+                    _rxRing->Pop(size);
+            }
+
+            // without a handler the thread waits for ResumeReceiving()
+            if (_handler)
+            {
+                std::scoped_lock _(_rxMx);
+                _rxDrainPosted = false;
+                _rxCv.notify_one();
+            }
+        }
+
+        void ResumeReceiving()
+        {
+            std::scoped_lock _(_rxMx);
+            if (!_rxDrainPosted)
+                return;
+            _rxDrainPosted = false;
+            _rxCv.notify_one();
+        }
+
+        void StopReceiving()
+        {
+            if (!_rxThread.joinable())
+                return;
+            {
+                std::scoped_lock _(_rxMx);
+                _rxStop = true;
+                _rxCv.notify_one();
+            }
+            _rxThread.join();
+            _rxDrainPosted = false;
+        }
+    };
+}
+
+std::unique_ptr<IConnection> MakeLocalChannelConnection(
+    IConnection::strand_type& strand,
+    std::unique_ptr<IConnection>&& tcp)
+{
+    return std::make_unique<LocalChannelConnection>(strand, std::move(tcp));
+}
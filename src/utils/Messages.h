@@ -19,23 +19,40 @@
 
 #pragma once
 
+#include "../ExtIO_API/LC_ExtIO_Types.h"
+#include "Connection.h"
+#include "BufferPool.h"
+#include "IQCodec.h"
 #include "Protocol.pb.h"
 
 namespace Protocol
 {
     constexpr uint32_t c_magicNum = 4378;
 
+#pragma pack(push)
+#pragma pack(1)
+    // Fixed sub-header of the PacketType::RawData packet.
+    // It is followed by cnt * SampleSize bytes of IQ samples
+    // or by their IQCodec coding negotiated by the Hello.
+    struct RawIQHead
+    {
+        int32_t cnt = 0;
+        int32_t status = 0;
+        float IQoffs = 0;
+        int32_t sampleFormat = 0;   // extHWtypeT of the samples
+        uint32_t droppedSamples = 0;    // samples dropped by the server before this block
+    };
+#pragma pack(pop)
+
+    // The version only, the sides fill the options of the RqsHello they send
     inline ExtIO_TCP_Proto::Message Make_Hello_Msg(
         uint64_t versionNumber,
         const std::string& clientVersionName)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsHello hello;
-        ExtIO_TCP_Proto::ProtocolVersion version;
+        auto& version = *msg.mutable_hello()->mutable_version();
         version.set_version_number(versionNumber);
         version.set_client_version_name(clientVersionName);
-        *hello.mutable_version() = version;
-        *msg.mutable_hello() = hello;
         return msg;
     }
 
@@ -46,12 +63,11 @@ namespace Protocol
         const std::optional<int>& type)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsInitHW inithw;
+        auto& inithw = *msg.mutable_inithw();
         if(result.has_value()) inithw.set_result(*result);
         if(name.has_value()) inithw.set_name(*name);
         if(model.has_value()) inithw.set_model(*model);
         if(type.has_value()) inithw.set_type(*type);
-        *msg.mutable_inithw() = inithw;
         return msg;
     }
 
@@ -59,9 +75,42 @@ namespace Protocol
         ExtIO_TCP_Proto::ErrorCode err)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsError error;
+        auto& error = *msg.mutable_error();
         error.set_error(err);
-        *msg.mutable_error() = error;
+        return msg;
+    }
+
+    inline ExtIO_TCP_Proto::Message Make_AttachControl_Msg(
+        const std::optional<uint64_t>& token,
+        const std::optional<ExtIO_TCP_Proto::ErrorCode>& result)
+    {
+        ExtIO_TCP_Proto::Message msg;
+        auto& attach = *msg.mutable_attachcontrol();
+        if (token.has_value()) attach.set_token(*token);
+        if (result.has_value()) attach.set_result(*result);
+        return msg;
+    }
+
+    inline ExtIO_TCP_Proto::Message Make_Ping_Msg(uint64_t seq, int64_t timestampUs)
+    {
+        ExtIO_TCP_Proto::Message msg;
+        auto& ping = *msg.mutable_ping();
+        ping.set_seq(seq);
+        ping.set_timestamp_us(timestampUs);
+        return msg;
+    }
+
+    // The enumeration tables are filled by the caller
+    inline ExtIO_TCP_Proto::Message Make_Capabilities_Msg(
+        const std::string& hwName,
+        const std::string& hwModel,
+        int32_t hwType)
+    {
+        ExtIO_TCP_Proto::Message msg;
+        auto& caps = *msg.mutable_capabilities();
+        caps.set_hw_name(hwName);
+        caps.set_hw_model(hwModel);
+        caps.set_hw_type(hwType);
         return msg;
     }
 
@@ -70,8 +119,7 @@ namespace Protocol
     {
         ExtIO_TCP_Proto::Message msg;
         if(err.has_value()) msg.set_resultcode(*err);
-        ExtIO_TCP_Proto::RqsLoadExtIOApi LoadAPI;
-        *msg.mutable_loadextioapi() = LoadAPI;
+        msg.mutable_loadextioapi();
         return msg;
     }
 
@@ -83,7 +131,6 @@ namespace Protocol
         size_t SampleSize)
     {
         auto msg = std::make_unique<ExtIO_TCP_Proto::Message>();
-        ExtIO_TCP_Proto::RqsExtIOCallback ExtIOCallback;
         auto& data = *msg->mutable_extiocallback();
         data.set_status(status);
         data.set_iqoffs(IQoffs);
@@ -98,13 +145,82 @@ namespace Protocol
         return msg;
     }
 
+    inline IConnection::buffer_ptr Make_ExtIOCallback_RawPacket(
+        IBufferPool& pool,
+        int cnt,
+        int status,
+        float IQoffs,
+        void* IQdata,
+        size_t SampleSize,
+        int sampleFormat,
+        const IQCodec::Config& codec = {},
+        size_t valueSize = 0)
+    {
+        const size_t dataSize = (cnt > 0 && IQdata) ? static_cast<size_t>(cnt) * SampleSize : 0;
+        const size_t maxSize = (dataSize && codec.kind != IQCodec::Kind::None) ? IQCodec::MaxCodedSize(dataSize) : dataSize;
+        auto buf = pool.Acquire(sizeof(RawIQHead) + maxSize);
+        buf->set_packet_type(PacketBuffer::PacketType::RawData);
+        buf->resize(sizeof(RawIQHead) + maxSize);
+        auto& head = *reinterpret_cast<RawIQHead*>(buf->data());
+        head.cnt = cnt;
+        head.status = status;
+        head.IQoffs = IQoffs;
+        head.sampleFormat = sampleFormat;
+        if (dataSize)
+        {
+            auto* samples = reinterpret_cast<uint8_t*>(buf->data()) + sizeof(RawIQHead);
+            buf->resize(sizeof(RawIQHead) + IQCodec::Encode(codec, IQdata, cnt, SampleSize, valueSize, samples));
+        }
+        return buf;
+    }
+
+    // Bytes of an IQ sample of the extHWtypeT format, 0 for an unknown one
+    inline size_t SampleSize(int sampleFormat)
+    {
+        switch (sampleFormat)
+        {
+        case exthwUSBdata16:
+            return 4;
+        case exthwFullPCM32:
+        case exthwUSBdata32:
+        case exthwUSBfloat32:
+            return 8;
+        case exthwUSBdata24:
+            return 6;
+        case exthwUSBdataU8:
+        case exthwUSBdataS8:
+            return 2;
+        }
+        return 0;
+    }
+
+    // Returns the sub-header of the raw IQ packet or nullptr if the packet is malformed.
+    // The samples of an uncoded packet have to fill it exactly, the host reads cnt of them,
+    // the coded ones are checked by IQCodec::Decode.
+    inline const RawIQHead* Parse_ExtIOCallback_RawPacket(
+        const PacketView& packet, void*& IQdata, IQCodec::Kind codec = IQCodec::Kind::None)
+    {
+        IQdata = nullptr;
+        if (packet.head.type != PacketBuffer::PacketType::RawData || packet.size < sizeof(RawIQHead))
+            return nullptr;
+        auto* head = reinterpret_cast<const RawIQHead*>(packet.data);
+        if (head->cnt > 0 && codec == IQCodec::Kind::None)
+        {
+            const size_t sampleSize = SampleSize(head->sampleFormat);
+            if (!sampleSize || packet.size - sizeof(RawIQHead) != (size_t)head->cnt * sampleSize)
+                return nullptr;
+        }
+        if (packet.size > sizeof(RawIQHead))
+            IQdata = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(packet.data) + sizeof(RawIQHead));
+        return head;
+    }
+
     inline ExtIO_TCP_Proto::Message Make_OpenHW_Msg(const std::optional<bool>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsOpenHW OpenHW;
+        auto& OpenHW = *msg.mutable_openhw();
         if (result.has_value())
             OpenHW.set_result(*result);
-        *msg.mutable_openhw() = OpenHW;
         return msg;
     }
 
@@ -113,10 +229,9 @@ namespace Protocol
         const std::optional<int32_t>& LOfreq)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsSetHWLO SetHWLO;
+        auto& SetHWLO = *msg.mutable_sethwlo();
         if (result.has_value()) SetHWLO.set_result(*result);
         if (LOfreq.has_value()) SetHWLO.set_lofreq(*LOfreq);
-        *msg.mutable_sethwlo() = SetHWLO;
         return msg;
     }
 
@@ -125,10 +240,9 @@ namespace Protocol
         const std::optional<int64_t>& LOfreq)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsSetHWLO64 SetHWLO;
+        auto& SetHWLO = *msg.mutable_sethwlo64();
         if (result.has_value()) SetHWLO.set_result(*result);
         if (LOfreq.has_value()) SetHWLO.set_lofreq(*LOfreq);
-        *msg.mutable_sethwlo64() = SetHWLO;
         return msg;
     }
 
@@ -136,9 +250,8 @@ namespace Protocol
         const std::optional<int32_t>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsGetHWSR GetHWSR;
+        auto& GetHWSR = *msg.mutable_gethwsr();
         if (result.has_value()) GetHWSR.set_result(*result);
-        *msg.mutable_gethwsr() = GetHWSR;
         return msg;
     }
 
@@ -147,10 +260,9 @@ namespace Protocol
         const std::optional<int32_t>& extLOfreq)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsStartHW StartHW;
+        auto& StartHW = *msg.mutable_starthw();
         if (result.has_value()) StartHW.set_result(*result);
         if (extLOfreq.has_value()) StartHW.set_extlofreq(*extLOfreq);
-        *msg.mutable_starthw() = StartHW;
         return msg;
     }
 
@@ -159,8 +271,7 @@ namespace Protocol
     {
         ExtIO_TCP_Proto::Message msg;
         if (err.has_value()) msg.set_resultcode(*err);
-        ExtIO_TCP_Proto::RqsStopHW StopHW;
-        *msg.mutable_stophw() = StopHW;
+        msg.mutable_stophw();
         return msg;
     }
 
@@ -170,11 +281,10 @@ namespace Protocol
         const std::optional<int32_t>& ver_minor)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsVersionInfo VersionInfo;
+        auto& VersionInfo = *msg.mutable_versioninfo();
         if (progname.has_value()) VersionInfo.set_progname(*progname);
         if (ver_major.has_value()) VersionInfo.set_ver_major(*ver_major);
         if (ver_minor.has_value()) VersionInfo.set_ver_minor(*ver_minor);
-        *msg.mutable_versioninfo() = VersionInfo;
         return msg;
     }
 
@@ -184,11 +294,10 @@ namespace Protocol
         const std::optional<float>& attenuation)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsGetAttenuators thisMsg;
+        auto& thisMsg = *msg.mutable_getattenuators();
         if (result.has_value()) thisMsg.set_result(*result);
         if (atten_idx.has_value()) thisMsg.set_atten_idx(*atten_idx);
         if (attenuation.has_value()) thisMsg.set_attenuation(*attenuation);
-        *msg.mutable_getattenuators() = thisMsg;
         return msg;
     }
 
@@ -196,9 +305,8 @@ namespace Protocol
         const std::optional<int32_t>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsGetActualAttIdx thisMsg;
+        auto& thisMsg = *msg.mutable_getactualattidx();
         if (result.has_value()) thisMsg.set_result(*result);
-        *msg.mutable_getactualattidx() = thisMsg;
         return msg;
     }
 
@@ -207,34 +315,30 @@ namespace Protocol
         const std::optional<int32_t>& agc_idx)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoShowMGC thisMsg;
+        auto& thisMsg = *msg.mutable_extioshowmgc();
         if (result.has_value()) thisMsg.set_result(*result);
         if (agc_idx.has_value()) thisMsg.set_agc_idx(*agc_idx);
-        *msg.mutable_extioshowmgc() = thisMsg;
         return msg;
     }
 
     inline ExtIO_TCP_Proto::Message Make_ShowGUI_Msg()
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsShowGUI thisMsg;
-        *msg.mutable_showgui() = thisMsg;
+        msg.mutable_showgui();
         return msg;
     }
 
     inline ExtIO_TCP_Proto::Message Make_HideGUI_Msg()
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsHideGUI thisMsg;
-        *msg.mutable_hidegui() = thisMsg;
+        msg.mutable_hidegui();
         return msg;
     }
 
     inline ExtIO_TCP_Proto::Message Make_SwitchGUI_Msg()
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsSwitchGUI thisMsg;
-        *msg.mutable_switchgui() = thisMsg;
+        msg.mutable_switchgui();
         return msg;
     }
 
@@ -244,11 +348,10 @@ namespace Protocol
         const std::optional<std::string>& text)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetAGCs thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetagcs();
         if (result.has_value()) thisMsg.set_result(*result);
         if (agc_idx.has_value()) thisMsg.set_agc_idx(*agc_idx);
         if (text.has_value()) thisMsg.set_text(*text);
-        *msg.mutable_extiogetagcs() = thisMsg;
         return msg;
     }
 
@@ -256,9 +359,8 @@ namespace Protocol
         const std::optional<int32_t>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetActualAGCidx thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetactualagcidx();
         if (result.has_value()) thisMsg.set_result(*result);
-        *msg.mutable_extiogetactualagcidx() = thisMsg;
         return msg;
     }
 
@@ -268,11 +370,10 @@ namespace Protocol
         const std::optional<float>& gain)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetMGCs thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetmgcs();
         if (result.has_value()) thisMsg.set_result(*result);
         if (mgc_idx.has_value()) thisMsg.set_mgc_idx(*mgc_idx);
         if (gain.has_value()) thisMsg.set_gain(*gain);
-        *msg.mutable_extiogetmgcs() = thisMsg;
         return msg;
     }
 
@@ -280,9 +381,8 @@ namespace Protocol
         const std::optional<int32_t>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetActualMgcIdx thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetactualmgcidx();
         if (result.has_value()) thisMsg.set_result(*result);
-        *msg.mutable_extiogetactualmgcidx() = thisMsg;
         return msg;
     }
 
@@ -292,11 +392,10 @@ namespace Protocol
         const std::optional<double>& samplerate)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetSrates thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetsrates();
         if (result.has_value()) thisMsg.set_result(*result);
         if (srate_idx.has_value()) thisMsg.set_srate_idx(*srate_idx);
         if (samplerate.has_value()) thisMsg.set_samplerate(*samplerate);
-        *msg.mutable_extiogetsrates() = thisMsg;
         return msg;
     }
 
@@ -304,9 +403,8 @@ namespace Protocol
         const std::optional<int32_t>& result)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetActualSrateIdx thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetactualsrateidx();
         if (result.has_value()) thisMsg.set_result(*result);
-        *msg.mutable_extiogetactualsrateidx() = thisMsg;
         return msg;
     }
 
@@ -315,10 +413,9 @@ namespace Protocol
         const std::optional<int32_t>& srate_idx)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoSetSrate thisMsg;
+        auto& thisMsg = *msg.mutable_extiosetsrate();
         if (result.has_value()) thisMsg.set_result(*result);
         if (srate_idx.has_value()) thisMsg.set_srate_idx(*srate_idx);
-        *msg.mutable_extiosetsrate() = thisMsg;
         return msg;
     }
 
@@ -327,10 +424,26 @@ namespace Protocol
         const std::optional<int32_t>& srate_idx)
     {
         ExtIO_TCP_Proto::Message msg;
-        ExtIO_TCP_Proto::RqsExtIoGetBandwidth thisMsg;
+        auto& thisMsg = *msg.mutable_extiogetbandwidth();
         if (result.has_value()) thisMsg.set_result(*result);
         if (srate_idx.has_value()) thisMsg.set_srate_idx(*srate_idx);
-        *msg.mutable_extiogetbandwidth() = thisMsg;
+        return msg;
+    }
+
+    inline ExtIO_TCP_Proto::Message Make_SetDDC_Msg(
+        const std::optional<bool>& enabled,
+        const std::optional<double>& offsetHz,
+        const std::optional<uint32_t>& decimation,
+        const std::optional<ExtIO_TCP_Proto::ErrorCode>& result,
+        const std::optional<int64_t>& samplerate)
+    {
+        ExtIO_TCP_Proto::Message msg;
+        auto& thisMsg = *msg.mutable_setddc();
+        if (enabled.has_value()) thisMsg.set_enabled(*enabled);
+        if (offsetHz.has_value()) thisMsg.set_offset_hz(*offsetHz);
+        if (decimation.has_value()) thisMsg.set_decimation(*decimation);
+        if (result.has_value()) thisMsg.set_result(*result);
+        if (samplerate.has_value()) thisMsg.set_samplerate(*samplerate);
         return msg;
     }
 }
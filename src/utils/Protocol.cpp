@@ -18,79 +18,130 @@
  *****************************************************************************/
 
 #include "Protocol.h"
+#include "BufferPool.h"
 
 #include "AtScopeExit.h"
 #include "IsAlive.h"
 
 #include "log.h"
 
+#include <google/protobuf/wire_format_lite.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <queue>
+
 namespace
 {
     namespace ProtoBuf = ExtIO_TCP_Proto;
     using namespace Protocol;
     using namespace boost;
 
-    class Stream : public google::protobuf::io::ZeroCopyOutputStream
-    {
-        IConnection::buffer_type& buf;
-        int64_t bytesWritten = 0;
+    // Messages of this size and larger are scanned for the IQ data to alias it
+    constexpr size_t c_aliasingThreshold = 4 * 1024;
+    // Received messages are parsed into it, the IQ data aside they fit without an allocation
+    constexpr size_t c_parseArenaSize = 4 * 1024;
 
-    public:
+    // Field numbers of the IQ data bytes within a package
+    constexpr int c_iqDataPath[] = {
+        ExtIO_TCP_Proto::PackagedMessage::kMsgFieldNumber,
+        ExtIO_TCP_Proto::Message::kExtIOCallbackFieldNumber,
+        ExtIO_TCP_Proto::RqsExtIOCallback::kIQdataFieldNumber,
+    };
 
-        bool Next(void** data, int* size) override
-        {
-            *data = buf.data();
-            *size = (int)buf.size();
-            bytesWritten += *size;
-            return true;
-        }
+    // Copies the message fields from in to out except the length delimited field
+    // at the end of the path, its bytes are returned as a span of the input buffer.
+    // The path messages are copied without the field, scratch keeps their fields.
+    bool StripField(
+        google::protobuf::io::CodedInputStream& in,
+        std::span<const int> path,
+        std::span<std::string> scratch,
+        std::string& out,
+        std::span<const uint8_t>& field)
+    {
+        using google::protobuf::internal::WireFormatLite;
 
-        void BackUp(int count) override
-        {
-            buf.resize(buf.size() - count);
-            bytesWritten -= count;
-        }
+        google::protobuf::io::StringOutputStream stream(&out);
+        google::protobuf::io::CodedOutputStream os(&stream);
 
-        int64_t ByteCount() const override
+        while (const uint32_t tag = in.ReadTag())
         {
-            return bytesWritten;
-        }
-
-    public:
+            if (WireFormatLite::GetTagFieldNumber(tag) != path.front() ||
+                WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED)
+            {
+                if (!WireFormatLite::SkipField(&in, tag, &os))
+                    return false;
+                continue;
+            }
 
-        Stream(IConnection::buffer_type& _buf)
-            : buf(_buf)
-        {
+            uint32_t length = 0;
+            if (!in.ReadVarint32(&length))
+                return false;
 
-        }
-    };
+            if (path.size() == 1)
+            {
+                const void* data = nullptr;
+                int size = 0;
+                if (!in.GetDirectBufferPointer(&data, &size) || (uint32_t)size < length)
+                    return false;
+                field = { (const uint8_t*)data, length };
+                in.Skip((int)length);
+                continue;
+            }
 
-    void SerializePackage(const ExtIO_TCP_Proto::PackagedMessage& pkg, IConnection::buffer_type& buf)
-    {
-        assert(pkg.IsInitialized());
-        buf.resize(pkg.ByteSizeLong());
-        Stream s(buf);
-        google::protobuf::io::CodedOutputStream os(&s);
-        pkg.SerializeToCodedStream(&os);
-        buf.resize(s.ByteCount());
-    }
+            auto& inner = scratch.front();
+            inner.clear();
+            const auto limit = in.PushLimit((int)length);
+            if (!StripField(in, path.subspan(1), scratch.subspan(1), inner, field))
+                return false;
+            in.PopLimit(limit);
 
-    void DeserializePackage(ExtIO_TCP_Proto::PackagedMessage& pkg, const IConnection::buffer_type& buf)
-    {
-        google::protobuf::io::CodedInputStream in((const uint8_t*)buf.data(), buf.size());
-        pkg.MergeFromCodedStream(&in);
+            os.WriteTag(tag);
+            os.WriteVarint32((uint32_t)inner.size());
+            os.WriteString(inner);
+        }
+        return in.BytesUntilLimit() == 0;
     }
 
     class ProtoImpl : public Protocol::IParser
     {
-        using RequestMapT = std::map<int64_t, OnMsgCb_T>;
+        using clock = std::chrono::steady_clock;
+
+        struct pending_request
+        {
+            OnMsgCb_T handler;
+            clock::time_point deadline = clock::time_point::max();
+        };
+        using RequestMapT = std::map<int64_t, pending_request>;
+
+        // Deadlines of the requests, the earliest first. The entries of the
+        // answered requests are left in and skipped when they come out.
+        using DeadlineT = std::pair<clock::time_point, int64_t>;
+        using DeadlineHeapT = std::priority_queue<DeadlineT, std::vector<DeadlineT>, std::greater<>>;
 
         IConnection& _connection;
 
-        std::atomic_int _readIsInProgress = 0;
+        bool _readIsInProgress = false;
         int64_t _nextDialogId = 0;
         RequestMapT _requestMap;
+        DeadlineHeapT _deadlines;
+        boost::asio::steady_timer _deadlineTimer;
+        std::optional<clock::time_point> _deadlineTimerExpiry;
         OnMsgCb_T _requestHandler;
+        OnRawDataCb_T _rawDataHandler;
+
+        // The package being handled and its IQ data aliasing the receive buffer
+        std::array<char, c_parseArenaSize> _arenaBlock;
+        google::protobuf::Arena _arena;
+        std::array<std::string, std::size(c_iqDataPath)> _stripScratch;
+        std::span<const uint8_t> _aliasedIQData;
+
+        std::optional<boost::asio::steady_timer> _heartbeatTimer;
+        OnLinkStatsCb_T _linkStatsHandler;
+        LinkStats _linkStats;
+        clock::time_point _lastPong;
+        clock::time_point _lastHeartbeat;
+        // socket writes at the previous heartbeat
+        IConnection::SocketWriteStats _lastSocketWrites;
 
         AliveInstance _inst;
 
@@ -98,6 +149,8 @@ namespace
 
         ProtoImpl(IConnection& connection)
             : _connection(connection)
+            , _deadlineTimer(connection.GetStrand())
+            , _arena(_arenaBlock.data(), _arenaBlock.size())
         {
 
         }
@@ -125,7 +178,8 @@ namespace
             return _nextDialogId;
         }
 
-        void AddReadHandler(int64_t dialogId, OnMsgCb_T&& handler)
+        void AddReadHandler(int64_t dialogId, OnMsgCb_T&& handler,
+            clock::time_point deadline = clock::time_point::max())
         {
             if (dialogId == 0)
             {
@@ -134,32 +188,100 @@ namespace
             else
             {
                 assert(_requestMap.find(dialogId) == _requestMap.end());
-                _requestMap[dialogId] = std::move(handler);
+                _requestMap[dialogId] = { std::move(handler), deadline };
+                if (deadline != clock::time_point::max())
+                    AddDeadline(deadline, dialogId);
             }
 
             if (!_readIsInProgress)
+                StartNextRead();
+        }
+
+        // Calls the handler of the request with the error unless it has been called already
+        void CompleteRequest(int64_t dialogId, const boost::system::error_code& ec)
+        {
+            auto it = _requestMap.find(dialogId);
+            if (it == _requestMap.end())
+                return;
+            auto handler = std::move(it->second.handler);
+            _requestMap.erase(it);
+            handler(ec, {}, dialogId);
+        }
+
+        void AddDeadline(clock::time_point deadline, int64_t dialogId)
+        {
+            _deadlines.emplace(deadline, dialogId);
+
+            // the requests mostly share the timeout, the timer is armed already then
+            if (_deadlineTimerExpiry && *_deadlineTimerExpiry <= deadline + c_deadlineResolution)
+                return;
+            StartDeadlineTimer(deadline);
+        }
+
+        void StartDeadlineTimer(clock::time_point expiry)
+        {
+            _deadlineTimerExpiry = expiry;
+            _deadlineTimer.expires_at(expiry);
+            _deadlineTimer.async_wait([this, a = AliveFlag()](const boost::system::error_code& ec) {
+                if (!a.IsAlive() || ec == boost::asio::error::operation_aborted)
+                    return;
+                OnDeadlineTimer();
+            });
+        }
+
+        void OnDeadlineTimer()
+        {
+            _deadlineTimerExpiry.reset();
+
+            const auto now = clock::now();
+            while (!_deadlines.empty() && _deadlines.top().first <= now)
             {
-                auto packet = std::make_shared<IConnection::buffer_type>();
-                AsyncReadPacket(
-                    packet,
-                    [this, packet, a = AliveFlag()](const boost::system::error_code& ec)
-                    {
-                        if (!a.IsAlive())
-                            return;
-                        OnAsyncReadDone(ec, packet); 
-                    }
-                );
+                const auto [deadline, did] = _deadlines.top();
+                _deadlines.pop();
+
+                auto it = _requestMap.find(did);
+                if (it == _requestMap.end() || it->second.deadline != deadline)
+                    continue;
+
+                LOG(trace) << "Request [" << did << "] timed out.";
+                CompleteRequest(did, boost::asio::error::timed_out);
             }
+
+            if (_deadlines.empty())
+                return;
+            // a handler may have armed the timer sending a new request
+            const auto next = std::max(_deadlines.top().first, now + c_deadlineResolution);
+            if (!_deadlineTimerExpiry || *_deadlineTimerExpiry > next)
+                StartDeadlineTimer(next);
+        }
+
+        bool HasReadHandlers() const
+        {
+            return _requestHandler || _requestMap.size() || _rawDataHandler;
         }
 
-        void OnAsyncReadDone(const boost::system::error_code& ec, IConnection::buffer_ptr buf)
+        void StartNextRead()
+        {
+            _readIsInProgress = true;
+            _connection.AsyncReadPackets(
+                [this, a = AliveFlag()](const boost::system::error_code& ec, const PacketView& packet)
+                {
+                    if (!a.IsAlive())
+                        return false;
+                    return OnPacketReceived(ec, packet);
+                }
+            );
+        }
+
+        // Returns true while the next packet is awaited
+        bool OnPacketReceived(const boost::system::error_code& ec, const PacketView& packet)
         {
-            assert(_readIsInProgress>0);
-            --_readIsInProgress;
             bool handled = false;
 
             if (ec.failed())
             {
+                _readIsInProgress = false;
+
                 if (_requestHandler)
                 {
                     _requestHandler(ec, {}, 0);
@@ -169,21 +291,45 @@ namespace
                 else if (_requestMap.size())
                 {
                     auto it = _requestMap.begin();
-                    it->second(ec, {}, 0);
+                    it->second.handler(ec, {}, 0);
                     _requestMap.erase(it->first);
                     handled = true;
                 }
+                else if (_rawDataHandler)
+                {
+                    _rawDataHandler(ec, {});
+                    _rawDataHandler = {};
+                    handled = true;
+                }
+
+                if (!_readIsInProgress && HasReadHandlers())
+                    StartNextRead();
+                return false;
+            }
+            else if (packet.head.type == PacketBuffer::PacketType::RawData)
+            {
+                if (_rawDataHandler)
+                    _rawDataHandler(ec, packet);
+                else
+                    LOG(trace) << "Unhandled raw data packet, size: " << packet.size;
             }
             else
             {
-                assert(buf->packet_type() != PacketBuffer::PacketType::RawData);
-
-                ExtIO_TCP_Proto::PackagedMessage pkg;
-                DeserializePackage(pkg, *buf);
+                auto& pkg = *google::protobuf::Arena::CreateMessage<ExtIO_TCP_Proto::PackagedMessage>(&_arena);
+                AtScopeExit release([this]() {
+                    _aliasedIQData = {};
+                    _arena.Reset();
+                });
+                DeserializePackage(pkg, packet);
 
                 const int64_t did = pkg.dialog_id();
 
-                if (did == 0 || pkg.type() == ExtIO_TCP_Proto::MsgType::Request)
+                if (pkg.msg().has_ping())
+                {
+                    OnPing(pkg.type(), pkg.msg().ping());
+                    handled = true;
+                }
+                else if (did == 0 || pkg.type() == ExtIO_TCP_Proto::MsgType::Request)
                 {
                     if (_requestHandler)
                     {
@@ -196,10 +342,14 @@ namespace
                     auto it = _requestMap.find(did);
                     if (it != _requestMap.end())
                     {
-                        it->second(ec, pkg.msg(), did);
+                        it->second.handler(ec, pkg.msg(), did);
                         _requestMap.erase(it->first);
-                        handled = true;
                     }
+                    else
+                    {
+                        LOG(trace) << "Responce [" << did << "] of a timed out or cancelled request is dropped.";
+                    }
+                    handled = true;
                 }
 
                 if(!handled)
@@ -208,31 +358,131 @@ namespace
                 }
             }
 
-            if (_requestHandler || _requestMap.size())
+            _readIsInProgress = HasReadHandlers();
+            return _readIsInProgress;
+        }
+
+        // A large package is parsed without its IQ data bytes, they are left in
+        // the receive buffer and handed out by GetAliasedIQData.
+        void DeserializePackage(ExtIO_TCP_Proto::PackagedMessage& pkg, const PacketView& packet)
+        {
+            if (packet.size >= c_aliasingThreshold)
             {
-                auto packet = std::make_shared<IConnection::buffer_type>();
-                AsyncReadPacket(
-                    packet,
-                    [this, packet, a = AliveFlag()](const boost::system::error_code& ec) {
-                        if (!a.IsAlive())
-                            return;
-                        OnAsyncReadDone(ec, packet);
-                    }
-                );
+                google::protobuf::io::CodedInputStream in((const uint8_t*)packet.data, (int)packet.size);
+                auto& stripped = _stripScratch.front();
+                stripped.clear();
+                std::span<const uint8_t> iqData;
+                if (StripField(in, std::span(c_iqDataPath), std::span(_stripScratch).subspan(1), stripped, iqData) &&
+                    pkg.ParseFromString(stripped))
+                {
+                    _aliasedIQData = iqData;
+                    return;
+                }
+                pkg.Clear();
             }
+
+            google::protobuf::io::CodedInputStream in((const uint8_t*)packet.data, (int)packet.size);
+            pkg.MergeFromCodedStream(&in);
         }
 
-        void AsyncReadPacket(const IConnection::buffer_ptr& buf, AsyncCb_T&& cb)
+        void StartHeartbeatTimer()
         {
-            assert(_readIsInProgress >= 0);
-            ++_readIsInProgress;
-            _connection.AsyncReadPacket(
-                buf,
-                [this, cb = std::move(cb), a = AliveFlag()](const boost::system::error_code& ec) mutable {
-                    if (!a.IsAlive())
-                        return;
-                    cb(ec);
-                });
+            _heartbeatTimer->expires_after(c_heartbeatPeriod);
+            _heartbeatTimer->async_wait([this, a = AliveFlag()](const boost::system::error_code& ec) {
+                if (!a.IsAlive() || ec.failed() || !_heartbeatTimer)
+                    return;
+                OnHeartbeat();
+            });
+        }
+
+        void StopHeartbeat()
+        {
+            if (_heartbeatTimer)
+                _heartbeatTimer->cancel();
+            _heartbeatTimer.reset();
+            _linkStatsHandler = {};
+        }
+
+        void OnHeartbeat()
+        {
+            const auto now = clock::now();
+
+            if (now - _lastPong > c_heartbeatTimeout)
+            {
+                LOG(warning) << "No pong for " << std::chrono::duration_cast<std::chrono::milliseconds>(now - _lastPong).count()
+                    << " ms, the link is dead.";
+                auto h = std::move(_linkStatsHandler);
+                StopHeartbeat();
+                if (h)
+                    h(asio::error::timed_out, _linkStats);
+                return;
+            }
+
+            const auto writes = _connection.GetSocketWriteStats();
+            const double bytes = double(writes.bytes - _lastSocketWrites.bytes);
+            const double busy = std::chrono::duration<double>(writes.busy - _lastSocketWrites.busy).count();
+            _lastSocketWrites = writes;
+
+            const double period = std::chrono::duration<double>(now - _lastHeartbeat).count();
+            _linkStats.throughput = period > 0 ? bytes / period : 0;
+            _lastHeartbeat = now;
+
+            if (busy > 0)
+            {
+                const double sample = bytes / busy;
+                _linkStats.goodput = _linkStats.goodput ? (7 * _linkStats.goodput + sample) / 8 : sample;
+            }
+
+            SendPing();
+            StartHeartbeatTimer();
+
+            if (_linkStatsHandler)
+                _linkStatsHandler({}, _linkStats);
+        }
+
+        void SendPing()
+        {
+            const auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(clock::now().time_since_epoch());
+
+            const auto msg = Make_Ping_Msg(++_linkStats.pingsSent, timestamp.count());
+            auto p = SerializeMessage(msg, ExtIO_TCP_Proto::MsgType::Request, 0, _connection.GetBufferPool());
+            _connection.AsyncWritePacket(p, IConnection::Priority::ControlRequest, {});
+        }
+
+        // A ping request is echoed back, the echo is the pong of our ping
+        void OnPing(ExtIO_TCP_Proto::MsgType type, const ExtIO_TCP_Proto::RqsPing& ping)
+        {
+            if (type == ExtIO_TCP_Proto::MsgType::Request)
+            {
+                const auto msg = Make_Ping_Msg(ping.seq(), ping.timestamp_us());
+                auto p = SerializeMessage(msg, ExtIO_TCP_Proto::MsgType::Responce, 0, _connection.GetBufferPool());
+                _connection.AsyncWritePacket(p, IConnection::Priority::ControlResponce, {});
+                return;
+            }
+
+            if (!_heartbeatTimer)
+                return;
+
+            const auto now = clock::now();
+            const auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()) -
+                std::chrono::microseconds(ping.timestamp_us());
+            if (rtt.count() < 0)
+                return;
+
+            _lastPong = now;
+
+            // RFC 6298 smoothing
+            auto& s = _linkStats;
+            if (!s.pongsReceived++)
+            {
+                s.rtt = rtt;
+                s.rttJitter = rtt / 2;
+            }
+            else
+            {
+                s.rttJitter = (3 * s.rttJitter + std::chrono::abs(s.rtt - rtt)) / 4;
+                s.rtt = (7 * s.rtt + rtt) / 8;
+            }
         }
 
         // IParser
@@ -242,10 +492,15 @@ namespace
         {
             _connection.Cancel();
 
-            _readIsInProgress = 0;
+            StopHeartbeat();
+
             _nextDialogId = 0;
             _requestMap.clear();
+            _deadlines = {};
+            _deadlineTimer.cancel();
+            _deadlineTimerExpiry.reset();
             _requestHandler = {};
+            _rawDataHandler = {};
         }
 
         void AsyncDisconnect(AsyncCb_T&& cb) override
@@ -253,22 +508,6 @@ namespace
             _connection.AsyncDisconnect(std::move(cb));
         }
 
-        void _AsyncReadData(const IConnection::buffer_ptr& buf, AsyncCb_T&& cb) 
-        {
-            //assert(!_currentDataHandler);
-
-            //_currentDataHandler = std::move(cb);
-
-            AsyncReadPacket(
-                buf,
-                [this, buf, a = AliveFlag()](const boost::system::error_code& ec) {
-                    if (!a.IsAlive())
-                        return;
-                    OnAsyncReadDone(ec, buf);
-                }
-            );
-        }
-
         void AsyncReceiveRequest(OnMsgCb_T&& h) override
         {
             AddReadHandler(0, std::move(h));
@@ -279,64 +518,101 @@ namespace
             AddReadHandler(did, std::move(h));
         }
 
-        void AsyncSendRequest(const ExtIO_TCP_Proto::Message& msg, OnMsgCb_T&& h) override
+        void AsyncReceiveRawData(OnRawDataCb_T&& h) override
         {
-            ExtIO_TCP_Proto::PackagedMessage package;
+            _rawDataHandler = std::move(h);
 
+            if (!_readIsInProgress)
+                StartNextRead();
+        }
+
+        int64_t AsyncSendRequest(const ExtIO_TCP_Proto::Message& msg, OnMsgCb_T&& h,
+            std::chrono::milliseconds timeout) override
+        {
             auto did = MakeDialogId();
 
-            *package.mutable_msg() = msg;
-            package.set_type(ExtIO_TCP_Proto::MsgType::Request);
-            package.set_dialog_id(did);
+            // the deadline counts the time the request waits to be written as well
+            AddReadHandler(did, std::move(h), clock::now() + timeout);
 
-            auto requestHandler = [this, h = std::move(h), did, a = AliveFlag()]
+            auto requestHandler = [this, did, a = AliveFlag()]
             (const boost::system::error_code& ec) mutable {
-                if (!a.IsAlive())
-                    return;
-
-                if (ec.failed())
-                {
-                    h(ec, {}, did);
+                if (!a.IsAlive() || !ec.failed())
                     return;
-                }
-
-                AsyncReceiveResponce(did, std::move(h));
+                CompleteRequest(did, ec);
             };
 
-            auto p = std::make_shared<IConnection::buffer_type>();
-            SerializePackage(package, *p);
-            p->set_packet_type(PacketBuffer::PacketType::Message);
-            _connection.AsyncWritePacket(p, std::move(requestHandler));
+            auto p = SerializeMessage(msg, ExtIO_TCP_Proto::MsgType::Request, did, _connection.GetBufferPool());
+            _connection.AsyncWritePacket(p, IConnection::Priority::ControlRequest, std::move(requestHandler));
+            return did;
+        }
+
+        void CancelRequest(int64_t did) override
+        {
+            CompleteRequest(did, boost::asio::error::operation_aborted);
         }
 
         void AsyncSendResponce(const ExtIO_TCP_Proto::Message& msg, int64_t did, AsyncCb_T&& h) override
         {
-            ExtIO_TCP_Proto::PackagedMessage package;
-            package.set_dialog_id(did);
-            package.set_type(ExtIO_TCP_Proto::MsgType::Responce);
-            *package.mutable_msg() = msg;
-            auto p = std::make_shared<IConnection::buffer_type>();
-            SerializePackage(package, *p);
-            p->set_packet_type(PacketBuffer::PacketType::Message);
-            _connection.AsyncWritePacket(p, std::move(h));
+            auto p = SerializeMessage(msg, ExtIO_TCP_Proto::MsgType::Responce, did, _connection.GetBufferPool());
+            _connection.AsyncWritePacket(p, IConnection::Priority::ControlResponce, std::move(h));
         }
 
         void AsyncSendMessage(std::unique_ptr<ExtIO_TCP_Proto::Message>&& msg, AsyncCb_T&& h) override
         {
-            ExtIO_TCP_Proto::PackagedMessage package;
-            package.set_dialog_id(0);
-            package.set_type(ExtIO_TCP_Proto::MsgType::Responce);
-            package.set_allocated_msg(msg.release());
-            auto p = std::make_shared<IConnection::buffer_type>();
-            SerializePackage(package, *p);
-            p->set_packet_type(PacketBuffer::PacketType::Message);
-            _connection.AsyncWritePacket(p, std::move(h));
+            auto p = SerializeMessage(*msg, ExtIO_TCP_Proto::MsgType::Responce, 0, _connection.GetBufferPool());
+            _connection.AsyncWritePacket(p, IConnection::Priority::IQData, std::move(h));
+        }
+
+        void AsyncSendRawData(const IConnection::buffer_ptr& buf, AsyncCb_T&& h) override
+        {
+            assert(buf->packet_type() == PacketBuffer::PacketType::RawData);
+            _connection.AsyncWritePacket(buf, IConnection::Priority::IQData, std::move(h));
+        }
+
+        void StartHeartbeat(IConnection::strand_type& strand, OnLinkStatsCb_T&& cb) override
+        {
+            StopHeartbeat();
+
+            _linkStats = {};
+            _lastPong = _lastHeartbeat = clock::now();
+            _lastSocketWrites = _connection.GetSocketWriteStats();
+
+            _heartbeatTimer.emplace(strand);
+            _linkStatsHandler = std::move(cb);
+            StartHeartbeatTimer();
+        }
+
+        LinkStats GetLinkStats() const override
+        {
+            return _linkStats;
+        }
+
+        std::span<const uint8_t> GetAliasedIQData() const override
+        {
+            return _aliasedIQData;
         }
     };
 }
 
 namespace Protocol
 {
+    IConnection::buffer_ptr SerializeMessage(
+        const ExtIO_TCP_Proto::Message& msg, ExtIO_TCP_Proto::MsgType type, int64_t did, IBufferPool& pool)
+    {
+        ExtIO_TCP_Proto::PackagedMessage pkg;
+        pkg.set_type(type);
+        pkg.set_dialog_id(did);
+        pkg.unsafe_arena_set_allocated_msg(const_cast<ExtIO_TCP_Proto::Message*>(&msg));
+        AtScopeExit release([&pkg]() { pkg.unsafe_arena_release_msg(); });
+
+        const auto size = pkg.ByteSizeLong();
+        auto p = pool.Acquire(size);
+        p->resize(size);
+        pkg.SerializeWithCachedSizesToArray((uint8_t*)p->data());
+        p->set_packet_type(PacketBuffer::PacketType::Message);
+        return p;
+    }
+
     std::string const& IParser::GetMessageName(const ExtIO_TCP_Proto::Message& msg)
     {
         if (!msg.IsInitialized()) {
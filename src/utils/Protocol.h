@@ -24,12 +24,37 @@
 #include "Messages.h"
 #include "Protocol.pb.h"
 
+#include <span>
+
 namespace Protocol
 {
-    constexpr uint32_t c_protocolVersion = 1;
+    constexpr uint32_t c_protocolVersion = 2;
 
     using AsyncCb_T = std::move_only_function<void(const boost::system::error_code&)>;
     using OnMsgCb_T = std::move_only_function<void(const boost::system::error_code&, const ExtIO_TCP_Proto::Message&, int64_t did)>;
+    using OnRawDataCb_T = std::move_only_function<void(const boost::system::error_code&, const PacketView&)>;
+
+    // A ping is sent every period, the link is reported dead after the timeout without pongs
+    constexpr auto c_heartbeatPeriod = std::chrono::seconds(1);
+    constexpr auto c_heartbeatTimeout = std::chrono::seconds(5);
+
+    // A request not answered within its timeout completes with timed_out,
+    // the deadlines are checked with this resolution
+    constexpr auto c_requestTimeout = std::chrono::seconds(10);
+    constexpr auto c_deadlineResolution = std::chrono::milliseconds(100);
+
+    struct LinkStats
+    {
+        std::chrono::microseconds rtt{};        // smoothed round trip time of the pings
+        std::chrono::microseconds rttJitter{};  // mean deviation of the round trip time
+        double goodput = 0;                     // bytes/s the socket drains while writes are queued
+        double throughput = 0;                  // bytes/s written during the last period
+        uint64_t pingsSent = 0;
+        uint64_t pongsReceived = 0;
+    };
+
+    // Called every heartbeat period, timed_out stops the heartbeat
+    using OnLinkStatsCb_T = std::move_only_function<void(const boost::system::error_code&, const LinkStats&)>;
 
     class IParser
     {
@@ -42,15 +67,34 @@ namespace Protocol
         virtual void Cancel() = 0;
         virtual void AsyncReceiveRequest(OnMsgCb_T&&) = 0;
         virtual void AsyncReceiveResponce(int64_t did, OnMsgCb_T&&) = 0;
+        virtual void AsyncReceiveRawData(OnRawDataCb_T&&) = 0;
         virtual void AsyncDisconnect(AsyncCb_T&& cb) = 0;
-        virtual void AsyncSendRequest(const ExtIO_TCP_Proto::Message& msg, OnMsgCb_T&& handler) = 0;
+        // Returns the dialog id of the request, a responce arriving after the timeout is dropped
+        virtual int64_t AsyncSendRequest(const ExtIO_TCP_Proto::Message& msg, OnMsgCb_T&& handler,
+            std::chrono::milliseconds timeout = c_requestTimeout) = 0;
+        // The handler of the request gets operation_aborted unless it has been called already
+        virtual void CancelRequest(int64_t did) = 0;
         virtual void AsyncSendResponce(const ExtIO_TCP_Proto::Message& msg, int64_t did, AsyncCb_T&& handler) = 0;
         virtual void AsyncSendMessage(std::unique_ptr<ExtIO_TCP_Proto::Message>&& msg, AsyncCb_T&& handler) = 0;
+        virtual void AsyncSendRawData(const IConnection::buffer_ptr& buf, AsyncCb_T&& handler) = 0;
+        // Pings the peer, it must have reported the heartbeat support in Hello.
+        // Pings of the peer are answered while a read is in progress.
+        virtual void StartHeartbeat(IConnection::strand_type& strand, OnLinkStatsCb_T&& cb) = 0;
+        virtual LinkStats GetLinkStats() const = 0;
+        // IQ data of the ExtIOCallback message being handled when it is left in the
+        // receive buffer instead of the message, valid until the handler returns.
+        virtual std::span<const uint8_t> GetAliasedIQData() const = 0;
     };
 
 
     std::unique_ptr<IParser> MakeParser(IConnection&);
 
+    // Serializes the message packaged with its dialog straight into a pooled buffer.
+    // The package refers to the message instead of copying it and the sizes
+    // computed by ByteSizeLong are reused by the serialization.
+    IConnection::buffer_ptr SerializeMessage(
+        const ExtIO_TCP_Proto::Message& msg, ExtIO_TCP_Proto::MsgType type, int64_t did, IBufferPool& pool);
+
     template<typename T>
     std::tuple<std::promise<T>, std::future<T>> MakePFPair()
     {
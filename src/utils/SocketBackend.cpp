@@ -0,0 +1,357 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "SocketBackend.h"
+#include "IsAlive.h"
+
+#include <deque>
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "log.h"
+
+namespace
+{
+    // The kernel reports the released pages of MSG_ZEROCOPY sends through the
+    // socket error queue, it is read after every send and whenever the socket
+    // signals an error while some sends are not released.
+    // Zero copy sends are turned off after this number of sends in a row the
+    // kernel has copied anyway, e.g. over the loopback or a NIC without scatter/gather
+    constexpr unsigned c_maxCopiedZeroCopySends = 64;
+
+    class AsioSocketBackend : public ISocketBackend
+    {
+        boost::asio::ip::tcp::socket& _socket;
+
+        // MSG_ZEROCOPY sends
+        struct zero_copy_write
+        {
+            uint32_t lastSend = 0;     // the kernel counter of the last sendmsg of the write
+            std::shared_ptr<const void> holder;
+        };
+
+        bool _zeroCopy = false;
+        std::span<const boost::asio::const_buffer> _zcBuffers;
+        std::shared_ptr<const void> _zcHolder;
+        IoCbT _zcCb;
+        size_t _zcWritten = 0;
+        size_t _zcTotal = 0;
+        uint32_t _zcSends = 0;
+        uint32_t _zcNextSend = 0;       // the kernel counts the sendmsg calls from 0
+        std::deque<zero_copy_write> _zcNotReleased;
+        bool _zcWaiting = false;
+        unsigned _zcCopiedInRow = 0;
+        uint64_t _zcSendsTotal = 0;
+        uint64_t _zcCopiedTotal = 0;
+
+        AliveInstance _inst;
+
+    public:
+        AsioSocketBackend(boost::asio::ip::tcp::socket& socket)
+            : _socket(socket)
+        {
+        }
+
+        // The connection calls Close() first, the not released buffers are
+        // dropped after the socket is closed.
+        ~AsioSocketBackend()
+        {
+            if (_zcCb)
+            {
+                boost::asio::post(_socket.get_executor(), [cb = std::move(_zcCb)]() mutable {
+                    cb(boost::asio::error::operation_aborted, 0);
+                });
+            }
+
+            if (_zcSendsTotal)
+            {
+                LOG(trace) << "Zero copy sends: " << _zcSendsTotal
+                    << "; copied by the kernel: " << _zcCopiedTotal;
+            }
+        }
+
+    private:
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+#ifdef __linux__
+        void ZeroCopySend()
+        {
+            ReadZeroCopyNotifications();
+
+            boost::container::small_vector<iovec, 4> iov;
+            size_t skip = _zcWritten;
+            for (const auto& b : _zcBuffers)
+            {
+                if (skip >= b.size())
+                {
+                    skip -= b.size();
+                    continue;
+                }
+                iov.push_back({ (uint8_t*)const_cast<void*>(b.data()) + skip, b.size() - skip });
+                skip = 0;
+            }
+
+            msghdr msg = {};
+            msg.msg_iov = iov.data();
+            msg.msg_iovlen = iov.size();
+
+            const auto n = ::sendmsg(_socket.native_handle(), &msg, MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0)
+            {
+                ++_zcSends;
+                _zcWritten += n;
+            }
+            else if (n < 0 && errno == ENOBUFS)
+            {
+                // the pinned pages are over the socket optmem limit, the rest is copied
+                return FinishZeroCopyWrite({}, true);
+            }
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return FinishZeroCopyWrite(boost::system::error_code(errno, boost::system::system_category()), false);
+            }
+
+            if (_zcWritten == _zcTotal)
+                return FinishZeroCopyWrite({}, false);
+
+            _socket.async_wait(boost::asio::socket_base::wait_write,
+                [this, a = AliveFlag()](const boost::system::error_code& ec) {
+                    if (!a.IsAlive()) return;
+                    if (ec.failed())
+                        return FinishZeroCopyWrite(ec, false);
+                    ZeroCopySend();
+                });
+        }
+
+        void FinishZeroCopyWrite(const boost::system::error_code& ec, bool copyTheRest)
+        {
+            if (_zcSends)
+            {
+                _zcNextSend += _zcSends;
+                _zcSendsTotal += _zcSends;
+                _zcNotReleased.push_back({ _zcNextSend - 1, std::move(_zcHolder) });
+                WaitZeroCopyNotifications();
+            }
+
+            auto cb = std::move(_zcCb);
+            const size_t written = _zcWritten;
+            _zcHolder.reset();
+
+            if (copyTheRest)
+            {
+                std::vector<boost::asio::const_buffer> rest;
+                size_t skip = written;
+                for (const auto& b : _zcBuffers)
+                {
+                    if (skip >= b.size())
+                    {
+                        skip -= b.size();
+                        continue;
+                    }
+                    rest.push_back(boost::asio::buffer(b + skip));
+                    skip = 0;
+                }
+                auto buffers = std::make_shared<std::vector<boost::asio::const_buffer>>(std::move(rest));
+                boost::asio::async_write(_socket, *buffers,
+                    [cb = std::move(cb), buffers, written](const boost::system::error_code& ec, std::size_t n) mutable {
+                        cb(ec, written + n);
+                    });
+                return;
+            }
+
+            // the write completes asynchronously as the asio ones do
+            boost::asio::post(_socket.get_executor(), [cb = std::move(cb), ec, written]() mutable {
+                cb(ec, written);
+            });
+        }
+
+        void ReadZeroCopyNotifications()
+        {
+            for (;;)
+            {
+                char control[128];
+                msghdr msg = {};
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                if (::recvmsg(_socket.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                    break;
+
+                for (auto* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+                {
+                    if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                        !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                        continue;
+                    const auto* ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+                    if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                        continue;
+                    OnZeroCopyReleased(ee->ee_data, (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+                }
+            }
+        }
+
+        // TCP releases the sends in their order, [.., last] are done
+        void OnZeroCopyReleased(uint32_t last, bool copied)
+        {
+            while (!_zcNotReleased.empty() && (int32_t)(_zcNotReleased.front().lastSend - last) <= 0)
+                _zcNotReleased.pop_front();
+
+            if (!copied)
+            {
+                _zcCopiedInRow = 0;
+                return;
+            }
+
+            ++_zcCopiedTotal;
+            if (_zeroCopy && ++_zcCopiedInRow >= c_maxCopiedZeroCopySends)
+            {
+                LOG(info) << "The kernel copies the zero copy sends, they are turned off.";
+                _zeroCopy = false;
+            }
+        }
+
+        // A queued notification makes the socket report an error condition
+        void WaitZeroCopyNotifications()
+        {
+            if (_zcWaiting || _zcNotReleased.empty() || !_socket.is_open())
+                return;
+
+            _zcWaiting = true;
+            _socket.async_wait(boost::asio::socket_base::wait_error,
+                [this, a = AliveFlag()](const boost::system::error_code& ec) {
+                    if (!a.IsAlive()) return;
+                    _zcWaiting = false;
+                    if (ec.failed()) return;
+                    ReadZeroCopyNotifications();
+                    WaitZeroCopyNotifications();
+                });
+
+            // the notifications queued before the wait was registered do not complete it
+            ReadZeroCopyNotifications();
+        }
+#endif
+
+        // ISocketBackend
+    private:
+        void AsyncWrite(std::span<const boost::asio::const_buffer> buffers, IoCbT&& cb) override
+        {
+            boost::asio::async_write(_socket, buffers, std::move(cb));
+        }
+
+        void AsyncReadSome(boost::asio::mutable_buffer buffer, IoCbT&& cb) override
+        {
+            _socket.async_read_some(buffer, std::move(cb));
+        }
+
+        bool EnableZeroCopy() override
+        {
+#ifdef __linux__
+            if (!_socket.is_open())
+                return false;
+
+            const int one = 1;
+            if (::setsockopt(_socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+            {
+                LOG(warning) << "SO_ZEROCOPY is not supported: " << std::strerror(errno);
+                return false;
+            }
+
+            _zeroCopy = true;
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        bool IsZeroCopyEnabled() const override
+        {
+            return _zeroCopy;
+        }
+
+        void AsyncWriteZeroCopy(
+            std::span<const boost::asio::const_buffer> buffers, std::shared_ptr<const void>&& holder, IoCbT&& cb) override
+        {
+#ifdef __linux__
+            if (_zeroCopy)
+            {
+                assert(!_zcCb);
+
+                _zcBuffers = buffers;
+                _zcHolder = std::move(holder);
+                _zcCb = std::move(cb);
+                _zcWritten = 0;
+                _zcTotal = boost::asio::buffer_size(buffers);
+                _zcSends = 0;
+                ZeroCopySend();
+                return;
+            }
+#endif
+            AsyncWrite(buffers, std::move(cb));
+        }
+
+        void Cancel() override
+        {
+            boost::system::error_code ec;
+            if (_socket.is_open())
+                _socket.cancel(ec);
+        }
+
+        void Close() override
+        {
+            boost::system::error_code ec;
+            if (_socket.is_open())
+            {
+                // the queued sends are dropped instead of being sent from the released buffers
+                if (!_zcNotReleased.empty())
+                    _socket.set_option(boost::asio::socket_base::linger(true, 0), ec);
+                _socket.close(ec);
+            }
+            _zcNotReleased.clear();
+        }
+    };
+}
+
+std::unique_ptr<ISocketBackend> MakeAsioSocketBackend(boost::asio::ip::tcp::socket& socket)
+{
+    return std::make_unique<AsioSocketBackend>(socket);
+}
+
+std::unique_ptr<ISocketBackend> MakeSocketBackend(
+    IConnection::strand_type& strand,
+    boost::asio::ip::tcp::socket& socket,
+    SocketBackend kind)
+{
+    if (kind == SocketBackend::IoUring)
+    {
+        if (auto backend = MakeUringSocketBackend(strand, socket))
+            return backend;
+
+        LOG(warning) << "io_uring socket backend is not available, using asio.";
+    }
+
+    return MakeAsioSocketBackend(socket);
+}
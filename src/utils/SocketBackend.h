@@ -0,0 +1,66 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#pragma once
+
+#include "Connection.h"
+
+#include <span>
+
+// Socket I/O of a Connection. Both operations are started and complete
+// on the connection strand, one write and one read may be in flight.
+class ISocketBackend
+{
+public:
+
+    using IoCbT = std::move_only_function<void(const boost::system::error_code&, std::size_t)>;
+
+    virtual ~ISocketBackend() = default;
+
+    // Writes all the buffers, their memory must stay valid until the cb is called
+    virtual void AsyncWrite(std::span<const boost::asio::const_buffer> buffers, IoCbT&& cb) = 0;
+    virtual void AsyncReadSome(boost::asio::mutable_buffer buffer, IoCbT&& cb) = 0;
+    // Turns on MSG_ZEROCOPY sends, returns false if the socket cannot do them
+    virtual bool EnableZeroCopy() = 0;
+    // False also when zero copy sends were turned off because the kernel copied them
+    virtual bool IsZeroCopyEnabled() const = 0;
+    // Writes as AsyncWrite does, but the kernel may read the buffers after the cb
+    // is called, the holder keeps their memory until the kernel releases the pages.
+    // It is a plain AsyncWrite if zero copy sends are not enabled.
+    virtual void AsyncWriteZeroCopy(
+        std::span<const boost::asio::const_buffer> buffers, std::shared_ptr<const void>&& holder, IoCbT&& cb) = 0;
+    // Pending operations complete with operation_aborted
+    virtual void Cancel() = 0;
+    // Closes the socket, the kernel no longer reads the written buffers after it.
+    // The connection closes the socket by this before the backend is replaced.
+    virtual void Close() = 0;
+};
+
+std::unique_ptr<ISocketBackend> MakeAsioSocketBackend(boost::asio::ip::tcp::socket& socket);
+
+// Returns nullptr if io_uring is not available on this system
+std::unique_ptr<ISocketBackend> MakeUringSocketBackend(
+    IConnection::strand_type& strand,
+    boost::asio::ip::tcp::socket& socket);
+
+// Makes the requested backend, falls back to asio if it cannot be set up
+std::unique_ptr<ISocketBackend> MakeSocketBackend(
+    IConnection::strand_type& strand,
+    boost::asio::ip::tcp::socket& socket,
+    SocketBackend kind);
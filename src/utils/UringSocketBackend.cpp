@@ -0,0 +1,769 @@
+/*****************************************************************************
+ * This file is a part of ExtIoOverNet software.
+ * 
+ * Copyright (C) 2023 Roman Ukhov. All rights reserved.
+ * 
+ * Licensed under the GNU General Public License Version 3 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at 
+ * https://www.gnu.org/licenses/gpl-3.0.txt
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-FileCopyrightText: 2023 Roman Ukhov <ukhov.roman@gmail.com>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *****************************************************************************/
+
+#include "SocketBackend.h"
+
+#ifdef __linux__
+
+#include "IsAlive.h"
+#include <cstring>
+#include <deque>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+namespace
+{
+    constexpr unsigned c_ringEntries = 64;
+
+    // Receive buffers provided to the kernel, a multishot recv
+    // picks one of them for every completion
+    constexpr unsigned c_recvBufferCount = 64;     // power of 2
+    constexpr unsigned c_recvBufferSize = 64 * 1024;
+    constexpr uint16_t c_recvBufferGroup = 0;
+
+    // One write goes out as a chain of linked sendmsg operations
+    constexpr size_t c_maxIovPerSend = 16;
+    constexpr size_t c_maxLinkedSends = 16;
+
+    // user_data of the submitted operations, a send keeps its chain index in the low bits
+    constexpr uint64_t c_recvOp = 1ull << 62;
+    constexpr uint64_t c_sendOp = 2ull << 62;
+    constexpr uint64_t c_cancelOp = 3ull << 62;
+    constexpr uint64_t c_opMask = 3ull << 62;
+
+    int sys_io_uring_setup(unsigned entries, io_uring_params* p)
+    {
+        return (int)::syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return (int)::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nrArgs)
+    {
+        return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+    }
+
+    template<typename T>
+    T load_acquire(T& v) { return std::atomic_ref<T>(v).load(std::memory_order_acquire); }
+
+    template<typename T>
+    void store_release(T& v, T x) { std::atomic_ref<T>(v).store(x, std::memory_order_release); }
+
+    // Submission and completion queues mapped from an io_uring instance
+    class Uring
+    {
+        int _fd = -1;
+        void* _sqMap = MAP_FAILED;
+        size_t _sqMapSize = 0;
+        void* _cqMap = MAP_FAILED;
+        size_t _cqMapSize = 0;
+        io_uring_sqe* _sqes = nullptr;
+        size_t _sqesSize = 0;
+
+        unsigned* _sqHead = nullptr;
+        unsigned* _sqTail = nullptr;
+        unsigned* _sqArray = nullptr;
+        unsigned _sqMask = 0;
+        unsigned _sqEntries = 0;
+        unsigned _sqLocalTail = 0;
+        unsigned _sqSubmitted = 0;
+
+        unsigned* _cqHead = nullptr;
+        unsigned* _cqTail = nullptr;
+        unsigned _cqMask = 0;
+        io_uring_cqe* _cqes = nullptr;
+
+    public:
+        Uring() = default;
+        Uring(const Uring&) = delete;
+        Uring& operator = (const Uring&) = delete;
+
+        ~Uring()
+        {
+            if (_sqes) ::munmap(_sqes, _sqesSize);
+            if (_cqMap != MAP_FAILED && _cqMap != _sqMap) ::munmap(_cqMap, _cqMapSize);
+            if (_sqMap != MAP_FAILED) ::munmap(_sqMap, _sqMapSize);
+            if (_fd >= 0) ::close(_fd);
+        }
+
+        bool Init(unsigned entries)
+        {
+            io_uring_params p = {};
+            _fd = sys_io_uring_setup(entries, &p);
+            if (_fd < 0)
+                return false;
+
+            _sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            const bool singleMap = p.features & IORING_FEAT_SINGLE_MMAP;
+            if (singleMap)
+                _sqMapSize = _cqMapSize = std::max(_sqMapSize, _cqMapSize);
+
+            _sqMap = ::mmap(nullptr, _sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            if (_sqMap == MAP_FAILED)
+                return false;
+
+            _cqMap = singleMap ? _sqMap :
+                ::mmap(nullptr, _cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+            if (_cqMap == MAP_FAILED)
+                return false;
+
+            _sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+            auto sqes = ::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+                return false;
+            _sqes = (io_uring_sqe*)sqes;
+
+            auto sq = (uint8_t*)_sqMap;
+            _sqHead = (unsigned*)(sq + p.sq_off.head);
+            _sqTail = (unsigned*)(sq + p.sq_off.tail);
+            _sqArray = (unsigned*)(sq + p.sq_off.array);
+            _sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+            _sqEntries = p.sq_entries;
+            _sqLocalTail = _sqSubmitted = *_sqTail;
+
+            auto cq = (uint8_t*)_cqMap;
+            _cqHead = (unsigned*)(cq + p.cq_off.head);
+            _cqTail = (unsigned*)(cq + p.cq_off.tail);
+            _cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+            _cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+            return true;
+        }
+
+        int Fd() const
+        {
+            return _fd;
+        }
+
+        // Returns a cleared entry or nullptr if the submission queue is full
+        io_uring_sqe* GetSqe()
+        {
+            if (_sqLocalTail - load_acquire(*_sqHead) >= _sqEntries)
+                return nullptr;
+
+            const unsigned idx = _sqLocalTail & _sqMask;
+            _sqArray[idx] = idx;
+            ++_sqLocalTail;
+
+            auto sqe = &_sqes[idx];
+            std::memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        // Passes the prepared entries to the kernel and optionally waits for completions
+        int Submit(unsigned minComplete = 0)
+        {
+            store_release(*_sqTail, _sqLocalTail);
+
+            const int res = sys_io_uring_enter(_fd, _sqLocalTail - _sqSubmitted, minComplete,
+                minComplete ? IORING_ENTER_GETEVENTS : 0);
+            if (res > 0)
+                _sqSubmitted += res;
+            return res < 0 ? -errno : res;
+        }
+
+        template<typename F>
+        void ReapCompletions(F&& f)
+        {
+            unsigned head = *_cqHead;
+            const unsigned tail = load_acquire(*_cqTail);
+
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe cqe = _cqes[head & _cqMask];
+                store_release(*_cqHead, head + 1);
+                f(cqe);
+            }
+        }
+    };
+
+    // Receives into a provided buffer ring with one multishot recv and sends
+    // a gathered write as linked sendmsg operations. Completions are signalled
+    // through an eventfd watched on the strand, so all the state is strand bound.
+    class UringSocketBackend : public ISocketBackend
+    {
+        IConnection::strand_type& _strand;
+        boost::asio::ip::tcp::socket& _socket;
+        const int _socketFd;
+        Uring _ring;
+        boost::asio::posix::stream_descriptor _event;
+        AliveInstance _inst;
+        // submitted operations whose last completion is not reaped yet
+        unsigned _inFlight = 0;
+
+        io_uring_buf_ring* _bufRing = (io_uring_buf_ring*)MAP_FAILED;
+        std::vector<uint8_t> _bufMemory;
+        uint16_t _bufTail = 0;
+        bool _bufRingRegistered = false;
+
+        struct chunk
+        {
+            uint16_t bid;
+            uint32_t offset;
+            uint32_t size;
+        };
+
+        std::deque<chunk> _received;
+        bool _recvArmed = false;
+        bool _recvPaused = false;
+        // the kernel ran out of buffers, the recv is armed again once one is recycled
+        bool _recvStarved = false;
+        bool _multishot = true;
+        boost::system::error_code _recvError;
+        boost::asio::mutable_buffer _readBuffer;
+        IoCbT _readCb;
+
+        std::vector<iovec> _writeIov;
+        std::vector<iovec> _sendIov;
+        std::vector<msghdr> _sendMsgs;
+        std::vector<size_t> _sendLen;
+        std::vector<int> _sendResult;
+        size_t _sendOps = 0;
+        size_t _writeTotal = 0;
+        size_t _writeDone = 0;
+        bool _writeCanceled = false;
+        IoCbT _writeCb;
+
+    public:
+        UringSocketBackend(IConnection::strand_type& strand, boost::asio::ip::tcp::socket& socket)
+            : _strand(strand)
+            , _socket(socket)
+            , _socketFd(socket.native_handle())
+            , _event(strand)
+        {
+        }
+
+        ~UringSocketBackend()
+        {
+            AbortOperations();
+
+            if (_bufRingRegistered)
+            {
+                io_uring_buf_reg reg = {};
+                reg.bgid = c_recvBufferGroup;
+                sys_io_uring_register(_ring.Fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+            }
+
+            if (_bufRing != MAP_FAILED)
+                ::munmap(_bufRing, c_recvBufferCount * sizeof(io_uring_buf));
+        }
+
+        bool Init()
+        {
+            if (!_ring.Init(c_ringEntries))
+            {
+                LOG(trace) << "io_uring setup failed: " << std::strerror(errno);
+                return false;
+            }
+
+            int efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (efd < 0)
+                return false;
+            _event.assign(efd);
+
+            if (sys_io_uring_register(_ring.Fd(), IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+            {
+                LOG(trace) << "io_uring eventfd registration failed: " << std::strerror(errno);
+                return false;
+            }
+
+            // the ring of buffer descriptors has to be page aligned
+            auto bufRing = ::mmap(nullptr, c_recvBufferCount * sizeof(io_uring_buf),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (bufRing == MAP_FAILED)
+                return false;
+            _bufRing = (io_uring_buf_ring*)bufRing;
+
+            io_uring_buf_reg reg = {};
+            reg.ring_addr = (uint64_t)_bufRing;
+            reg.ring_entries = c_recvBufferCount;
+            reg.bgid = c_recvBufferGroup;
+            if (sys_io_uring_register(_ring.Fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            {
+                LOG(trace) << "io_uring buffer ring registration failed: " << std::strerror(errno);
+                return false;
+            }
+            _bufRingRegistered = true;
+
+            _bufMemory.resize(c_recvBufferCount * c_recvBufferSize);
+            for (uint16_t bid = 0; bid < c_recvBufferCount; ++bid)
+                RecycleBuffer(bid);
+            CommitBuffers();
+
+            WaitEvents();
+            ArmRecv();
+
+            return true;
+        }
+
+    private:
+
+        auto AliveFlag()
+        {
+            return ::AliveFlag(_inst);
+        }
+
+        // The pending operations complete with operation_aborted, the kernel
+        // must not touch the buffers after they are freed
+        void AbortOperations()
+        {
+            if (_readCb)
+                Post(std::move(_readCb), boost::asio::error::operation_aborted, 0);
+            if (_writeCb)
+                Post(std::move(_writeCb), boost::asio::error::operation_aborted, _writeDone);
+
+            if (_inFlight)
+            {
+                SubmitCancel();
+                while (_inFlight)
+                {
+                    const int res = _ring.Submit(1);
+                    if (res < 0 && res != -EINTR)
+                    {
+                        LOG(error) << "io_uring wait failed: " << -res;
+                        break;
+                    }
+                    _ring.ReapCompletions([this](const io_uring_cqe& cqe) { Account(cqe); });
+                }
+            }
+        }
+
+        void Post(IoCbT&& cb, const boost::system::error_code& ec, std::size_t bytes)
+        {
+            boost::asio::post(_strand, [cb = std::move(cb), ec, bytes]() mutable { cb(ec, bytes); });
+        }
+
+        void WaitEvents()
+        {
+            _event.async_wait(boost::asio::posix::descriptor_base::wait_read,
+                [this, a = AliveFlag()](const boost::system::error_code& ec)
+                {
+                    if (!a.IsAlive() || ec.failed()) return;
+
+                    uint64_t counter;
+                    [[maybe_unused]] auto res = ::read(_event.native_handle(), &counter, sizeof(counter));
+
+                    _ring.ReapCompletions([this](const io_uring_cqe& cqe) { OnCompletion(cqe); });
+                    WaitEvents();
+                });
+        }
+
+        io_uring_sqe* GetSqe()
+        {
+            auto sqe = _ring.GetSqe();
+            if (!sqe)
+            {
+                _ring.Submit();
+                sqe = _ring.GetSqe();
+            }
+            return sqe;
+        }
+
+        void Submit()
+        {
+            const int res = _ring.Submit();
+            if (res < 0)
+                LOG(error) << "io_uring submit failed: " << std::strerror(-res);
+        }
+
+        void SubmitCancel()
+        {
+            auto sqe = GetSqe();
+            if (!sqe)
+                return;
+
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = _socketFd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = c_cancelOp;
+            ++_inFlight;
+            Submit();
+        }
+
+        // Tracks the operations whose last completion is reaped,
+        // returns false for a completion that is followed by more.
+        bool Account(const io_uring_cqe& cqe)
+        {
+            if ((cqe.user_data & c_opMask) == c_recvOp && (cqe.flags & IORING_CQE_F_MORE))
+                return false;
+            --_inFlight;
+            return true;
+        }
+
+        void OnCompletion(const io_uring_cqe& cqe)
+        {
+            const bool last = Account(cqe);
+
+            switch (cqe.user_data & c_opMask)
+            {
+            case c_recvOp:
+                if (last) _recvArmed = false;
+                OnReceived(cqe);
+                break;
+            case c_sendOp:
+                OnSent(cqe);
+                break;
+            default:
+                break;
+            }
+        }
+
+        // receive
+
+        void ArmRecv()
+        {
+            if (_recvArmed || _recvPaused || _recvStarved || _recvError.failed())
+                return;
+
+            auto sqe = GetSqe();
+            if (!sqe)
+                return;
+
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = _socketFd;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = c_recvBufferGroup;
+            if (_multishot)
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->user_data = c_recvOp;
+            ++_inFlight;
+            _recvArmed = true;
+            Submit();
+        }
+
+        void OnReceived(const io_uring_cqe& cqe)
+        {
+            if (cqe.res > 0)
+            {
+                assert(cqe.flags & IORING_CQE_F_BUFFER);
+                _received.push_back({ (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 0, (uint32_t)cqe.res });
+            }
+            else if (cqe.res == 0)
+                _recvError = boost::asio::error::eof;
+            else if (cqe.res == -EINVAL && _multishot && _received.empty())
+            {
+                LOG(trace) << "io_uring multishot recv is not supported, using single shot ones.";
+                _multishot = false;
+            }
+            else if (cqe.res == -ENOBUFS)
+                _recvStarved = true;
+            else if (cqe.res != -ECANCELED)
+                _recvError = boost::system::error_code(-cqe.res, boost::system::system_category());
+
+            if (_readCb)
+            {
+                if (auto bytes = TakeReceived())
+                {
+                    auto cb = std::move(_readCb);
+                    cb({}, bytes);
+                }
+                else if (_received.empty() && _recvError.failed())
+                {
+                    auto cb = std::move(_readCb);
+                    cb(_recvError, 0);
+                }
+            }
+
+            ArmRecv();
+        }
+
+        // Copies the received data to the pending read buffer
+        size_t TakeReceived()
+        {
+            size_t copied = 0;
+
+            while (!_received.empty() && copied < _readBuffer.size())
+            {
+                auto& c = _received.front();
+                const size_t n = std::min<size_t>(c.size, _readBuffer.size() - copied);
+
+                std::memcpy((uint8_t*)_readBuffer.data() + copied,
+                    _bufMemory.data() + (size_t)c.bid * c_recvBufferSize + c.offset, n);
+                copied += n;
+                c.offset += (uint32_t)n;
+                c.size -= (uint32_t)n;
+
+                if (!c.size)
+                {
+                    RecycleBuffer(c.bid);
+                    _received.pop_front();
+                }
+            }
+
+            if (copied)
+                CommitBuffers();
+
+            return copied;
+        }
+
+        void RecycleBuffer(uint16_t bid)
+        {
+            // the descriptors start at the ring base, the bufs member is off
+            // by the flex array wrapper in C++; the first one overlays the tail
+            auto& b = reinterpret_cast<io_uring_buf*>(_bufRing)[_bufTail & (c_recvBufferCount - 1)];
+            b.addr = (uint64_t)(_bufMemory.data() + (size_t)bid * c_recvBufferSize);
+            b.len = c_recvBufferSize;
+            b.bid = bid;
+            ++_bufTail;
+            _recvStarved = false;
+        }
+
+        void CommitBuffers()
+        {
+            store_release(_bufRing->tail, _bufTail);
+        }
+
+        // send
+
+        void SubmitSends()
+        {
+            _sendIov.clear();
+            _sendLen.clear();
+
+            // skip the sent bytes
+            size_t skip = _writeDone;
+            size_t first = 0;
+            while (skip >= _writeIov[first].iov_len)
+                skip -= _writeIov[first++].iov_len;
+
+            size_t opBytes = 0;
+            size_t opIovs = 0;
+            for (size_t i = first; i < _writeIov.size() && _sendLen.size() < c_maxLinkedSends; ++i)
+            {
+                auto v = _writeIov[i];
+                if (i == first)
+                {
+                    v.iov_base = (uint8_t*)v.iov_base + skip;
+                    v.iov_len -= skip;
+                }
+                _sendIov.push_back(v);
+                opBytes += v.iov_len;
+
+                if (++opIovs == c_maxIovPerSend || i + 1 == _writeIov.size())
+                {
+                    _sendLen.push_back(opBytes);
+                    opBytes = 0;
+                    opIovs = 0;
+                }
+            }
+            if (opIovs)
+                _sendLen.push_back(opBytes);
+
+            _sendMsgs.assign(_sendLen.size(), {});
+            _sendResult.assign(_sendLen.size(), 0);
+
+            size_t iov = 0;
+            for (size_t i = 0; i < _sendMsgs.size(); ++i)
+            {
+                auto& msg = _sendMsgs[i];
+                msg.msg_iov = &_sendIov[iov];
+                msg.msg_iovlen = std::min(c_maxIovPerSend, _sendIov.size() - iov);
+                iov += msg.msg_iovlen;
+
+                auto sqe = GetSqe();
+                if (!sqe)
+                {
+                    // the chain is cut here, the rest goes with the next round
+                    _sendMsgs.resize(i);
+                    _sendLen.resize(i);
+                    _sendResult.resize(i);
+                    break;
+                }
+
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = _socketFd;
+                sqe->addr = (uint64_t)&msg;
+                sqe->len = 1;
+                sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+                sqe->user_data = c_sendOp | i;
+                if (i + 1 < _sendMsgs.size())
+                    sqe->flags = IOSQE_IO_LINK;
+                ++_inFlight;
+                ++_sendOps;
+            }
+
+            if (_sendOps)
+                Submit();
+            else
+                CompleteWrite(boost::asio::error::no_buffer_space);
+        }
+
+        void OnSent(const io_uring_cqe& cqe)
+        {
+            _sendResult[cqe.user_data & ~c_opMask] = cqe.res;
+            if (--_sendOps)
+                return;
+
+            // the chain is broken after a short or failed send, the next ones are canceled
+            boost::system::error_code ec;
+            size_t sent = 0;
+            for (size_t i = 0; i < _sendResult.size(); ++i)
+            {
+                const int res = _sendResult[i];
+                if (res > 0)
+                    sent += res;
+                if (res < 0 && res != -ECANCELED)
+                    ec = boost::system::error_code(-res, boost::system::system_category());
+                if (res < 0 || (size_t)res != _sendLen[i])
+                    break;
+            }
+            _writeDone += sent;
+
+            if (ec.failed())
+                CompleteWrite(ec);
+            else if (_writeCanceled)
+                CompleteWrite(boost::asio::error::operation_aborted);
+            else if (_writeDone == _writeTotal)
+                CompleteWrite({});
+            else if (!sent)
+                CompleteWrite(boost::asio::error::broken_pipe);
+            else
+                SubmitSends();
+        }
+
+        void CompleteWrite(const boost::system::error_code& ec)
+        {
+            _writeCanceled = false;
+            auto cb = std::move(_writeCb);
+            cb(ec, _writeDone);
+        }
+
+        // ISocketBackend
+    private:
+        void AsyncWrite(std::span<const boost::asio::const_buffer> buffers, IoCbT&& cb) override
+        {
+            assert(_strand.running_in_this_thread());
+            assert(!_writeCb);
+
+            _writeCb = std::move(cb);
+            _writeIov.clear();
+            _writeTotal = 0;
+            _writeDone = 0;
+            for (const auto& b : buffers)
+            {
+                if (!b.size())
+                    continue;
+                _writeIov.push_back({ const_cast<void*>(b.data()), b.size() });
+                _writeTotal += b.size();
+            }
+
+            if (!_writeTotal)
+            {
+                Post(std::move(_writeCb), {}, 0);
+                return;
+            }
+
+            SubmitSends();
+        }
+
+        bool EnableZeroCopy() override
+        {
+            return false;
+        }
+
+        bool IsZeroCopyEnabled() const override
+        {
+            return false;
+        }
+
+        void AsyncWriteZeroCopy(
+            std::span<const boost::asio::const_buffer> buffers, std::shared_ptr<const void>&& holder, IoCbT&& cb) override
+        {
+            AsyncWrite(buffers, std::move(cb));
+        }
+
+        void AsyncReadSome(boost::asio::mutable_buffer buffer, IoCbT&& cb) override
+        {
+            assert(_strand.running_in_this_thread());
+            assert(!_readCb);
+
+            _readBuffer = buffer;
+            _recvPaused = false;
+
+            if (auto bytes = TakeReceived())
+                Post(std::move(cb), {}, bytes);
+            else if (_received.empty() && _recvError.failed())
+                Post(std::move(cb), _recvError, 0);
+            else
+                _readCb = std::move(cb);
+
+            ArmRecv();
+        }
+
+        void Cancel() override
+        {
+            assert(_strand.running_in_this_thread());
+
+            if (_readCb)
+                Post(std::move(_readCb), boost::asio::error::operation_aborted, 0);
+
+            // the write completes once its sends are reaped, the kernel may read its buffers till then
+            if (_writeCb)
+                _writeCanceled = true;
+
+            if (_recvArmed || _sendOps)
+            {
+                _recvPaused = true;
+                SubmitCancel();
+            }
+        }
+
+        void Close() override
+        {
+            // the operations in flight keep the socket file referenced
+            AbortOperations();
+            boost::system::error_code ec;
+            if (_socket.is_open())
+                _socket.close(ec);
+        }
+    };
+}
+
+std::unique_ptr<ISocketBackend> MakeUringSocketBackend(
+    IConnection::strand_type& strand,
+    boost::asio::ip::tcp::socket& socket)
+{
+    auto backend = std::make_unique<UringSocketBackend>(strand, socket);
+    if (!backend->Init())
+        return nullptr;
+
+    LOG(trace) << "Using io_uring socket backend.";
+    return backend;
+}
+
+#else
+
+std::unique_ptr<ISocketBackend> MakeUringSocketBackend(
+    IConnection::strand_type& strand,
+    boost::asio::ip::tcp::socket& socket)
+{
+    return nullptr;
+}
+
+#endif